@@ -30,11 +30,15 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
+#include <kern/time.h>
 #include <lib.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <copyinout.h>
 #include <syscall.h>
+#include <trace.h>
+#include <syscallstats.h>
 
 
 /*
@@ -81,12 +85,17 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+	int fd;
+	off_t offset;
+	struct timespec start;
 
 	KASSERT(current_thread != NULL);
 	KASSERT(current_thread->t_curspl == 0);
 	KASSERT(current_thread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	TRACE(TRACE_SYSCALL, callno, 0);
+	SYSCALLSTATS_START(&start);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -109,6 +118,51 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_futex:
+		err = sys_futex((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+				tf->tf_a3, &retval);
+		break;
+
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_mmap:
+		/* fd and the (aligned) 64-bit offset are on the stack */
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &fd,
+			     sizeof(fd));
+		if (err) {
+			break;
+		}
+		err = copyin((const_userptr_t)(tf->tf_sp + 24), &offset,
+			     sizeof(offset));
+		if (err) {
+			break;
+		}
+		err = sys_mmap((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+			       tf->tf_a3, fd, offset, &retval);
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_msync:
+		err = sys_msync((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+
+	    case SYS_getrusage:
+		err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_getrlimit:
+		err = sys_getrlimit(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_setrlimit:
+		err = sys_setrlimit(tf->tf_a0, (const_userptr_t)tf->tf_a1);
+		break;
+
 	    /* Add stuff here */
 
 	    default:
@@ -140,6 +194,9 @@ syscall(struct trapframe *tf)
 
 	tf->tf_epc += 4;
 
+	SYSCALLSTATS_END(callno, err, &start);
+	TRACE(TRACE_SYSRET, callno, err);
+
 	/* Make sure the syscall code didn't forget to lower spl */
 	KASSERT(current_thread->t_curspl == 0);
 	/* ...or leak any spinlocks */
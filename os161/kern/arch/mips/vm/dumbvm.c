@@ -29,15 +29,22 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <spl.h>
 #include <cpu.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <thread.h>
+#include <wchan.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <pagecache.h>
+#include <trace.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,15 +66,62 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
+/* heap pages sbrk takes out of the TLBs per shootdown when shrinking */
+#define DUMBVM_SBRKBATCH     32
+
 /*
  * Wrap ram_stealmem in a spinlock.
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
+/*
+ * Single pages given back by shrinking heaps and destroyed address
+ * spaces. ram_stealmem can't take memory back, so these are kept on
+ * a list (linked through the first word of each page) and handed out
+ * again before stealing more.
+ *
+ * A lowest-priority thread moves them from dumbvm_freepages to
+ * dumbvm_zeropages, clearing them as it goes, so that pages that have
+ * to start out zeroed (heap and anonymous mmap pages) usually needn't
+ * be cleared in the fault handler. Other allocations take dirty pages
+ * first. The counters say how often a zeroed page was there when
+ * wanted.
+ *
+ * All protected by stealmem_lock.
+ */
+static paddr_t dumbvm_freepages;
+static unsigned dumbvm_nfreepages;
+static paddr_t dumbvm_zeropages;
+static unsigned dumbvm_nzeropages;
+static struct wchan *dumbvm_zerowchan;
+static unsigned dumbvm_zerohits;	/* zeroed page was ready */
+static unsigned dumbvm_zeromisses;	/* had to zero it ourselves */
+static unsigned dumbvm_zeroed;		/* pages zeroed in background */
+
+/*
+ * TLB statistics. These are bumped without locking on hot paths, so
+ * on a multiprocessor they may come up a little short.
+ */
+static unsigned dumbvm_fastfaults;	/* refilled from the software TLB */
+static unsigned dumbvm_slowfaults;	/* went through dumbvm_lookup */
+static unsigned dumbvm_lazyswitches;	/* as_activate with nothing to do */
+static unsigned dumbvm_tlbflushes;	/* as_activate that flushed */
+
+static void dumbvm_zerothread(void *, unsigned long);
+
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	int result;
+
+	dumbvm_zerowchan = wchan_create("pagezero");
+	if (dumbvm_zerowchan == NULL) {
+		panic("dumbvm: wchan_create failed\n");
+	}
+	result = thread_fork("pagezero", NULL, dumbvm_zerothread, NULL, 0);
+	if (result) {
+		panic("dumbvm: thread_fork failed: %s\n", strerror(result));
+	}
 }
 
 /*
@@ -90,6 +144,24 @@ dumbvm_can_sleep(void)
 	}
 }
 
+/*
+ * Pop a page off one of the free lists. Call with stealmem_lock held.
+ */
+static
+paddr_t
+dumbvm_poppage(paddr_t *list, unsigned *count)
+{
+	paddr_t addr;
+
+	addr = *list;
+	if (addr != 0) {
+		*list = *(paddr_t *)PADDR_TO_KVADDR(addr);
+		*(paddr_t *)PADDR_TO_KVADDR(addr) = 0;
+		(*count)--;
+	}
+	return addr;
+}
+
 static
 paddr_t
 getppages(unsigned long npages)
@@ -98,12 +170,141 @@ getppages(unsigned long npages)
 
 	spinlock_acquire(&stealmem_lock);
 
-	addr = ram_stealmem(npages);
+	addr = 0;
+	if (npages == 1) {
+		addr = dumbvm_poppage(&dumbvm_freepages, &dumbvm_nfreepages);
+		if (addr == 0) {
+			addr = dumbvm_poppage(&dumbvm_zeropages,
+					      &dumbvm_nzeropages);
+		}
+	}
+	if (addr == 0) {
+		addr = ram_stealmem(npages);
+	}
+
+	spinlock_release(&stealmem_lock);
+	return addr;
+}
+
+/*
+ * Get a single zero-filled page, preferably one the zeroing thread
+ * has already cleared.
+ */
+static
+paddr_t
+getzeroedpage(void)
+{
+	paddr_t addr;
 
+	spinlock_acquire(&stealmem_lock);
+	addr = dumbvm_poppage(&dumbvm_zeropages, &dumbvm_nzeropages);
+	if (addr != 0) {
+		dumbvm_zerohits++;
+	}
+	else {
+		dumbvm_zeromisses++;
+	}
 	spinlock_release(&stealmem_lock);
+
+	if (addr == 0) {
+		addr = getppages(1);
+		if (addr == 0) {
+			return 0;
+		}
+		bzero((void *)PADDR_TO_KVADDR(addr), PAGE_SIZE);
+	}
 	return addr;
 }
 
+/*
+ * Put a single page (from getppages(1)) on the free list.
+ */
+static
+void
+putppage(paddr_t addr)
+{
+	KASSERT(addr != 0 && (addr & PAGE_FRAME) == addr);
+
+	spinlock_acquire(&stealmem_lock);
+	*(paddr_t *)PADDR_TO_KVADDR(addr) = dumbvm_freepages;
+	dumbvm_freepages = addr;
+	dumbvm_nfreepages++;
+	if (dumbvm_zerowchan != NULL) {
+		wchan_wakeone(dumbvm_zerowchan, &stealmem_lock);
+	}
+	spinlock_release(&stealmem_lock);
+}
+
+/*
+ * The zeroing thread. It runs at the lowest priority, so it only gets
+ * the cpu when nothing else wants it. The page being cleared is off
+ * both lists, so nobody else can see it half done.
+ */
+static
+void
+dumbvm_zerothread(void *junk1, unsigned long junk2)
+{
+	paddr_t addr;
+
+	(void)junk1;
+	(void)junk2;
+
+	thread_setpriority(PRI_MIN);
+
+	spinlock_acquire(&stealmem_lock);
+	while (1) {
+		addr = dumbvm_poppage(&dumbvm_freepages, &dumbvm_nfreepages);
+		if (addr == 0) {
+			wchan_sleep(dumbvm_zerowchan, &stealmem_lock);
+			continue;
+		}
+		spinlock_release(&stealmem_lock);
+
+		bzero((void *)PADDR_TO_KVADDR(addr), PAGE_SIZE);
+
+		spinlock_acquire(&stealmem_lock);
+		/* Relink; the link word is cleared again when popped. */
+		*(paddr_t *)PADDR_TO_KVADDR(addr) = dumbvm_zeropages;
+		dumbvm_zeropages = addr;
+		dumbvm_nzeropages++;
+		dumbvm_zeroed++;
+	}
+}
+
+void
+vm_getstats(struct vm_stats *stats)
+{
+	spinlock_acquire(&stealmem_lock);
+	stats->vs_freepages = dumbvm_nfreepages + dumbvm_nzeropages;
+	stats->vs_zeropages = dumbvm_nzeropages;
+	stats->vs_zerohits = dumbvm_zerohits;
+	stats->vs_zeromisses = dumbvm_zeromisses;
+	stats->vs_zeroed = dumbvm_zeroed;
+	spinlock_release(&stealmem_lock);
+
+	stats->vs_fastfaults = dumbvm_fastfaults;
+	stats->vs_slowfaults = dumbvm_slowfaults;
+	stats->vs_tlbflushes = dumbvm_tlbflushes;
+	stats->vs_lazyswitches = dumbvm_lazyswitches;
+}
+
+void
+vm_printstats(void)
+{
+	struct vm_stats vs;
+
+	vm_getstats(&vs);
+	kprintf("dumbvm: %u free pages, %u of them zeroed\n",
+		vs.vs_freepages, vs.vs_zeropages);
+	kprintf("dumbvm: zeroed pages wanted: %u ready, %u zeroed on demand\n",
+		vs.vs_zerohits, vs.vs_zeromisses);
+	kprintf("dumbvm: %u pages zeroed in the background\n", vs.vs_zeroed);
+	kprintf("dumbvm: TLB faults: %u from the software TLB, %u slow\n",
+		vs.vs_fastfaults, vs.vs_slowfaults);
+	kprintf("dumbvm: address space switches: %u flushed, %u lazy\n",
+		vs.vs_tlbflushes, vs.vs_lazyswitches);
+}
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t
 alloc_kpages(unsigned npages)
@@ -132,25 +333,448 @@ coremap_used_bytes() {
 
 	/* dumbvm doesn't track page allocations. Return 0 so that khu works. */
 
-	return 0;
+	return 0;
+}
+
+/*
+ * Invalidate the given range. For small ranges probe for each page;
+ * past half the TLB it's cheaper to read every entry and check it.
+ */
+unsigned
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vaddr_t va, top;
+	uint32_t ehi, elo;
+	unsigned i, count;
+	int index, spl;
+
+	KASSERT((ts->ts_vaddr & PAGE_FRAME) == ts->ts_vaddr);
+
+	top = ts->ts_vaddr + ts->ts_npages * PAGE_SIZE;
+	count = 0;
+
+	spl = splhigh();
+	if (ts->ts_npages > NUM_TLB / 2) {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_read(&ehi, &elo, i);
+			va = ehi & TLBHI_VPAGE;
+			if ((elo & TLBLO_VALID) && va >= ts->ts_vaddr &&
+			    va < top) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+				count++;
+			}
+		}
+	}
+	else {
+		for (va = ts->ts_vaddr; va < top; va += PAGE_SIZE) {
+			index = tlb_probe(va, 0);
+			if (index >= 0) {
+				tlb_write(TLBHI_INVALID(index),
+					  TLBLO_INVALID(), index);
+				count++;
+			}
+		}
+	}
+	splx(spl);
+
+	return count;
+}
+
+unsigned
+vm_tlbshootdown_all(void)
+{
+	uint32_t ehi, elo;
+	unsigned i, count;
+	int spl;
+
+	count = 0;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if (elo & TLBLO_VALID) {
+			count++;
+		}
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+
+	return count;
+}
+
+/*
+ * Resident set accounting. Every page AS has in memory counts: the
+ * segments and stack (which are always there), heap pages that have
+ * been touched, and mmap pages, whether our own or the page cache's.
+ * (A cache page mapped by several processes counts against each.)
+ *
+ * Before a fault gives the current process another page, it goes
+ * through dumbvm_charge, which holds the process to its RLIMIT_RSS by
+ * replacing one of its own pages; other processes are never touched.
+ * With no swap, only file pages can go: they are handed back to the
+ * page cache (which writes them back if dirty) and get read in again
+ * when next touched. If nothing is left to replace, the fault fails.
+ */
+static
+void
+dumbvm_addresident(struct addrspace *as, unsigned npages)
+{
+	as->as_resident += npages;
+	if (as->as_resident > as->as_maxresident) {
+		as->as_maxresident = as->as_resident;
+	}
+}
+
+/*
+ * RLIMIT_RSS of the current process, in pages.
+ */
+static
+unsigned
+dumbvm_rsslimit(void)
+{
+	struct rlimit rl;
+	rlim_t npages;
+
+	proc_getrlimit(curproc, RLIMIT_RSS, &rl);
+	npages = rl.rlim_cur / PAGE_SIZE;
+	return npages > (unsigned)-1 ? (unsigned)-1 : (unsigned)npages;
+}
+
+/*
+ * Give up one file page of AS, going round its mmap regions clock
+ * fashion. Returns false if it has none.
+ */
+static
+bool
+dumbvm_evict(struct addrspace *as)
+{
+	struct tlbshootdown ts;
+	struct dumbvm_map *dm;
+	struct pcpage *pp;
+	unsigned i, j, pos, total;
+
+	/* Unused regions have dm_npages 0. */
+	total = 0;
+	for (i=0; i<DUMBVM_NMAPS; i++) {
+		total += as->as_maps[i].dm_npages;
+	}
+
+	for (pos=0; pos<total; pos++) {
+		j = (as->as_evicthand + pos) % total;
+		for (i=0; j >= as->as_maps[i].dm_npages; i++) {
+			j -= as->as_maps[i].dm_npages;
+		}
+		dm = &as->as_maps[i];
+		if (dm->dm_shared == NULL || dm->dm_shared[j] == NULL) {
+			continue;
+		}
+
+		as->as_evicthand = (as->as_evicthand + pos + 1) % total;
+		pp = dm->dm_shared[j];
+		dm->dm_shared[j] = NULL;
+
+		ts.ts_vaddr = dm->dm_base + j * PAGE_SIZE;
+		ts.ts_npages = 1;
+		ipi_tlbshootdown_sync(as, &ts);
+
+		pagecache_put(pp);
+		as->as_resident--;
+		as->as_evictions++;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Make room in AS (the current process's) for one more page and
+ * count it. Undo with as_resident-- if the page can't be had after
+ * all.
+ */
+static
+int
+dumbvm_charge(struct addrspace *as)
+{
+	unsigned limit;
+
+	limit = dumbvm_rsslimit();
+	while (as->as_resident >= limit) {
+		if (!dumbvm_evict(as)) {
+			return ENOMEM;
+		}
+	}
+	dumbvm_addresident(as, 1);
+	return 0;
+}
+
+/*
+ * Find (or, if it's never been touched, allocate) the page backing
+ * heap page number INDEX of AS.
+ */
+static
+int
+dumbvm_heappage(struct addrspace *as, unsigned index, paddr_t *ret)
+{
+	paddr_t pa;
+	int result;
+
+	KASSERT(index < as->as_heapslots);
+
+	pa = as->as_heappages[index];
+	if (pa == 0) {
+		result = dumbvm_charge(as);
+		if (result) {
+			return result;
+		}
+		pa = getzeroedpage();
+		if (pa == 0) {
+			as->as_resident--;
+			return ENOMEM;
+		}
+		as->as_heappages[index] = pa;
+		as->as_minflt++;
+	}
+	*ret = pa;
+	return 0;
+}
+
+/*
+ * Find the mmap region of AS containing VADDR, if any.
+ */
+static
+struct dumbvm_map *
+dumbvm_findmap(struct addrspace *as, vaddr_t vaddr)
+{
+	struct dumbvm_map *dm;
+	unsigned i;
+
+	for (i=0; i<DUMBVM_NMAPS; i++) {
+		dm = &as->as_maps[i];
+		if (dm->dm_base != 0 && vaddr >= dm->dm_base &&
+		    vaddr < dm->dm_base + dm->dm_npages * PAGE_SIZE) {
+			return dm;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find the page backing page INDEX of mmap region DM, for reading or
+ * (if WRITE) writing, and say whether it may be mapped writable.
+ *
+ * Pages of a file come from the page cache and are handed out
+ * read-only until written, so that the first store comes back here:
+ * for MAP_SHARED that marks the cache page dirty, and for MAP_PRIVATE
+ * it copies it into a page of our own. Anonymous pages are always
+ * our own, zero-filled when first touched.
+ *
+ * DM belongs to AS, which gets charged for pages coming in. A copy
+ * on write swaps one page for another, so it isn't charged.
+ */
+static
+int
+dumbvm_mappage(struct addrspace *as, struct dumbvm_map *dm, unsigned index,
+	       bool write, paddr_t *ret, bool *writable)
+{
+	struct pcpage *pp;
+	paddr_t pa;
+	int result;
+
+	KASSERT(index < dm->dm_npages);
+
+	if (dm->dm_prot == PROT_NONE ||
+	    (write && (dm->dm_prot & PROT_WRITE) == 0)) {
+		return EFAULT;
+	}
+
+	if (dm->dm_private[index] == 0 && dm->dm_vn == NULL) {
+		result = dumbvm_charge(as);
+		if (result) {
+			return result;
+		}
+		pa = getzeroedpage();
+		if (pa == 0) {
+			as->as_resident--;
+			return ENOMEM;
+		}
+		dm->dm_private[index] = pa;
+		as->as_minflt++;
+	}
+	if (dm->dm_private[index] != 0) {
+		*ret = dm->dm_private[index];
+		*writable = (dm->dm_prot & PROT_WRITE) != 0;
+		return 0;
+	}
+
+	pp = dm->dm_shared[index];
+	if (pp == NULL) {
+		result = dumbvm_charge(as);
+		if (result) {
+			return result;
+		}
+		result = pagecache_get(dm->dm_vn,
+				       dm->dm_offset + index * PAGE_SIZE, &pp);
+		if (result) {
+			as->as_resident--;
+			return result;
+		}
+		dm->dm_shared[index] = pp;
+		/* It may have been cached already; we can't tell. */
+		as->as_majflt++;
+	}
+
+	if (!write) {
+		*ret = pagecache_paddr(pp);
+		*writable = false;
+		return 0;
+	}
+
+	if (dm->dm_flags & MAP_SHARED) {
+		pagecache_dirty(pp);
+		*ret = pagecache_paddr(pp);
+		*writable = true;
+		return 0;
+	}
+
+	/* Private: copy on write. Our old read-only TLB entry gets replaced. */
+	pa = getppages(1);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(pa),
+		(const void *)PADDR_TO_KVADDR(pagecache_paddr(pp)), PAGE_SIZE);
+	dm->dm_private[index] = pa;
+	dm->dm_shared[index] = NULL;
+	pagecache_put(pp);
+	as->as_minflt++;
+
+	*ret = pa;
+	*writable = true;
+	return 0;
+}
+
+/*
+ * Find the physical address backing VADDR in AS, using the fixed
+ * segments dumbvm hands out, the heap, or the mmap regions, for
+ * reading or (if WRITE) writing. Sets WRITABLE if the page may be
+ * mapped writable; mmap pages sometimes may not be. Sets STABLE if
+ * the translation stays good until the region shrinks, so it can go
+ * in the software TLB; mmap pages change under us (copy on write,
+ * dirty tracking) so they aren't. Returns EFAULT if VADDR isn't in any
+ * region, or the access isn't allowed.
+ */
+static
+int
+dumbvm_lookup(struct addrspace *as, vaddr_t vaddr, bool write,
+	      paddr_t *ret, bool *writable, bool *stable)
+{
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	struct dumbvm_map *dm;
+	paddr_t pa;
+	int result;
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	stacktop = USERSTACK;
+
+	*writable = true;
+	*stable = true;
+
+	if (vaddr >= vbase1 && vaddr < vtop1) {
+		*ret = (vaddr - vbase1) + as->as_pbase1;
+	}
+	else if (vaddr >= vbase2 && vaddr < vtop2) {
+		*ret = (vaddr - vbase2) + as->as_pbase2;
+	}
+	else if (vaddr >= stackbase && vaddr < stacktop) {
+		*ret = (vaddr - stackbase) + as->as_stackpbase;
+	}
+	else if (vaddr >= as->as_heapbase && vaddr < as->as_heaptop) {
+		result = dumbvm_heappage(as,
+			(vaddr - as->as_heapbase) / PAGE_SIZE, &pa);
+		if (result) {
+			return result;
+		}
+		*ret = pa + (vaddr & ~(vaddr_t)PAGE_FRAME);
+	}
+	else if ((dm = dumbvm_findmap(as, vaddr)) != NULL) {
+		*stable = false;
+		result = dumbvm_mappage(as, dm,
+					(vaddr - dm->dm_base) / PAGE_SIZE,
+					write, &pa, writable);
+		if (result) {
+			return result;
+		}
+		*ret = pa + (vaddr & ~(vaddr_t)PAGE_FRAME);
+	}
+	else {
+		return EFAULT;
+	}
+	return 0;
+}
+
+/*
+ * Put a translation in the TLB: over the old entry for the page if
+ * there is one (a store to a read-only page), otherwise in a random
+ * slot. The hardware's random register never picks the wired slots.
+ */
+static
+void
+dumbvm_tlbload(vaddr_t vaddr, uint32_t elo)
+{
+	int index, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	index = tlb_probe(vaddr, 0);
+	if (index >= 0) {
+		tlb_write(vaddr, elo, index);
+	}
+	else {
+		tlb_random(vaddr, elo);
+	}
+
+	splx(spl);
 }
 
-void
-vm_tlbshootdown(const struct tlbshootdown *ts)
+/*
+ * Check that heap page VADDR of AS, looked up as PADDR, hasn't been
+ * taken away by as_sbrk since. Call at splhigh: as_sbrk drops the
+ * page from the heap before it shoots down the TLBs, and can't free
+ * it until this cpu has taken the shootdown, so a page still present
+ * here is safe to load until the spl comes down. This also catches
+ * software TLB entries filled in after as_sbrk cleared it. Other
+ * pages always pass.
+ */
+static
+bool
+dumbvm_stillthere(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	KASSERT(current_thread->t_curspl > 0);
+
+	if (vaddr < as->as_heapbase || vaddr >= as->as_mapbase) {
+		return true;
+	}
+	if (vaddr >= as->as_heaptop) {
+		return false;
+	}
+	return as->as_heappages[(vaddr - as->as_heapbase) / PAGE_SIZE]
+		== (paddr & PAGE_FRAME);
 }
 
+static
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+dumbvm_fault(int faulttype, vaddr_t faultaddress)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
+	uint32_t elo;
 	struct addrspace *as;
-	int spl;
+	struct dumbvm_stlbent *ste;
+	bool writable, stable;
+	int result, spl;
 
 	faultaddress &= PAGE_FRAME;
 
@@ -158,8 +782,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
+		/* Only mmap pages are ever mapped read-only. */
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -185,6 +808,23 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
+	/*
+	 * Fast path: a translation we've handed out before. Only TLB
+	 * misses; a store to a read-only page needs the full path.
+	 */
+	ste = &as->as_stlb[(faultaddress / PAGE_SIZE) % DUMBVM_STLBSIZE];
+	spl = splhigh();
+	if (faulttype != VM_FAULT_READONLY && ste->ste_vaddr == faultaddress &&
+	    (ste->ste_elo & TLBLO_VALID) &&
+	    dumbvm_stillthere(as, faultaddress, ste->ste_elo & PAGE_FRAME)) {
+		dumbvm_fastfaults++;
+		dumbvm_tlbload(faultaddress, ste->ste_elo);
+		splx(spl);
+		return 0;
+	}
+	splx(spl);
+	dumbvm_slowfaults++;
+
 	/* Assert that the address space has been set up properly. */
 	KASSERT(as->as_vbase1 != 0);
 	KASSERT(as->as_pbase1 != 0);
@@ -199,48 +839,64 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
 	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
 
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
-	}
-	else {
-		return EFAULT;
-	}
-
-	/* make sure it's page-aligned */
-	KASSERT((paddr & PAGE_FRAME) == paddr);
+	while (1) {
+		result = dumbvm_lookup(as, faultaddress,
+				       faulttype != VM_FAULT_READ,
+				       &paddr, &writable, &stable);
+		if (result) {
+			return result;
+		}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+		/* make sure it's page-aligned */
+		KASSERT((paddr & PAGE_FRAME) == paddr);
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
+		/*
+		 * The lookup may have slept; if as_sbrk shrank the heap
+		 * meanwhile, the page may be gone. Look again.
+		 */
+		spl = splhigh();
+		if (dumbvm_stillthere(as, faultaddress, paddr)) {
+			break;
 		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
 		splx(spl);
-		return 0;
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+	elo = paddr | (writable ? TLBLO_DIRTY : 0) | TLBLO_VALID;
+	if (stable) {
+		ste->ste_vaddr = faultaddress;
+		ste->ste_elo = elo;
+	}
+	dumbvm_tlbload(faultaddress, elo);
 	splx(spl);
-	return EFAULT;
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	int result;
+
+	TRACE(TRACE_FAULT, faultaddress, faulttype);
+	result = dumbvm_fault(faulttype, faultaddress);
+	TRACE(TRACE_FAULTDONE, faultaddress, result);
+	return result;
+}
+
+int
+vm_translate(vaddr_t vaddr, paddr_t *ret)
+{
+	struct addrspace *as;
+	bool writable, stable;
+
+	if (curproc == NULL) {
+		return EFAULT;
+	}
+	as = proc_getas();
+	if (as == NULL || as->as_stackpbase == 0) {
+		return EFAULT;
+	}
+	return dumbvm_lookup(as, vaddr, false, ret, &writable, &stable);
 }
 
 struct addrspace *
@@ -258,14 +914,82 @@ as_create(void)
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
+	as->as_heapbase = 0;
+	as->as_heaptop = 0;
+	as->as_heappages = NULL;
+	as->as_heapslots = 0;
+	bzero(as->as_maps, sizeof(as->as_maps));
+	bzero(as->as_stlb, sizeof(as->as_stlb));
+	as->as_mapbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	as->as_resident = 0;
+	as->as_maxresident = 0;
+	as->as_minflt = 0;
+	as->as_majflt = 0;
+	as->as_evictions = 0;
+	as->as_evicthand = 0;
 
 	return as;
 }
 
+/*
+ * Let go of everything mmap region DM holds and mark it unused. The
+ * caller takes care of the TLB. Returns the number of pages that were
+ * resident.
+ */
+static
+unsigned
+dumbvm_unmap(struct dumbvm_map *dm)
+{
+	unsigned i, count;
+
+	count = 0;
+	for (i=0; i<dm->dm_npages; i++) {
+		if (dm->dm_private != NULL && dm->dm_private[i] != 0) {
+			putppage(dm->dm_private[i]);
+			count++;
+		}
+		if (dm->dm_shared != NULL && dm->dm_shared[i] != NULL) {
+			pagecache_put(dm->dm_shared[i]);
+			count++;
+		}
+	}
+	kfree(dm->dm_private);
+	kfree(dm->dm_shared);
+	if (dm->dm_vn != NULL) {
+		VOP_DECREF(dm->dm_vn);
+	}
+	bzero(dm, sizeof(*dm));
+	return count;
+}
+
 void
 as_destroy(struct addrspace *as)
 {
+	struct tlbshootdown ts;
+	unsigned i;
+
 	dumbvm_can_sleep();
+
+	/*
+	 * Flush cpus that still have AS as c_curas, so that another
+	 * address space allocated at the same place doesn't inherit
+	 * our entries (see as_activate).
+	 */
+	ts.ts_vaddr = 0;
+	ts.ts_npages = USERSPACETOP / PAGE_SIZE;
+	ipi_tlbshootdown_sync(as, &ts);
+
+	for (i=0; i<DUMBVM_NMAPS; i++) {
+		if (as->as_maps[i].dm_base != 0) {
+			dumbvm_unmap(&as->as_maps[i]);
+		}
+	}
+	for (i=0; i<as->as_heapslots; i++) {
+		if (as->as_heappages[i] != 0) {
+			putppage(as->as_heappages[i]);
+		}
+	}
+	kfree(as->as_heappages);
 	kfree(as);
 }
 
@@ -280,6 +1004,27 @@ as_activate(void)
 		return;
 	}
 
+	/*
+	 * If this cpu's TLB already belongs to AS (we're back from a
+	 * kernel-only thread, say) everything in it is still good:
+	 * changes to AS shoot down every cpu that has it as c_curas,
+	 * whatever it's running. So there's no need for ASIDs to skip
+	 * the flush.
+	 */
+	if (curcpu->c_curas == as) {
+		dumbvm_lazyswitches++;
+		return;
+	}
+	dumbvm_tlbflushes++;
+
+	/*
+	 * Publish the new address space before flushing, so a
+	 * shootdown for it either sees us in c_curas or happened
+	 * before the flush (see ipi_tlbshootdown_sync).
+	 */
+	curcpu->c_curas = as;
+	membar_any_any();
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
@@ -318,6 +1063,12 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	(void)writeable;
 	(void)executable;
 
+	/* The heap starts out empty, just past the highest region. */
+	if (vaddr + sz > as->as_heapbase) {
+		KASSERT(as->as_heaptop == as->as_heapbase);
+		as->as_heapbase = as->as_heaptop = vaddr + sz;
+	}
+
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
@@ -372,6 +1123,10 @@ as_prepare_load(struct addrspace *as)
 	as_zero_region(as->as_pbase2, as->as_npages2);
 	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
 
+	/* These are always resident, whatever the limit says. */
+	dumbvm_addresident(as, as->as_npages1 + as->as_npages2 +
+			   DUMBVM_STACKPAGES);
+
 	return 0;
 }
 
@@ -392,10 +1147,97 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Make sure AS's heap page table has room for NPAGES pages.
+ */
+static
+int
+dumbvm_heapslots(struct addrspace *as, unsigned npages)
+{
+	paddr_t *newpages;
+	unsigned i, newslots;
+
+	if (npages <= as->as_heapslots) {
+		return 0;
+	}
+
+	newslots = as->as_heapslots ? as->as_heapslots : 16;
+	while (newslots < npages) {
+		newslots *= 2;
+	}
+	newpages = kmalloc(newslots * sizeof(paddr_t));
+	if (newpages == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<newslots; i++) {
+		newpages[i] = i < as->as_heapslots ? as->as_heappages[i] : 0;
+	}
+	kfree(as->as_heappages);
+	as->as_heappages = newpages;
+	as->as_heapslots = newslots;
+	return 0;
+}
+
+/*
+ * Set up mmap region NEW as a copy of OLD, for as_copy. Cache pages
+ * are shared (for MAP_PRIVATE, until either side writes); our own
+ * pages are copied, so anonymous memory isn't shared even with
+ * MAP_SHARED.
+ */
+static
+int
+dumbvm_copymap(struct dumbvm_map *old, struct dumbvm_map *new)
+{
+	struct pcpage *pp;
+	unsigned i;
+
+	*new = *old;
+	new->dm_shared = NULL;
+	new->dm_private = kmalloc(old->dm_npages * sizeof(paddr_t));
+	if (new->dm_private == NULL) {
+		bzero(new, sizeof(*new));
+		return ENOMEM;
+	}
+	bzero(new->dm_private, old->dm_npages * sizeof(paddr_t));
+	if (new->dm_vn != NULL) {
+		VOP_INCREF(new->dm_vn);
+		new->dm_shared = kmalloc(old->dm_npages * sizeof(pp));
+		if (new->dm_shared == NULL) {
+			dumbvm_unmap(new);
+			return ENOMEM;
+		}
+		bzero(new->dm_shared, old->dm_npages * sizeof(pp));
+	}
+
+	for (i=0; i<old->dm_npages; i++) {
+		if (old->dm_private[i] != 0) {
+			new->dm_private[i] = getppages(1);
+			if (new->dm_private[i] == 0) {
+				dumbvm_unmap(new);
+				return ENOMEM;
+			}
+			memmove((void *)PADDR_TO_KVADDR(new->dm_private[i]),
+				(const void *)PADDR_TO_KVADDR(old->dm_private[i]),
+				PAGE_SIZE);
+		}
+		else if (old->dm_shared != NULL && old->dm_shared[i] != NULL) {
+			if (pagecache_get(old->dm_vn,
+					  old->dm_offset + i * PAGE_SIZE, &pp)) {
+				dumbvm_unmap(new);
+				return ENOMEM;
+			}
+			KASSERT(pp == old->dm_shared[i]);
+			new->dm_shared[i] = pp;
+		}
+	}
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+	unsigned i;
 
 	dumbvm_can_sleep();
 
@@ -431,6 +1273,316 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
 
+	/* Copy only the heap pages that have been touched. */
+	new->as_heapbase = old->as_heapbase;
+	new->as_heaptop = old->as_heapbase;
+	if (dumbvm_heapslots(new, old->as_heapslots)) {
+		as_destroy(new);
+		return ENOMEM;
+	}
+	new->as_heaptop = old->as_heaptop;
+	for (i=0; i<old->as_heapslots; i++) {
+		if (old->as_heappages[i] == 0) {
+			continue;
+		}
+		new->as_heappages[i] = getppages(1);
+		if (new->as_heappages[i] == 0) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(new->as_heappages[i]),
+			(const void *)PADDR_TO_KVADDR(old->as_heappages[i]),
+			PAGE_SIZE);
+	}
+
+	new->as_mapbase = old->as_mapbase;
+	for (i=0; i<DUMBVM_NMAPS; i++) {
+		if (old->as_maps[i].dm_base == 0) {
+			continue;
+		}
+		if (dumbvm_copymap(&old->as_maps[i], &new->as_maps[i])) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+	}
+
+	/* Everything resident in OLD now is in NEW too. */
+	new->as_resident = old->as_resident;
+	new->as_maxresident = old->as_resident;
+
 	*ret = new;
 	return 0;
 }
+
+/*
+ * Move the break of AS by AMOUNT, which must keep it page-aligned,
+ * handing back the old break. Growing only makes room in the heap
+ * page table; pages get memory when they're first touched (see
+ * dumbvm_heappage). Shrinking knocks the pages past the new break out
+ * of every TLB and then gives them back to the free list.
+ *
+ * The heap may grow up to the lowest mmap region, or the bottom of
+ * the stack if there isn't one.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct tlbshootdown ts;
+	paddr_t batch[DUMBVM_SBRKBATCH];
+	vaddr_t newtop;
+	unsigned i, j, n, nfree, oldpages, newpages;
+
+	dumbvm_can_sleep();
+
+	if (amount % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+
+	*oldbreak = as->as_heaptop;
+	oldpages = (as->as_heaptop - as->as_heapbase) / PAGE_SIZE;
+
+	if (amount < 0) {
+		if ((vaddr_t)-amount > as->as_heaptop - as->as_heapbase) {
+			return EINVAL;
+		}
+		newtop = as->as_heaptop + amount;
+		newpages = (newtop - as->as_heapbase) / PAGE_SIZE;
+
+		/* From here on, faults past the new break fail. */
+		as->as_heaptop = newtop;
+
+		/*
+		 * Another cpu may still have the pages in its TLB, so
+		 * they can't be freed until it's been shot down. Take
+		 * them out of the page table a batch at a time, shoot
+		 * the batch down, and only then free it.
+		 */
+		for (i=newpages; i<oldpages; i += n) {
+			n = oldpages - i;
+			if (n > DUMBVM_SBRKBATCH) {
+				n = DUMBVM_SBRKBATCH;
+			}
+			nfree = 0;
+			for (j=0; j<n; j++) {
+				if (as->as_heappages[i + j] != 0) {
+					batch[nfree++] = as->as_heappages[i + j];
+					as->as_heappages[i + j] = 0;
+				}
+			}
+
+			/* Cheaper to forget everything than hunt. */
+			bzero(as->as_stlb, sizeof(as->as_stlb));
+			ts.ts_vaddr = as->as_heapbase + i * PAGE_SIZE;
+			ts.ts_npages = n;
+			ipi_tlbshootdown_sync(as, &ts);
+
+			for (j=0; j<nfree; j++) {
+				putppage(batch[j]);
+				as->as_resident--;
+			}
+		}
+		return 0;
+	}
+
+	if ((vaddr_t)amount > as->as_mapbase - as->as_heaptop) {
+		return ENOMEM;
+	}
+	newtop = as->as_heaptop + amount;
+	newpages = (newtop - as->as_heapbase) / PAGE_SIZE;
+	if (dumbvm_heapslots(as, newpages)) {
+		return ENOMEM;
+	}
+	as->as_heaptop = newtop;
+	return 0;
+}
+
+/*
+ * Set up an mmap region. Regions are stacked downward from the bottom
+ * of the stack, wherever the lowest one ends; the address hint of
+ * mmap() isn't used. Nothing is read in until it's touched (see
+ * dumbvm_mappage).
+ */
+int
+as_mmap(struct addrspace *as, struct vnode *vn, off_t offset, size_t len,
+	int prot, int flags, vaddr_t *ret)
+{
+	struct dumbvm_map *dm;
+	size_t npages;
+	unsigned i;
+	int result;
+
+	dumbvm_can_sleep();
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if ((flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANON)) != 0 ||
+	    (flags & (MAP_SHARED | MAP_PRIVATE)) == 0 ||
+	    (flags & (MAP_SHARED | MAP_PRIVATE)) ==
+	    (MAP_SHARED | MAP_PRIVATE)) {
+		return EINVAL;
+	}
+	if ((flags & MAP_ANON) ? vn != NULL : vn == NULL) {
+		return EINVAL;
+	}
+	if (vn != NULL) {
+		result = VOP_MMAP(vn, prot);
+		if (result) {
+			return result;
+		}
+	}
+
+	if (len > as->as_mapbase - as->as_heaptop) {
+		return ENOMEM;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	dm = NULL;
+	for (i=0; i<DUMBVM_NMAPS; i++) {
+		if (as->as_maps[i].dm_base == 0) {
+			dm = &as->as_maps[i];
+			break;
+		}
+	}
+	if (dm == NULL) {
+		return ENOMEM;
+	}
+
+	dm->dm_private = kmalloc(npages * sizeof(paddr_t));
+	if (dm->dm_private == NULL) {
+		return ENOMEM;
+	}
+	bzero(dm->dm_private, npages * sizeof(paddr_t));
+	if (vn != NULL) {
+		dm->dm_shared = kmalloc(npages * sizeof(struct pcpage *));
+		if (dm->dm_shared == NULL) {
+			kfree(dm->dm_private);
+			dm->dm_private = NULL;
+			return ENOMEM;
+		}
+		bzero(dm->dm_shared, npages * sizeof(struct pcpage *));
+		VOP_INCREF(vn);
+	}
+
+	dm->dm_base = as->as_mapbase - npages * PAGE_SIZE;
+	dm->dm_npages = npages;
+	dm->dm_prot = prot;
+	dm->dm_flags = flags;
+	dm->dm_vn = vn;
+	dm->dm_offset = offset;
+	as->as_mapbase = dm->dm_base;
+
+	*ret = dm->dm_base;
+	return 0;
+}
+
+/*
+ * Remove an mmap region. Only whole regions can be unmapped. Dirty
+ * shared pages are written back first (ignoring errors: they stay
+ * dirty, for whoever maps them next or sync). Address space is only
+ * reused once every region is gone.
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct tlbshootdown ts;
+	struct dumbvm_map *dm;
+	unsigned i;
+
+	dumbvm_can_sleep();
+
+	dm = dumbvm_findmap(as, addr);
+	if (dm == NULL || addr != dm->dm_base ||
+	    len > dm->dm_npages * PAGE_SIZE ||
+	    len <= (dm->dm_npages - 1) * PAGE_SIZE) {
+		return EINVAL;
+	}
+
+	if (dm->dm_vn != NULL && (dm->dm_flags & MAP_SHARED)) {
+		/*result =*/ pagecache_flush(dm->dm_vn, dm->dm_offset,
+			dm->dm_offset + dm->dm_npages * PAGE_SIZE);
+	}
+
+	ts.ts_vaddr = dm->dm_base;
+	ts.ts_npages = dm->dm_npages;
+	ipi_tlbshootdown_sync(as, &ts);
+
+	as->as_resident -= dumbvm_unmap(dm);
+	as->as_evicthand = 0;
+
+	for (i=0; i<DUMBVM_NMAPS; i++) {
+		if (as->as_maps[i].dm_base != 0) {
+			return 0;
+		}
+	}
+	as->as_mapbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Write back the dirty shared file pages in [ADDR, ADDR+LEN). Every
+ * page in the range must be in some mmap region. MS_ASYNC is done
+ * synchronously too.
+ */
+int
+as_msync(struct addrspace *as, vaddr_t addr, size_t len, int flags)
+{
+	struct dumbvm_map *dm;
+	vaddr_t va, top, end;
+	int result;
+
+	dumbvm_can_sleep();
+
+	if ((addr & PAGE_FRAME) != addr ||
+	    (flags & ~(MS_ASYNC | MS_SYNC)) != 0 ||
+	    flags == (MS_ASYNC | MS_SYNC)) {
+		return EINVAL;
+	}
+	if (len > USERSPACETOP - addr) {
+		return ENOMEM;
+	}
+	end = addr + len;
+
+	for (va = addr; va < end; va = top) {
+		dm = dumbvm_findmap(as, va);
+		if (dm == NULL) {
+			return ENOMEM;
+		}
+		top = dm->dm_base + dm->dm_npages * PAGE_SIZE;
+		if (top > end) {
+			top = end;
+		}
+		if (dm->dm_vn == NULL || (dm->dm_flags & MAP_SHARED) == 0) {
+			continue;
+		}
+		result = pagecache_flush(dm->dm_vn,
+					 dm->dm_offset + (va - dm->dm_base),
+					 dm->dm_offset + (top - dm->dm_base));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * dumbvm has no swap, so au_swapped is always 0.
+ */
+void
+as_getusage(struct addrspace *as, struct as_usage *ret)
+{
+	unsigned i;
+
+	ret->au_virtual = as->as_npages1 + as->as_npages2 +
+		DUMBVM_STACKPAGES +
+		(as->as_heaptop - as->as_heapbase) / PAGE_SIZE;
+	for (i=0; i<DUMBVM_NMAPS; i++) {
+		ret->au_virtual += as->as_maps[i].dm_npages;
+	}
+	ret->au_resident = as->as_resident;
+	ret->au_maxresident = as->as_maxresident;
+	ret->au_swapped = 0;
+	ret->au_minflt = as->as_minflt;
+	ret->au_majflt = as->as_majflt;
+	ret->au_evictions = as->as_evictions;
+}
@@ -35,6 +35,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <clock.h>
+#include <prof.h>
 #include <thread.h>
 #include <current.h>
 #include <membar.h>
@@ -316,6 +317,9 @@ mainbus_interrupt(struct trapframe *tf)
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
 		mips_timer_set(CPU_FREQUENCY / HZ);
+		/* sample for the profiler, which needs the trapframe */
+		prof_sample(tf->tf_epc, tf->tf_ra,
+			    (tf->tf_status & CST_KUp) != 0);
 		/* and call hardclock */
 		hardclock();
 		seen = true;
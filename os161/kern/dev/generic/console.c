@@ -55,6 +55,7 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -109,28 +110,139 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * Start sending the next queued character, if there is one and the
+ * device isn't busy.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	unsigned tail;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+
+	if (cs->cs_outsending || cs->cs_outcount == 0) {
+		return;
+	}
+	tail = (cs->cs_outhead + CONSOLE_OUTPUT_BUFFER_SIZE - cs->cs_outcount)
+		% CONSOLE_OUTPUT_BUFFER_SIZE;
+	cs->cs_outcount--;
+	cs->cs_outsending = true;
+	cs->cs_send(cs->cs_devdata, cs->cs_outbuf[tail]);
+}
+
+/*
+ * Add a character to the output ring, waiting for space if it's full.
+ */
+static
+void
+con_queue(struct con_softc *cs, int ch)
+{
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+
+	while (cs->cs_outcount == CONSOLE_OUTPUT_BUFFER_SIZE) {
+		con_kick(cs);
+		wchan_sleep(cs->cs_outwchan, &cs->cs_outlock);
+	}
+	cs->cs_outbuf[cs->cs_outhead] = ch;
+	cs->cs_outhead = (cs->cs_outhead + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	cs->cs_outcount++;
+}
+
+/*
+ * Queue a buffer of user output, turning newlines into CR-LF.
+ */
+static
+void
+con_write(struct con_softc *cs, const char *data, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_outlock);
+	for (i=0; i<len; i++) {
+		if (data[i] == '\n') {
+			con_queue(cs, '\r');
+		}
+		con_queue(cs, data[i]);
+	}
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
+}
+
+//////////////////////////////////////////////////
+
+/*
+ * Send whatever is in the output ring, by polling. The caller holds
+ * the output lock, or is panicking.
+ */
+static
+void
+con_drain(struct con_softc *cs)
+{
+	unsigned tail;
+
+	while (cs->cs_outcount > 0) {
+		tail = (cs->cs_outhead + CONSOLE_OUTPUT_BUFFER_SIZE
+			- cs->cs_outcount) % CONSOLE_OUTPUT_BUFFER_SIZE;
+		cs->cs_outcount--;
+		cs->cs_sendpolled(cs->cs_devdata, cs->cs_outbuf[tail]);
+	}
+}
+
 /*
  * Print a character, using polling instead of interrupts to wait for
  * I/O completion.
+ *
+ * Anything still in the output ring goes out first, so output stays
+ * in order; this is also what flushes the ring when the system shuts
+ * down or panics, since both end up printing with interrupts off. If
+ * we already hold the output lock (we panicked inside the console
+ * code) just send the character. Once a panic has started, the lock
+ * may be held by a cpu that's been stopped, so drain the ring without
+ * it.
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	bool wasfull;
+
+	if (spinlock_do_i_hold(&cs->cs_outlock)) {
+		cs->cs_sendpolled(cs->cs_devdata, ch);
+		return;
+	}
+
+	if (panicstart) {
+		con_drain(cs);
+		cs->cs_sendpolled(cs->cs_devdata, ch);
+		return;
+	}
+
+	spinlock_acquire(&cs->cs_outlock);
+	wasfull = cs->cs_outcount == CONSOLE_OUTPUT_BUFFER_SIZE;
+	con_drain(cs);
 	cs->cs_sendpolled(cs->cs_devdata, ch);
+	if (wasfull) {
+		wchan_wakeall(cs->cs_outwchan, &cs->cs_outlock);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
 
 /*
  * Print a character, using interrupts to wait for I/O completion.
+ * This only waits if the output ring is full.
  */
 static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	spinlock_acquire(&cs->cs_outlock);
+	con_queue(cs, ch);
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
 }
 
 /*
@@ -178,13 +290,21 @@ con_input(void *vcs, int ch)
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next character, and once the ring is down to half full
+ * let any writers waiting for space continue.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outsending = false;
+	con_kick(cs);
+	if (cs->cs_outcount <= CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		wchan_wakeall(cs->cs_outwchan, &cs->cs_outlock);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -244,12 +364,12 @@ static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
 	int result;
 	char ch;
+	size_t len;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -260,8 +380,8 @@ con_io(struct device *dev, struct uio *uio)
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
-	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
+	if (uio->uio_rw==UIO_READ) {
+		while (uio->uio_resid > 0) {
 			ch = getch();
 			if (ch=='\r') {
 				ch = '\n';
@@ -275,16 +395,23 @@ con_io(struct device *dev, struct uio *uio)
 				break;
 			}
 		}
-		else {
-			result = uiomove(&ch, 1, uio);
+	}
+	else {
+		/*
+		 * Copy the output in as large pieces as we can and
+		 * queue each piece in one go.
+		 */
+		while (uio->uio_resid > 0) {
+			len = uio->uio_resid;
+			if (len > sizeof(cs->cs_iobuf)) {
+				len = sizeof(cs->cs_iobuf);
+			}
+			result = uiomove(cs->cs_iobuf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+			con_write(cs, cs->cs_iobuf, len);
 		}
 	}
 	lock_release(lk);
@@ -343,7 +470,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *wc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -363,30 +491,35 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	wc = wchan_create("console output");
+	if (wc == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wc);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
 
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = wc;
+	cs->cs_outhead = 0;
+	cs->cs_outcount = 0;
+	cs->cs_outsending = false;
+
 	the_console = cs;
 	con_userlock_read = rlk;
 	con_userlock_write = wlk;
@@ -30,14 +30,27 @@
 #ifndef _GENERIC_CONSOLE_H_
 #define _GENERIC_CONSOLE_H_
 
+#include <spinlock.h>
+
+struct wchan;	/* from <wchan.h> */
+
 /*
  * Device data for the hardware-independent system console.
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * Output goes through a ring buffer, cs_outbuf. Writers add to it
+ * and the device's write-done interrupt (con_start) sends the next
+ * character, so writers only wait when the ring is full.
+ * cs_outsending is true while the device has a character in flight.
+ * The output fields are protected by cs_outlock; cs_iobuf is only
+ * used by con_io, under the console write lock.
  */
 
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 4096
+#define CONSOLE_IO_BUFFER_SIZE 512
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -47,10 +60,17 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	struct spinlock cs_outlock;
+	struct wchan *cs_outwchan;	/* writers waiting for space */
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outhead;		/* next slot to put a char in */
+	unsigned cs_outcount;		/* chars waiting to be sent */
+	bool cs_outsending;		/* device is busy */
+	char cs_iobuf[CONSOLE_IO_BUFFER_SIZE];
 };
 
 /*
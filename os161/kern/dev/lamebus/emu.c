@@ -52,6 +52,7 @@
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <pagecache.h>
 #include <emufs.h>
 #include "autoconf.h"
 
@@ -262,7 +263,8 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 }
 
 /*
- * Common code for read and readdir.
+ * Common code for read and readdir. The caller may already hold the
+ * device lock (the read cache does, so it can fill itself atomically).
  */
 static
 int
@@ -270,6 +272,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	   uint32_t op, struct uio *uio)
 {
 	int result;
+	bool mine;
 
 	KASSERT(uio->uio_rw == UIO_READ);
 
@@ -278,7 +281,10 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return 0;
 	}
 
-	lock_acquire(sc->e_lock);
+	mine = lock_do_i_hold(sc->e_lock);
+	if (!mine) {
+		lock_acquire(sc->e_lock);
+	}
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
@@ -295,7 +301,9 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
 
  out:
-	lock_release(sc->e_lock);
+	if (!mine) {
+		lock_release(sc->e_lock);
+	}
 	return result;
 }
 
@@ -351,6 +359,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
 	result = emu_waitdone(sc);
+	sc->e_gen++;
 
  out:
 	lock_release(sc->e_lock);
@@ -359,14 +368,19 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 /*
  * Get the file size associated with a hardware-level file handle.
+ * The caller may already hold the device lock.
  */
 static
 int
 emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 {
 	int result;
+	bool mine;
 
-	lock_acquire(sc->e_lock);
+	mine = lock_do_i_hold(sc->e_lock);
+	if (!mine) {
+		lock_acquire(sc->e_lock);
+	}
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
@@ -375,7 +389,9 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 		*retval = emu_rreg(sc, REG_IOLEN);
 	}
 
-	lock_release(sc->e_lock);
+	if (!mine) {
+		lock_release(sc->e_lock);
+	}
 	return result;
 }
 
@@ -396,6 +412,7 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 	emu_wreg(sc, REG_IOLEN, len);
 	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
 	result = emu_waitdone(sc);
+	sc->e_gen++;
 
 	lock_release(sc->e_lock);
 	return result;
@@ -414,6 +431,106 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 static int emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 			   struct emufs_vnode **ret);
 
+/*
+ * Name cache slot for looking up NAME in DIR.
+ */
+static
+struct emufs_ncentry *
+emufs_nc_slot(struct emufs_fs *ef, struct emufs_vnode *dir, const char *name)
+{
+	uint32_t h;
+
+	h = dir->ev_handle * 31;
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return &ef->ef_ncache[h % EMUFS_NCACHE];
+}
+
+/*
+ * Look NAME up in the name cache. Returns the vnode with a new
+ * reference, or NULL.
+ */
+static
+struct emufs_vnode *
+emufs_nc_find(struct emufs_fs *ef, struct emufs_vnode *dir, const char *name)
+{
+	struct emufs_ncentry *nc;
+	struct emufs_vnode *ev = NULL;
+
+	vfs_biglock_acquire();
+	nc = emufs_nc_slot(ef, dir, name);
+	if (nc->nc_vn != NULL && nc->nc_dir == dir &&
+	    !strcmp(nc->nc_name, name)) {
+		ev = nc->nc_vn;
+		VOP_INCREF(&ev->ev_v);
+	}
+	vfs_biglock_release();
+	return ev;
+}
+
+/*
+ * Drop a name cache entry. The references it held are released,
+ * which may reclaim the vnodes, so the caller must not hold e_lock.
+ */
+static
+void
+emufs_nc_drop(struct emufs_ncentry *nc)
+{
+	struct emufs_vnode *dir, *ev;
+
+	dir = nc->nc_dir;
+	ev = nc->nc_vn;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+	if (ev != NULL) {
+		VOP_DECREF(&ev->ev_v);
+		VOP_DECREF(&dir->ev_v);
+	}
+}
+
+/*
+ * Remember that NAME in DIR is EV, replacing whatever was in the slot.
+ * Names too long to fit aren't cached.
+ */
+static
+void
+emufs_nc_enter(struct emufs_fs *ef, struct emufs_vnode *dir, const char *name,
+	       struct emufs_vnode *ev)
+{
+	struct emufs_ncentry *nc;
+
+	if (strlen(name) + 1 > EMUFS_NCNAMELEN) {
+		return;
+	}
+
+	vfs_biglock_acquire();
+	nc = emufs_nc_slot(ef, dir, name);
+	emufs_nc_drop(nc);
+	VOP_INCREF(&dir->ev_v);
+	VOP_INCREF(&ev->ev_v);
+	nc->nc_dir = dir;
+	nc->nc_vn = ev;
+	strcpy(nc->nc_name, name);
+	vfs_biglock_release();
+}
+
+/*
+ * Empty the name cache, closing the host handles it was keeping open.
+ */
+static
+void
+emufs_nc_purge(struct emufs_fs *ef)
+{
+	unsigned i;
+
+	vfs_biglock_acquire();
+	for (i=0; i<EMUFS_NCACHE; i++) {
+		emufs_nc_drop(&ef->ef_ncache[i]);
+	}
+	vfs_biglock_release();
+}
+
 /*
  * VOP_EACHOPEN on files
  */
@@ -529,12 +646,80 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	kfree(ev->ev_rbuf);
 	kfree(ev);
 	return 0;
 }
 
+/*
+ * Read through the vnode's read cache: if the data at the current
+ * offset isn't there, fetch a full EMU_MAXIO from the device into the
+ * cache first. This turns a run of small sequential reads (stdio,
+ * the ELF loader reading headers) into one device operation per
+ * EMU_MAXIO bytes. Reading at or past a short fill is EOF.
+ *
+ * The cache is allocated here, under e_lock, the first time it's
+ * needed. If that fails the read just goes to the device.
+ */
+static
+int
+emufs_cachedread(struct emufs_vnode *ev, struct uio *uio)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	struct iovec iov;
+	struct uio kuio;
+	off_t offset;
+	size_t amt;
+	int result;
+
+	offset = uio->uio_offset;
+
+	lock_acquire(sc->e_lock);
+
+	if (ev->ev_rbuf == NULL) {
+		ev->ev_rbuf = kmalloc(EMU_MAXIO);
+		if (ev->ev_rbuf == NULL) {
+			result = emu_read(sc, ev->ev_handle, uio->uio_resid,
+					  uio);
+			lock_release(sc->e_lock);
+			return result;
+		}
+	}
+
+	if (!ev->ev_rvalid || ev->ev_rgen != sc->e_gen ||
+	    offset < ev->ev_rstart ||
+	    offset > ev->ev_rstart + ev->ev_rlen ||
+	    (offset == ev->ev_rstart + ev->ev_rlen &&
+	     ev->ev_rlen == EMU_MAXIO)) {
+		ev->ev_rvalid = false;
+		uio_kinit(&iov, &kuio, ev->ev_rbuf, EMU_MAXIO, offset,
+			  UIO_READ);
+		result = emu_read(sc, ev->ev_handle, EMU_MAXIO, &kuio);
+		if (result) {
+			lock_release(sc->e_lock);
+			return result;
+		}
+		ev->ev_rstart = offset;
+		ev->ev_rlen = EMU_MAXIO - kuio.uio_resid;
+		ev->ev_rgen = sc->e_gen;
+		ev->ev_rvalid = true;
+	}
+
+	amt = ev->ev_rstart + ev->ev_rlen - offset;
+	if (amt > uio->uio_resid) {
+		amt = uio->uio_resid;
+	}
+	result = uiomove(ev->ev_rbuf + (offset - ev->ev_rstart), amt, uio);
+
+	lock_release(sc->e_lock);
+	return result;
+}
+
 /*
  * VOP_READ
+ *
+ * Reads of at least EMU_MAXIO go straight to the device; smaller ones
+ * go through the read cache.
  */
 static
 int
@@ -547,6 +732,15 @@ emufs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	/* Pick up stores made through mappings of the file. */
+	result = pagecache_flush(v, uio->uio_offset,
+				 uio->uio_offset + uio->uio_resid);
+	if (result) {
+		return result;
+	}
+
+	/* e_lock is held across the copies to user memory. */
+	pagecache_fsio_enter();
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -555,9 +749,14 @@ emufs_read(struct vnode *v, struct uio *uio)
 
 		oldresid = uio->uio_resid;
 
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+		if (amt < EMU_MAXIO && uio->uio_offset <= (off_t)0xffffffff) {
+			result = emufs_cachedread(ev, uio);
+		}
+		else {
+			result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+		}
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -565,8 +764,9 @@ emufs_read(struct vnode *v, struct uio *uio)
 			break;
 		}
 	}
+	pagecache_fsio_leave();
 
-	return 0;
+	return result;
 }
 
 /*
@@ -578,6 +778,7 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
+	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
@@ -586,7 +787,10 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 		amt = EMU_MAXIO;
 	}
 
-	return emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
+	pagecache_fsio_enter();
+	result = emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
+	pagecache_fsio_leave();
+	return result;
 }
 
 /*
@@ -597,12 +801,20 @@ int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	off_t start = uio->uio_offset;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	/* As in sfs: flush mapped pages first, reread them after. */
+	result = pagecache_flush(v, start, start + uio->uio_resid);
+	if (result) {
+		return result;
+	}
+
+	pagecache_fsio_enter();
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -613,7 +825,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -621,8 +833,11 @@ emufs_write(struct vnode *v, struct uio *uio)
 			break;
 		}
 	}
+	pagecache_fsio_leave();
 
-	return 0;
+	pagecache_refresh(v, start, uio->uio_offset);
+
+	return result;
 }
 
 /*
@@ -651,14 +866,25 @@ int
 emufs_stat(struct vnode *v, struct stat *statbuf)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emu_softc *sc = ev->ev_emu;
 	int result;
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
-	if (result) {
-		return result;
+	/* Use the cached size unless something's been written since. */
+	lock_acquire(sc->e_lock);
+	if (!ev->ev_sizevalid || ev->ev_sizegen != sc->e_gen) {
+		result = emu_getsize(sc, ev->ev_handle, &ev->ev_size);
+		if (result) {
+			ev->ev_sizevalid = false;
+			lock_release(sc->e_lock);
+			return result;
+		}
+		ev->ev_sizegen = sc->e_gen;
+		ev->ev_sizevalid = true;
 	}
+	statbuf->st_size = ev->ev_size;
+	lock_release(sc->e_lock);
 
 	result = VOP_GETTYPE(v, &statbuf->st_mode);
 	if (result) {
@@ -728,6 +954,29 @@ emufs_truncate(struct vnode *v, off_t len)
 	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
 }
 
+/*
+ * Open NAME in directory EV at the hardware level. If the host is out
+ * of file handles, drop the ones the name cache is holding and try
+ * again.
+ */
+static
+int
+emufs_open(struct emufs_fs *ef, struct emufs_vnode *ev, const char *name,
+	   bool create, bool excl, mode_t mode,
+	   uint32_t *handle, int *isdir)
+{
+	int result;
+
+	result = emu_open(ev->ev_emu, ev->ev_handle, name, create, excl, mode,
+			  handle, isdir);
+	if (result == ENFILE) {
+		emufs_nc_purge(ef);
+		result = emu_open(ev->ev_emu, ev->ev_handle, name,
+				  create, excl, mode, handle, isdir);
+	}
+	return result;
+}
+
 /*
  * VOP_CREAT
  */
@@ -743,8 +992,7 @@ emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
 	int result;
 	int isdir;
 
-	result = emu_open(ev->ev_emu, ev->ev_handle, name, true, excl, mode,
-			  &handle, &isdir);
+	result = emufs_open(ef, ev, name, true, excl, mode, &handle, &isdir);
 	if (result) {
 		return result;
 	}
@@ -755,6 +1003,8 @@ emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
 		return result;
 	}
 
+	emufs_nc_enter(ef, ev, name, newguy);
+
 	*ret = &newguy->ev_v;
 	return 0;
 }
@@ -773,8 +1023,14 @@ emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
 	int result;
 	int isdir;
 
-	result = emu_open(ev->ev_emu, ev->ev_handle, pathname, false, false, 0,
-			  &handle, &isdir);
+	newguy = emufs_nc_find(ef, ev, pathname);
+	if (newguy != NULL) {
+		*ret = &newguy->ev_v;
+		return 0;
+	}
+
+	result = emufs_open(ef, ev, pathname, false, false, 0,
+			    &handle, &isdir);
 	if (result) {
 		return result;
 	}
@@ -785,6 +1041,8 @@ emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
 		return result;
 	}
 
+	emufs_nc_enter(ef, ev, pathname, newguy);
+
 	*ret = &newguy->ev_v;
 	return 0;
 }
@@ -845,13 +1103,17 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_MMAP
+ *
+ * Files can be mapped; the page cache reads and writes them through
+ * emufs_read and emufs_write like anyone else.
  */
 static
 int
-emufs_mmap(struct vnode *v)
+emufs_mmap(struct vnode *v, int prot)
 {
 	(void)v;
-	return ENOSYS;
+	(void)prot;
+	return 0;
 }
 
 //////////////////////////////
@@ -1067,6 +1329,15 @@ emufs_truncate_isdir(struct vnode *v, off_t len)
 	return ENOTDIR;
 }
 
+static
+int
+emufs_mmap_isdir(struct vnode *v, int prot)
+{
+	(void)v;
+	(void)prot;
+	return EISDIR;
+}
+
 //////////////////////////////
 
 /*
@@ -1121,7 +1392,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_gettype = emufs_dir_gettype,
 	.vop_isseekable = emufs_isseekable,
 	.vop_fsync = emufs_void_op_isdir,
-	.vop_mmap = emufs_void_op_isdir,
+	.vop_mmap = emufs_mmap_isdir,
 	.vop_truncate = emufs_truncate_isdir,
 	.vop_namefile = emufs_namefile,
 
@@ -1179,6 +1450,14 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_rbuf = NULL;
+	ev->ev_rstart = 0;
+	ev->ev_rlen = 0;
+	ev->ev_rgen = 0;
+	ev->ev_rvalid = false;
+	ev->ev_size = 0;
+	ev->ev_sizegen = 0;
+	ev->ev_sizevalid = false;
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
@@ -1292,6 +1571,7 @@ int
 emufs_addtovfs(struct emu_softc *sc, const char *devname)
 {
 	struct emufs_fs *ef;
+	unsigned i;
 	int result;
 
 	ef = kmalloc(sizeof(struct emufs_fs));
@@ -1304,6 +1584,10 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 
 	ef->ef_emu = sc;
 	ef->ef_root = NULL;
+	for (i=0; i<EMUFS_NCACHE; i++) {
+		ef->ef_ncache[i].nc_dir = NULL;
+		ef->ef_ncache[i].nc_vn = NULL;
+	}
 	ef->ef_vnodes = vnodearray_create();
 	if (ef->ef_vnodes == NULL) {
 		kfree(ef);
@@ -1350,6 +1634,7 @@ config_emu(struct emu_softc *sc, int emuno)
 		return ENOMEM;
 	}
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
+	sc->e_gen = 0;
 
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
@@ -51,6 +51,12 @@ struct emu_softc {
 	struct semaphore *e_sem;
 	void *e_iobuf;
 
+	/*
+	 * Bumped (under e_lock) by every write and truncate; cached
+	 * file contents and sizes are tagged with it.
+	 */
+	uint32_t e_gen;
+
 	/* Written by the interrupt handler */
 	uint32_t e_result;
 };
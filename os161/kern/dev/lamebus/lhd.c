@@ -40,6 +40,7 @@
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
+#include <trace.h>
 #include "autoconf.h"
 
 /* Registers (offsets within slot) */
@@ -235,6 +236,7 @@ lhd_io(struct device *d, struct uio *uio)
 		lhd_wreg(lh, LHD_REG_SECT, sector+i);
 
 		/* and start the operation. */
+		TRACE(TRACE_DISKIO, sector+i, uio->uio_rw == UIO_WRITE);
 		lhd_wreg(lh, LHD_REG_STAT, statval);
 
 		/* Now wait until the interrupt handler tells us we're done. */
@@ -242,6 +244,7 @@ lhd_io(struct device *d, struct uio *uio)
 
 		/* Get the result value saved by the interrupt handler. */
 		result = lh->lh_result;
+		TRACE(TRACE_DISKDONE, sector+i, result);
 
 		/*
 		 * Are we reading? If so, and if we succeeded,
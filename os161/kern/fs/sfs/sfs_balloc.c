@@ -33,6 +33,7 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <sfs.h>
@@ -41,7 +42,6 @@
 /*
  * Zero out a disk block.
  */
-static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
@@ -52,40 +52,166 @@ sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 }
 
 /*
- * Allocate a block.
+ * Record that DISKBLOCK's bit in the freemap changed: adjust the free
+ * count for the freemap block holding it by DELTA and mark that
+ * freemap block as needing to be written.
+ */
+static
+void
+sfs_freemap_changed(struct sfs_fs *sfs, daddr_t diskblock, int delta)
+{
+	unsigned fmblock;
+
+	fmblock = diskblock / SFS_BITSPERBLOCK;
+	sfs->sfs_freemapfree[fmblock] += delta;
+	KASSERT(sfs->sfs_freemapfree[fmblock] <= SFS_BITSPERBLOCK);
+
+	if (!bitmap_isset(sfs->sfs_freemapblkdirty, fmblock)) {
+		bitmap_mark(sfs->sfs_freemapblkdirty, fmblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
+/*
+ * Find a free block, as close after HINT as possible (pass 0 for no
+ * preference), and mark it in use. Callers pass the previous block of
+ * the same file, or the inode of the containing object, so files stay
+ * roughly contiguous and near their inodes.
+ *
+ * Freemap blocks with no free bits are skipped by their free count
+ * without looking at the bitmap. The search starts in the freemap
+ * block holding HINT and wraps around the disk.
  */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_balloc_find(struct sfs_fs *sfs, daddr_t hint, daddr_t *diskblock)
 {
+	uint32_t i, fmblock, freemapblocks;
+	unsigned lo, hi;
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	freemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+	if (hint >= sfs->sfs_sb.sb_nblocks) {
+		hint = 0;
+	}
+
+	for (i = 0; i < freemapblocks; i++) {
+		fmblock = (hint / SFS_BITSPERBLOCK + i) % freemapblocks;
+		if (sfs->sfs_freemapfree[fmblock] > 0) {
+			break;
+		}
+	}
+	if (i == freemapblocks) {
+		return ENOSPC;
+	}
+
+	lo = fmblock * SFS_BITSPERBLOCK;
+	hi = lo + SFS_BITSPERBLOCK;
+	if (i == 0) {
+		/* Hint's own freemap block: prefer what follows the hint */
+		result = bitmap_alloc_range(sfs->sfs_freemap, hint, hi,
+					    diskblock);
+		if (result) {
+			result = bitmap_alloc_range(sfs->sfs_freemap, lo, hint,
+						    diskblock);
+		}
+	}
+	else {
+		result = bitmap_alloc_range(sfs->sfs_freemap, lo, hi,
+					    diskblock);
+	}
 	if (result) {
-		return result;
+		panic("sfs: %s: balloc: freemap block %u has no free bits "
+		      "but a free count of %u\n", sfs->sfs_sb.sb_volname,
+		      fmblock, sfs->sfs_freemapfree[fmblock]);
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_changed(sfs, *diskblock, -1);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
+	return 0;
+}
+
+/*
+ * Allocate a block near HINT (see above) and zero it.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t hint, daddr_t *diskblock)
+{
+	int result;
+
+	result = sfs_balloc_find(sfs, hint, diskblock);
+	if (result) {
+		return result;
+	}
 
 	/* Clear block before returning it */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_freemap_changed(sfs, *diskblock, 1);
 	}
 	return result;
 }
 
 /*
- * Free a block.
+ * Allocate a run of up to WANT consecutive blocks near HINT, handing
+ * back the first in *START and the length in *COUNT. The run is
+ * whatever free space follows the first free block found, so it may
+ * be shorter than asked for, but is never empty. The blocks are not
+ * zeroed; the caller must initialize them (or zero them with
+ * sfs_clearblock) before anything on disk refers to them.
+ */
+int
+sfs_balloc_run(struct sfs_fs *sfs, daddr_t hint, unsigned want,
+	       daddr_t *start, unsigned *count)
+{
+	daddr_t block;
+	int result;
+
+	KASSERT(want > 0);
+
+	result = sfs_balloc_find(sfs, hint, start);
+	if (result) {
+		return result;
+	}
+
+	*count = 1;
+	block = *start + 1;
+	while (*count < want && block < sfs->sfs_sb.sb_nblocks &&
+	       !bitmap_isset(sfs->sfs_freemap, block)) {
+		bitmap_mark(sfs->sfs_freemap, block);
+		sfs_freemap_changed(sfs, block, -1);
+		(*count)++;
+		block++;
+	}
+	return 0;
+}
+
+/*
+ * Free a block. With a journal, the block isn't actually freed until
+ * the transaction commits; see sfs_journal.c.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
+{
+	if (sfs->sfs_journal != NULL) {
+		sfs_jfree(sfs, diskblock);
+		return;
+	}
+	sfs_bfree_now(sfs, diskblock);
+}
+
+/*
+ * Free a block right away.
+ */
+void
+sfs_bfree_now(struct sfs_fs *sfs, daddr_t diskblock)
 {
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_changed(sfs, diskblock, 1);
 }
 
 /*
@@ -39,15 +39,88 @@
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Allocate a data block for SV, near HINT. If CLEAR is set the block
+ * is zeroed; otherwise the caller is about to fill it.
+ *
+ * Regular files are given blocks out of a per-vnode preallocation
+ * window: when it's empty a run of up to SFS_PREALLOC blocks is taken
+ * at once, and later blocks come off the front of it. So a file being
+ * appended to gets contiguous runs even while other files grow
+ * alongside it. Unused window blocks are given back by
+ * sfs_prealloc_release. (After a crash they stay marked in use until
+ * sfsck finds them.)
+ */
+static
+int
+sfs_dalloc(struct sfs_vnode *sv, daddr_t hint, bool clear, daddr_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block;
+	unsigned count;
+	int result;
+
+	if (sv->sv_i.sfi_type != SFS_TYPE_FILE) {
+		if (clear) {
+			return sfs_balloc(sfs, hint, ret);
+		}
+		return sfs_balloc_run(sfs, hint, 1, ret, &count);
+	}
+
+	if (sv->sv_nprealloc == 0) {
+		result = sfs_balloc_run(sfs, hint, SFS_PREALLOC,
+					&sv->sv_prealloc, &sv->sv_nprealloc);
+		if (result) {
+			return result;
+		}
+	}
+	block = sv->sv_prealloc++;
+	sv->sv_nprealloc--;
+
+	if (clear) {
+		result = sfs_clearblock(sfs, block);
+		if (result) {
+			sfs_bfree_now(sfs, block);
+			return result;
+		}
+	}
+	*ret = block;
+	return 0;
+}
+
+/*
+ * Give back any blocks left in SV's preallocation window. They were
+ * never referenced from the file, so they can be freed right away
+ * even with a journal.
+ */
+void
+sfs_prealloc_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	while (sv->sv_nprealloc > 0) {
+		sfs_bfree_now(sfs, sv->sv_prealloc);
+		sv->sv_prealloc++;
+		sv->sv_nprealloc--;
+	}
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * Newly allocated blocks are zeroed, unless FRESH is not NULL. In
+ * that case *FRESH says whether the block was just allocated, and if
+ * so the caller must write the whole block; this saves writing it
+ * twice when it's about to be overwritten anyway.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+	 daddr_t *diskblock, bool *fresh)
 {
 	/*
 	 * I/O buffer for handling indirect blocks.
@@ -61,6 +134,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t block;
 	daddr_t idblock;
+	daddr_t hint;
 	uint32_t idnum, idoff;
 	int result;
 
@@ -69,6 +143,10 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	/* Since we're using a static buffer, we'd better be locked. */
 	KASSERT(vfs_biglock_do_i_hold());
 
+	if (fresh != NULL) {
+		*fresh = false;
+	}
+
 	/*
 	 * If the block we want is one of the direct blocks...
 	 */
@@ -82,10 +160,19 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			/* Put it after the previous block, or the inode */
+			hint = fileblock > 0 ?
+				sv->sv_i.sfi_direct[fileblock-1] : 0;
+			if (hint == 0) {
+				hint = sv->sv_ino;
+			}
+			result = sfs_dalloc(sv, hint, fresh == NULL, &block);
 			if (result) {
 				return result;
 			}
+			if (fresh != NULL) {
+				*fresh = true;
+			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
@@ -143,7 +230,11 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * the indirect block. Thus, we need to allocate an
 		 * indirect block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		hint = sv->sv_i.sfi_direct[SFS_NDIRECT-1];
+		if (hint == 0) {
+			hint = sv->sv_ino;
+		}
+		result = sfs_balloc(sfs, hint, &idblock);
 		if (result) {
 			return result;
 		}
@@ -172,16 +263,23 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		hint = idoff > 0 ? idbuf[idoff-1] : 0;
+		if (hint == 0) {
+			hint = idblock;
+		}
+		result = sfs_dalloc(sv, hint, fresh == NULL, &block);
 		if (result) {
 			return result;
 		}
+		if (fresh != NULL) {
+			*fresh = true;
+		}
 
 		/* Remember the block we allocated */
 		idbuf[idoff] = block;
 
 		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_writemeta(sfs, idblock, idbuf, sizeof(idbuf));
 		if (result) {
 			return result;
 		}
@@ -197,6 +295,123 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	return 0;
 }
 
+/*
+ * Find the first block of the file at or after FILEBLOCK, and before
+ * LIMIT, that is allocated (if WANTDATA is set) or is a hole (if
+ * not). Hands back LIMIT if there isn't one.
+ *
+ * This reads the indirect block at most once, so it's a lot cheaper
+ * than calling sfs_bmap on each block in turn when stepping over a
+ * long run of holes or data.
+ */
+int
+sfs_findblock(struct sfs_vnode *sv, uint32_t fileblock, uint32_t limit,
+	      bool wantdata, uint32_t *ret)
+{
+	/*
+	 * I/O buffer for handling the indirect block.
+	 *
+	 * Note: in real life (and when you've done the fs assignment)
+	 * you would get space from the disk buffer cache for this,
+	 * not use a static area.
+	 */
+	static uint32_t idbuf[SFS_DBPERIDB];
+
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t idblock;
+	uint32_t i;
+	int result;
+
+	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+
+	/* Since we're using a static buffer, we'd better be locked. */
+	KASSERT(vfs_biglock_do_i_hold());
+
+	/* Nothing exists past the end of the indirect block. */
+	if (fileblock >= SFS_NDIRECT + SFS_DBPERIDB) {
+		return EFBIG;
+	}
+	if (limit > SFS_NDIRECT + SFS_DBPERIDB) {
+		limit = SFS_NDIRECT + SFS_DBPERIDB;
+	}
+
+	/* Check the direct blocks. */
+	for (i=fileblock; i<limit && i<SFS_NDIRECT; i++) {
+		if ((sv->sv_i.sfi_direct[i] != 0) == wantdata) {
+			*ret = i;
+			return 0;
+		}
+	}
+	if (i >= limit) {
+		*ret = limit;
+		return 0;
+	}
+
+	/* If there's no indirect block, the rest is all holes. */
+	idblock = sv->sv_i.sfi_indirect;
+	if (idblock == 0) {
+		*ret = wantdata ? limit : i;
+		return 0;
+	}
+
+	result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+	if (result) {
+		return result;
+	}
+	for (; i<limit; i++) {
+		if ((idbuf[i - SFS_NDIRECT] != 0) == wantdata) {
+			*ret = i;
+			return 0;
+		}
+	}
+	*ret = limit;
+	return 0;
+}
+
+/*
+ * Hole-aware seek, for the FIOSEEKDATA and FIOSEEKHOLE ioctls. Move
+ * *POS forward to the next byte of data (if WANTDATA) or the start
+ * of the next hole (if not). The end of the file counts as a hole.
+ * Fails with ENXIO if *POS is at or past EOF, or if we're looking for
+ * data and there isn't any more.
+ */
+int
+sfs_seekhole(struct sfs_vnode *sv, bool wantdata, off_t *pos)
+{
+	off_t size = sv->sv_i.sfi_size;
+	uint32_t fileblock, blocklen, found;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (*pos < 0) {
+		return EINVAL;
+	}
+	if (*pos >= size) {
+		return ENXIO;
+	}
+
+	fileblock = *pos / SFS_BLOCKSIZE;
+	blocklen = DIVROUNDUP(size, SFS_BLOCKSIZE);
+
+	result = sfs_findblock(sv, fileblock, blocklen, wantdata, &found);
+	if (result) {
+		return result;
+	}
+
+	if (found >= blocklen) {
+		if (wantdata) {
+			return ENXIO;
+		}
+		*pos = size;
+		return 0;
+	}
+	if (found > fileblock) {
+		*pos = (off_t)found * SFS_BLOCKSIZE;
+	}
+	return 0;
+}
+
 /*
  * Called for ftruncate() and from sfs_reclaim.
  */
@@ -217,7 +432,7 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
+	uint32_t i, j, first;
 	daddr_t block, idblock;
 	uint32_t baseblock, highblock;
 	int result;
@@ -227,6 +442,9 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 
 	vfs_biglock_acquire();
 
+	/* Don't hold on to space the file may no longer grow into */
+	sfs_prealloc_release(sv);
+
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -249,7 +467,7 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* The highest block in the indirect block */
 	highblock = baseblock + SFS_DBPERIDB - 1;
 
-	if (blocklen < highblock && idblock != 0) {
+	if (blocklen <= highblock && idblock != 0) {
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
@@ -259,18 +477,28 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 			return result;
 		}
 
-		hasnonzero = 0;
+		/* First slot past the new EOF */
+		first = blocklen > baseblock ? blocklen - baseblock : 0;
+
+		/*
+		 * Discard the blocks past the new EOF. Holes are
+		 * already zero, so only allocated slots cost anything.
+		 */
 		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
+		for (j=first; j<SFS_DBPERIDB; j++) {
+			if (idbuf[j] != 0) {
 				sfs_bfree(sfs, idbuf[j]);
 				idbuf[j] = 0;
 				iddirty = 1;
 			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
+		}
+
+		/* Is anything left below the new EOF? */
+		hasnonzero = 0;
+		for (j=0; j<first; j++) {
+			if (idbuf[j] != 0) {
+				hasnonzero = 1;
+				break;
 			}
 		}
 
@@ -282,8 +510,8 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		}
 		else if (iddirty) {
 			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
+			result = sfs_writemeta(sfs, idblock, idbuf,
+					       sizeof(idbuf));
 			if (result) {
 				vfs_biglock_release();
 				return result;
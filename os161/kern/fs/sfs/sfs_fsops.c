@@ -45,11 +45,6 @@
 #include "sfsprivate.h"
 
 
-/* Shortcuts for the size macros in kern/sfs.h */
-#define SFS_FS_NBLOCKS(sfs)        ((sfs)->sfs_sb.sb_nblocks)
-#define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
-#define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
-
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
  * We always do the whole bitmap at once; writing individual sectors
@@ -84,6 +79,12 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 	/* For each block in the free block bitmap... */
 	for (j=0; j<freemapblocks; j++) {
 
+		/* When writing, skip the ones that haven't changed. */
+		if (rw == UIO_WRITE &&
+		    !bitmap_isset(sfs->sfs_freemapblkdirty, j)) {
+			continue;
+		}
+
 		/* Get a pointer to its data */
 		void *ptr = freemapdata + j*SFS_BLOCKSIZE;
 
@@ -101,10 +102,42 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 		if (result) {
 			return result;
 		}
+
+		if (rw == UIO_WRITE) {
+			bitmap_unmark(sfs->sfs_freemapblkdirty, j);
+		}
 	}
 	return 0;
 }
 
+/*
+ * Count the free blocks covered by each freemap block, after loading
+ * the freemap.
+ */
+static
+void
+sfs_freemap_count(struct sfs_fs *sfs)
+{
+	uint32_t j, k, freemapblocks;
+	unsigned char *freemapdata, byte;
+	unsigned nfree;
+
+	freemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+	freemapdata = bitmap_getdata(sfs->sfs_freemap);
+
+	for (j=0; j<freemapblocks; j++) {
+		nfree = 0;
+		for (k=0; k<SFS_BLOCKSIZE; k++) {
+			/* count the zero bits */
+			for (byte = ~freemapdata[j*SFS_BLOCKSIZE + k];
+			     byte != 0; byte &= byte - 1) {
+				nfree++;
+			}
+		}
+		sfs->sfs_freemapfree[j] = nfree;
+	}
+}
+
 /*
  * Sync routine for the vnode table.
  */
@@ -215,6 +248,16 @@ sfs_sync(struct fs *fs)
 		return result;
 	}
 
+	/*
+	 * With a journal, commit; that takes care of the freemap and
+	 * superblock too.
+	 */
+	if (sfs->sfs_journal != NULL) {
+		result = sfs_jcommit_all(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
@@ -259,9 +302,18 @@ static
 void
 sfs_fs_destroy(struct sfs_fs *sfs)
 {
+	if (sfs->sfs_journal != NULL) {
+		sfs_journal_unmount(sfs);
+	}
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	if (sfs->sfs_freemapblkdirty != NULL) {
+		bitmap_destroy(sfs->sfs_freemapblkdirty);
+	}
+	if (sfs->sfs_freemapfree != NULL) {
+		kfree(sfs->sfs_freemapfree);
+	}
 	vnodearray_destroy(sfs->sfs_vnodes);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
@@ -277,6 +329,7 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
 	vfs_biglock_acquire();
 
@@ -286,6 +339,16 @@ sfs_unmount(struct fs *fs)
 		return EBUSY;
 	}
 
+	/* Get everything home, so the journal is empty. */
+	if (sfs->sfs_journal != NULL) {
+		result = sfs_jflush(sfs);
+		if (result) {
+			vfs_biglock_release();
+			return result;
+		}
+		sfs_journal_unmount(sfs);
+	}
+
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
@@ -359,6 +422,11 @@ sfs_fs_create(void)
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemapblkdirty = NULL;
+	sfs->sfs_freemapfree = NULL;
+
+	/* journal */
+	sfs->sfs_journal = NULL;
 
 	return sfs;
 
@@ -448,9 +516,22 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Replay the journal, which may change the freemap. */
+	result = sfs_journal_mount(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
-	if (sfs->sfs_freemap == NULL) {
+	sfs->sfs_freemapblkdirty = bitmap_create(SFS_FS_FREEMAPBLOCKS(sfs));
+	sfs->sfs_freemapfree = kmalloc(SFS_FS_FREEMAPBLOCKS(sfs) *
+				       sizeof(sfs->sfs_freemapfree[0]));
+	if (sfs->sfs_freemap == NULL || sfs->sfs_freemapblkdirty == NULL ||
+	    sfs->sfs_freemapfree == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
 		vfs_biglock_release();
@@ -463,6 +544,8 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		vfs_biglock_release();
 		return result;
 	}
+	bitmap_rebuild(sfs->sfs_freemap);
+	sfs_freemap_count(sfs);
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
@@ -49,7 +49,7 @@
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
- * except sfs_device.
+ * except sfs_device (and sfs_journal, which is NULL then).
  */
 
 /*
@@ -102,7 +102,8 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 }
 
 /*
- * Read a block.
+ * Read a block. Metadata changed recently may not be home yet, so
+ * check the journal first.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
@@ -112,6 +113,10 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
+	if (sfs->sfs_journal != NULL && sfs_jread(sfs, block, data)) {
+		return 0;
+	}
+
 	SFSUIO(&iov, &ku, data, block, UIO_READ);
 	return sfs_rwblock(sfs, &ku);
 }
@@ -131,6 +136,21 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 	return sfs_rwblock(sfs, &ku);
 }
 
+/*
+ * Write a metadata block. If the volume has a journal this goes into
+ * the running transaction instead of straight to disk.
+ */
+int
+sfs_writemeta(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	if (sfs->sfs_journal != NULL) {
+		return sfs_jwrite(sfs, block, data);
+	}
+	return sfs_writeblock(sfs, block, data, len);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
@@ -162,6 +182,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t diskblock;
 	uint32_t fileblock;
+	bool fresh;
 	int result;
 
 	/* Allocate missing blocks if and only if we're writing */
@@ -175,18 +196,28 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
-	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/*
+	 * Get the disk block number. A block allocated just now
+	 * comes back unzeroed; we always write all of it below.
+	 */
+	result = sfs_bmap(sv, fileblock, doalloc, &diskblock, &fresh);
 	if (result) {
 		return result;
 	}
 
 	if (diskblock == 0) {
 		/*
-		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * There was no block mapped at this point in the file,
+		 * so we must be reading; hand back zeros directly.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
+		return uiomovezeros(len, uio);
+	}
+
+	if (fresh) {
+		/*
+		 * New block: there's nothing on disk worth reading.
+		 */
 		bzero(iobuf, sizeof(iobuf));
 	}
 	else {
@@ -204,6 +235,11 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	result = uiomove(iobuf+skipstart, len, uio);
 	if (result) {
+		if (fresh) {
+			/* Don't leave old disk contents in the file */
+			(void)sfs_writeblock(sfs, diskblock, iobuf,
+					     sizeof(iobuf));
+		}
 		return result;
 	}
 
@@ -230,6 +266,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t diskblock;
 	uint32_t fileblock;
+	bool fresh;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
 	off_t saveoff;
@@ -240,8 +277,11 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
-	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/*
+	 * Look up the disk block number. We're about to overwrite
+	 * the whole block, so a new one needn't be zeroed first.
+	 */
+	result = sfs_bmap(sv, fileblock, doalloc, &diskblock, &fresh);
 	if (result) {
 		return result;
 	}
@@ -282,6 +322,11 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
 	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
 
+	if (result && fresh) {
+		/* Don't leave old disk contents in the file */
+		(void)sfs_clearblock(sfs, diskblock);
+	}
+
 	return result;
 }
 
@@ -292,7 +337,8 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, run, i;
+	uint32_t fileblock, next;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
 
@@ -352,11 +398,44 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
-		if (result) {
-			goto out;
+	while (nblocks > 0) {
+		run = nblocks;
+		if (uio->uio_rw == UIO_READ) {
+			/*
+			 * When reading, find out how far the hole or
+			 * data run starting here extends. Holes are
+			 * zero-filled all at once with no disk I/O.
+			 */
+			fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+			result = sfs_findblock(sv, fileblock,
+					       fileblock + nblocks, true, &next);
+			if (result) {
+				goto out;
+			}
+			if (next > fileblock) {
+				run = next - fileblock;
+				result = uiomovezeros(run * SFS_BLOCKSIZE, uio);
+				if (result) {
+					goto out;
+				}
+				nblocks -= run;
+				continue;
+			}
+			result = sfs_findblock(sv, fileblock,
+					       fileblock + nblocks, false, &next);
+			if (result) {
+				goto out;
+			}
+			KASSERT(next > fileblock);
+			run = next - fileblock;
+		}
+		for (i=0; i<run; i++) {
+			result = sfs_blockio(sv, uio);
+			if (result) {
+				goto out;
+			}
 		}
+		nblocks -= run;
 	}
 
 	/*
@@ -432,7 +511,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 
 	/* Get the disk block number */
 	doalloc = (rw == UIO_WRITE);
-	result = sfs_bmap(sv, vnblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, vnblock, doalloc, &diskblock, NULL);
 	if (result) {
 		return result;
 	}
@@ -461,8 +540,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		memcpy(metaiobuf + blockoffset, data, len);
 
 		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
+		result = sfs_writemeta(sfs, diskblock,
+				       metaiobuf, sizeof(metaiobuf));
 		if (result) {
 			return result;
 		}
@@ -0,0 +1,1198 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Metadata journal.
+ *
+ * Metadata blocks (inodes, directory blocks, indirect blocks, the
+ * freemap, and the superblock) are not written in place. Instead the
+ * new contents are kept in memory in a jbuf, "staged" in the running
+ * transaction. Every so often the journal thread commits the running
+ * transaction: it writes all staged blocks to the log in one
+ * sequential pass followed by a commit record, so many operations
+ * share one log write (group commit). Committed blocks are "logged";
+ * they are written to their home locations later, by a checkpoint,
+ * after which their log space can be reused.
+ *
+ * Until then reads of those blocks are served from the jbufs, so the
+ * jbufs double as a cache of recently changed metadata.
+ *
+ * Two rules keep this correct:
+ *
+ *  - Nothing uncommitted is ever written home. If a logged block is
+ *    changed again before it is checkpointed, the logged contents are
+ *    written home first (that is always safe: replay would put the
+ *    same thing there).
+ *
+ *  - Freed blocks are not really freed until the transaction freeing
+ *    them commits, so they can't be reused (and overwritten in place
+ *    as file data) while the old owner might still be what's on disk
+ *    after a crash. The commit also records them as revoked, so replay
+ *    doesn't write stale metadata over their new contents. Clearing
+ *    them in the freemap waits until the log write has succeeded, so
+ *    that freemap change goes in the next transaction; a crash in
+ *    between only leaks the blocks.
+ *
+ * All of this is protected by the vfs biglock, which also means
+ * transactions naturally end at operation boundaries: the journal
+ * thread can't commit until the current operation lets go of it.
+ *
+ * File data is written in place as before; since that happens at
+ * once, the data is on disk before the metadata pointing to it is
+ * committed.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <array.h>
+#include <clock.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <thread.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Number of hash chains for finding jbufs */
+#define SFS_JHASHSIZE		64
+
+/* Freed blocks recorded per chunk */
+#define SFS_JFREECHUNK		62
+
+/* Journal thread commits at least this often (in hardclocks) */
+#define SFS_JCOMMIT_TICKS	(HZ / 2)
+
+/*
+ * A metadata block held by the journal.
+ */
+struct sfs_jbuf {
+	struct sfs_jbuf *jb_next;	/* hash chain */
+	daddr_t jb_block;		/* home location */
+	bool jb_staged;			/* changed in running transaction */
+	bool jb_logged;			/* committed but not yet home */
+	char jb_data[SFS_BLOCKSIZE];
+};
+
+/*
+ * Blocks freed but not yet committed.
+ */
+struct sfs_jfree {
+	struct sfs_jfree *jf_next;
+	unsigned jf_num;
+	unsigned jf_applied;		/* how many have had their jbufs dropped */
+	uint32_t jf_blocks[SFS_JFREECHUNK];
+};
+
+struct sfs_journal {
+	struct sfs_fs *j_sfs;		/* NULL once unmounted */
+	uint32_t j_start;		/* header block */
+	uint32_t j_size;		/* log blocks after the header */
+
+	/* Log state, as offsets into the log */
+	uint32_t j_tail;		/* oldest transaction not checkpointed */
+	uint32_t j_tailseq;		/* ...and its sequence number */
+	uint32_t j_head;		/* where the next transaction goes */
+	uint32_t j_headseq;		/* ...and its sequence number */
+	uint32_t j_used;		/* blocks between tail and head */
+
+	/* Blocks */
+	struct sfs_jbuf *j_hash[SFS_JHASHSIZE];
+	unsigned j_nstaged;
+	unsigned j_nlogged;
+
+	/* Frees: not yet gathered, and gathered but not yet committed */
+	struct sfs_jfree *j_pendfree;
+	struct sfs_jfree *j_revokes;
+	unsigned j_nrevokes;
+
+	/* Journal thread */
+	struct lock *j_lock;
+	struct cv *j_cv;
+	bool j_wantcommit;
+	bool j_exiting;
+
+	/* Statistics */
+	unsigned j_ncommits;
+	unsigned j_nlogblocks;
+	unsigned j_ncheckpoints;
+	bool j_warned;
+
+	/* Scratch block for descriptors and list blocks */
+	uint32_t j_buf[SFS_BLOCKSIZE / sizeof(uint32_t)];
+};
+
+////////////////////////////////////////////////////////////
+// jbufs
+
+static
+unsigned
+sfs_jhash(daddr_t block)
+{
+	return block % SFS_JHASHSIZE;
+}
+
+static
+struct sfs_jbuf *
+sfs_jfind(struct sfs_journal *j, daddr_t block)
+{
+	struct sfs_jbuf *jb;
+
+	for (jb = j->j_hash[sfs_jhash(block)]; jb != NULL; jb = jb->jb_next) {
+		if (jb->jb_block == block) {
+			return jb;
+		}
+	}
+	return NULL;
+}
+
+static
+struct sfs_jbuf *
+sfs_jbuf_create(struct sfs_journal *j, daddr_t block)
+{
+	struct sfs_jbuf *jb;
+	unsigned h;
+
+	jb = kmalloc(sizeof(*jb));
+	if (jb == NULL) {
+		return NULL;
+	}
+	jb->jb_block = block;
+	jb->jb_staged = false;
+	jb->jb_logged = false;
+
+	h = sfs_jhash(block);
+	jb->jb_next = j->j_hash[h];
+	j->j_hash[h] = jb;
+	return jb;
+}
+
+/*
+ * Forget about BLOCK, whatever state it's in.
+ */
+static
+void
+sfs_jbuf_drop(struct sfs_journal *j, daddr_t block)
+{
+	struct sfs_jbuf **pp, *jb;
+
+	for (pp = &j->j_hash[sfs_jhash(block)]; *pp != NULL;
+	     pp = &(*pp)->jb_next) {
+		jb = *pp;
+		if (jb->jb_block == block) {
+			*pp = jb->jb_next;
+			if (jb->jb_staged) {
+				j->j_nstaged--;
+			}
+			if (jb->jb_logged) {
+				j->j_nlogged--;
+			}
+			kfree(jb);
+			return;
+		}
+	}
+}
+
+/*
+ * Write the logged contents of JB home.
+ */
+static
+int
+sfs_jbuf_writehome(struct sfs_fs *sfs, struct sfs_jbuf *jb)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	KASSERT(jb->jb_logged);
+	result = sfs_writeblock(sfs, jb->jb_block, jb->jb_data,
+				SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+	jb->jb_logged = false;
+	j->j_nlogged--;
+	return 0;
+}
+
+/*
+ * Forget about BLOCK because it's being freed. If its last committed
+ * contents haven't been written home, do that first: the transaction
+ * freeing it isn't committed yet, and if it never is, those contents
+ * are still live.
+ */
+static
+int
+sfs_jbuf_forget(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_jbuf *jb;
+	int result;
+
+	jb = sfs_jfind(sfs->sfs_journal, block);
+	if (jb == NULL) {
+		return 0;
+	}
+	if (jb->jb_logged) {
+		result = sfs_jbuf_writehome(sfs, jb);
+		if (result) {
+			return result;
+		}
+	}
+	sfs_jbuf_drop(sfs->sfs_journal, block);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Log I/O
+
+static
+daddr_t
+sfs_jlogblock(struct sfs_journal *j, uint32_t pos)
+{
+	return j->j_start + 1 + pos % j->j_size;
+}
+
+/*
+ * Blocks needed to log a transaction with N list entries, NIMAGES of
+ * which are images.
+ */
+static
+uint32_t
+sfs_jtxnsize(unsigned n, unsigned nimages)
+{
+	unsigned nlist;
+
+	nlist = 0;
+	if (n > SFS_JDESC_ENTRIES) {
+		nlist = DIVROUNDUP(n - SFS_JDESC_ENTRIES, SFS_JLIST_ENTRIES);
+	}
+	return 1 + nlist + nimages + 1;
+}
+
+static
+void
+sfs_jsum(uint32_t *sum, const void *block)
+{
+	const uint32_t *words = block;
+	unsigned i;
+
+	for (i = 0; i < SFS_BLOCKSIZE / sizeof(uint32_t); i++) {
+		*sum = ((*sum << 1) | (*sum >> 31)) + words[i];
+	}
+}
+
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jheader *jh;
+
+	COMPILE_ASSERT(sizeof(*jh) == SFS_BLOCKSIZE);
+	jh = (struct sfs_jheader *)j->j_buf;
+	bzero(jh, sizeof(*jh));
+	jh->jh_magic = SFS_JOURNAL_MAGIC;
+	jh->jh_tail = j->j_tail;
+	jh->jh_tailseq = j->j_tailseq;
+	return sfs_writeblock(sfs, j->j_start, jh, sizeof(*jh));
+}
+
+/*
+ * Write all logged blocks home and empty the log.
+ */
+static
+int
+sfs_jcheckpoint(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb, **pp;
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i = 0; i < SFS_JHASHSIZE; i++) {
+		pp = &j->j_hash[i];
+		while ((jb = *pp) != NULL) {
+			if (jb->jb_logged) {
+				result = sfs_jbuf_writehome(sfs, jb);
+				if (result) {
+					return result;
+				}
+			}
+			if (!jb->jb_staged) {
+				*pp = jb->jb_next;
+				kfree(jb);
+				continue;
+			}
+			pp = &jb->jb_next;
+		}
+	}
+	KASSERT(j->j_nlogged == 0);
+
+	if (j->j_used == 0) {
+		return 0;
+	}
+	j->j_tail = j->j_head;
+	j->j_tailseq = j->j_headseq;
+	j->j_used = 0;
+	j->j_ncheckpoints++;
+	return sfs_jwriteheader(sfs);
+}
+
+////////////////////////////////////////////////////////////
+// Staging
+
+/*
+ * Wake the journal thread if the running transaction is getting big.
+ */
+static
+void
+sfs_jpoke(struct sfs_journal *j)
+{
+	if (j->j_nstaged + j->j_nrevokes < j->j_size / 4 ||
+	    j->j_wantcommit) {
+		return;
+	}
+	lock_acquire(j->j_lock);
+	j->j_wantcommit = true;
+	cv_signal(j->j_cv, j->j_lock);
+	lock_release(j->j_lock);
+}
+
+/*
+ * Put new contents for metadata block BLOCK in the running
+ * transaction.
+ */
+int
+sfs_jwrite(struct sfs_fs *sfs, daddr_t block, const void *data)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	jb = sfs_jfind(j, block);
+	if (jb == NULL) {
+		jb = sfs_jbuf_create(j, block);
+		if (jb == NULL) {
+			return ENOMEM;
+		}
+	}
+	else if (jb->jb_logged) {
+		/* Don't lose the committed version; see above. */
+		result = sfs_jbuf_writehome(sfs, jb);
+		if (result) {
+			return result;
+		}
+	}
+
+	memcpy(jb->jb_data, data, SFS_BLOCKSIZE);
+	if (!jb->jb_staged) {
+		jb->jb_staged = true;
+		j->j_nstaged++;
+		sfs_jpoke(j);
+	}
+	return 0;
+}
+
+/*
+ * If the journal holds BLOCK, copy it out and return true.
+ */
+bool
+sfs_jread(struct sfs_fs *sfs, daddr_t block, void *data)
+{
+	struct sfs_jbuf *jb;
+
+	jb = sfs_jfind(sfs->sfs_journal, block);
+	if (jb == NULL) {
+		return false;
+	}
+	memcpy(data, jb->jb_data, SFS_BLOCKSIZE);
+	return true;
+}
+
+/*
+ * Record that BLOCK is being freed. It stays marked in use until the
+ * running transaction commits.
+ */
+void
+sfs_jfree(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jfree *jf;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	jf = j->j_pendfree;
+	if (jf == NULL || jf->jf_num == SFS_JFREECHUNK) {
+		jf = kmalloc(sizeof(*jf));
+		if (jf == NULL) {
+			/*
+			 * Can't defer it. Free it now; this only risks
+			 * the block's reuse being visible after a crash
+			 * that loses the free.
+			 */
+			sfs_bfree_now(sfs, block);
+			(void)sfs_jbuf_forget(sfs, block);
+			return;
+		}
+		jf->jf_num = 0;
+		jf->jf_applied = 0;
+		jf->jf_next = j->j_pendfree;
+		j->j_pendfree = jf;
+	}
+	jf->jf_blocks[jf->jf_num++] = block;
+	j->j_nrevokes++;
+	sfs_jpoke(j);
+}
+
+////////////////////////////////////////////////////////////
+// Commit
+
+/*
+ * Get everything that belongs in the transaction into it: dirty
+ * inodes, pending frees (as revokes), the freemap, and the superblock.
+ */
+static
+int
+sfs_jgather(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jfree *jf;
+	unsigned i, num, freemapblocks;
+	char *freemapdata;
+	int result;
+
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
+		result = sfs_sync_inode(v->vn_data);
+		if (result) {
+			return result;
+		}
+	}
+
+	while ((jf = j->j_pendfree) != NULL) {
+		while (jf->jf_applied < jf->jf_num) {
+			result = sfs_jbuf_forget(sfs,
+					jf->jf_blocks[jf->jf_applied]);
+			if (result) {
+				return result;
+			}
+			jf->jf_applied++;
+		}
+		j->j_pendfree = jf->jf_next;
+		jf->jf_next = j->j_revokes;
+		j->j_revokes = jf;
+	}
+
+	if (sfs->sfs_freemapdirty) {
+		freemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+		freemapdata = bitmap_getdata(sfs->sfs_freemap);
+		for (i = 0; i < freemapblocks; i++) {
+			if (!bitmap_isset(sfs->sfs_freemapblkdirty, i)) {
+				continue;
+			}
+			result = sfs_jwrite(sfs, SFS_FREEMAP_START + i,
+					    freemapdata + i*SFS_BLOCKSIZE);
+			if (result) {
+				return result;
+			}
+			bitmap_unmark(sfs->sfs_freemapblkdirty, i);
+		}
+		sfs->sfs_freemapdirty = false;
+	}
+
+	if (sfs->sfs_superdirty) {
+		result = sfs_jwrite(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb);
+		if (result) {
+			return result;
+		}
+		sfs->sfs_superdirty = false;
+	}
+	return 0;
+}
+
+/*
+ * Add block number BLOCK as list entry N of the transaction being
+ * written at POS, writing out list blocks as they fill.
+ */
+static
+int
+sfs_jlist_add(struct sfs_fs *sfs, uint32_t *pos, unsigned n,
+	      uint32_t block, uint32_t *sum)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *jd = (struct sfs_jdesc *)j->j_buf;
+	unsigned ix;
+	int result;
+
+	if (n < SFS_JDESC_ENTRIES) {
+		jd->jd_blocks[n] = block;
+		ix = n;
+		if (ix + 1 < SFS_JDESC_ENTRIES) {
+			return 0;
+		}
+	}
+	else {
+		ix = (n - SFS_JDESC_ENTRIES) % SFS_JLIST_ENTRIES;
+		j->j_buf[ix] = block;
+		if (ix + 1 < SFS_JLIST_ENTRIES) {
+			return 0;
+		}
+	}
+
+	/* This block of the list is full; write it. */
+	sfs_jsum(sum, j->j_buf);
+	result = sfs_writeblock(sfs, sfs_jlogblock(j, *pos), j->j_buf,
+				SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+	(*pos)++;
+	bzero(j->j_buf, sizeof(j->j_buf));
+	return 0;
+}
+
+/*
+ * Write the staged blocks and revokes to the log as one transaction.
+ */
+static
+int
+sfs_jlog(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *jd;
+	struct sfs_jcommit *jc;
+	struct sfs_jbuf *jb;
+	struct sfs_jfree *jf;
+	uint32_t pos, sum;
+	unsigned i, k, n, total;
+	int result;
+
+	COMPILE_ASSERT(sizeof(*jd) == SFS_BLOCKSIZE);
+	COMPILE_ASSERT(sizeof(*jc) == SFS_BLOCKSIZE);
+
+	total = j->j_nstaged + j->j_nrevokes;
+	pos = j->j_head;
+	sum = 0;
+	n = 0;
+
+	/* Descriptor and lists */
+	jd = (struct sfs_jdesc *)j->j_buf;
+	bzero(jd, sizeof(*jd));
+	jd->jd_magic = SFS_JDESC_MAGIC;
+	jd->jd_seq = j->j_headseq;
+	jd->jd_nimages = j->j_nstaged;
+	jd->jd_nrevokes = j->j_nrevokes;
+	for (i = 0; i < SFS_JHASHSIZE; i++) {
+		for (jb = j->j_hash[i]; jb != NULL; jb = jb->jb_next) {
+			if (!jb->jb_staged) {
+				continue;
+			}
+			result = sfs_jlist_add(sfs, &pos, n++, jb->jb_block,
+					       &sum);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	for (jf = j->j_revokes; jf != NULL; jf = jf->jf_next) {
+		for (k = 0; k < jf->jf_num; k++) {
+			result = sfs_jlist_add(sfs, &pos, n++,
+					       jf->jf_blocks[k], &sum);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	KASSERT(n == total);
+	if (pos == j->j_head || (n > SFS_JDESC_ENTRIES &&
+	    (n - SFS_JDESC_ENTRIES) % SFS_JLIST_ENTRIES != 0)) {
+		/* flush the partly filled descriptor or list block */
+		sfs_jsum(&sum, j->j_buf);
+		result = sfs_writeblock(sfs, sfs_jlogblock(j, pos), j->j_buf,
+					SFS_BLOCKSIZE);
+		if (result) {
+			return result;
+		}
+		pos++;
+	}
+
+	/* Images, in the same order as the list */
+	for (i = 0; i < SFS_JHASHSIZE; i++) {
+		for (jb = j->j_hash[i]; jb != NULL; jb = jb->jb_next) {
+			if (!jb->jb_staged) {
+				continue;
+			}
+			sfs_jsum(&sum, jb->jb_data);
+			result = sfs_writeblock(sfs, sfs_jlogblock(j, pos),
+						jb->jb_data, SFS_BLOCKSIZE);
+			if (result) {
+				return result;
+			}
+			pos++;
+		}
+	}
+
+	/* The commit record; once it's on disk, the transaction counts. */
+	jc = (struct sfs_jcommit *)j->j_buf;
+	bzero(jc, sizeof(*jc));
+	jc->jc_magic = SFS_JCOMMIT_MAGIC;
+	jc->jc_seq = j->j_headseq;
+	jc->jc_sum = sum;
+	result = sfs_writeblock(sfs, sfs_jlogblock(j, pos), jc, sizeof(*jc));
+	if (result) {
+		return result;
+	}
+	pos++;
+
+	KASSERT(pos - j->j_head == sfs_jtxnsize(total, j->j_nstaged));
+	j->j_used += pos - j->j_head;
+	j->j_nlogblocks += pos - j->j_head;
+	j->j_head = pos % j->j_size;
+	j->j_headseq++;
+	j->j_ncommits++;
+	return 0;
+}
+
+/*
+ * Commit the running transaction.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	struct sfs_jfree *jf;
+	uint32_t size;
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	result = sfs_jgather(sfs);
+	if (result) {
+		return result;
+	}
+	if (j->j_nstaged == 0 && j->j_nrevokes == 0) {
+		return 0;
+	}
+
+	size = sfs_jtxnsize(j->j_nstaged + j->j_nrevokes, j->j_nstaged);
+	if (size > j->j_size - j->j_used) {
+		result = sfs_jcheckpoint(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	if (size > j->j_size) {
+		/*
+		 * Too big for the log at all. Fall back to writing it
+		 * in place, which is no worse than not journaling.
+		 */
+		if (!j->j_warned) {
+			kprintf("sfs: %s: transaction of %u blocks doesn't "
+				"fit in the journal; writing in place\n",
+				sfs->sfs_sb.sb_volname, size);
+			j->j_warned = true;
+		}
+		for (i = 0; i < SFS_JHASHSIZE; i++) {
+			for (jb = j->j_hash[i]; jb != NULL;
+			     jb = jb->jb_next) {
+				if (!jb->jb_staged) {
+					continue;
+				}
+				result = sfs_writeblock(sfs, jb->jb_block,
+							jb->jb_data,
+							SFS_BLOCKSIZE);
+				if (result) {
+					return result;
+				}
+			}
+		}
+	}
+	else {
+		result = sfs_jlog(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Staged blocks are now logged (or home, if we fell back). */
+	for (i = 0; i < SFS_JHASHSIZE; i++) {
+		for (jb = j->j_hash[i]; jb != NULL; jb = jb->jb_next) {
+			if (!jb->jb_staged) {
+				continue;
+			}
+			KASSERT(!jb->jb_logged);
+			jb->jb_staged = false;
+			if (size <= j->j_size) {
+				jb->jb_logged = true;
+				j->j_nlogged++;
+			}
+		}
+	}
+	j->j_nstaged = 0;
+	if (size > j->j_size) {
+		/* drops the jbufs we just wrote home */
+		result = sfs_jcheckpoint(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* The frees are committed; now the blocks can be reused. */
+	while ((jf = j->j_revokes) != NULL) {
+		j->j_revokes = jf->jf_next;
+		for (i = 0; i < jf->jf_num; i++) {
+			sfs_bfree_now(sfs, jf->jf_blocks[i]);
+		}
+		kfree(jf);
+	}
+	j->j_nrevokes = 0;
+	return 0;
+}
+
+/*
+ * Commit until nothing is left over: the frees one commit applies
+ * dirty the freemap, which takes a second.
+ */
+int
+sfs_jcommit_all(struct sfs_fs *sfs)
+{
+	int result;
+
+	result = sfs_jcommit(sfs);
+	if (result == 0 && sfs->sfs_freemapdirty) {
+		result = sfs_jcommit(sfs);
+	}
+	return result;
+}
+
+/*
+ * Commit, then get everything home so the log is empty.
+ */
+int
+sfs_jflush(struct sfs_fs *sfs)
+{
+	int result;
+
+	result = sfs_jcommit_all(sfs);
+	if (result) {
+		return result;
+	}
+	return sfs_jcheckpoint(sfs);
+}
+
+////////////////////////////////////////////////////////////
+// Journal thread
+
+static
+void
+sfs_journal_destroy(struct sfs_journal *j)
+{
+	struct sfs_jbuf *jb;
+	struct sfs_jfree *jf;
+	unsigned i;
+
+	for (i = 0; i < SFS_JHASHSIZE; i++) {
+		while ((jb = j->j_hash[i]) != NULL) {
+			j->j_hash[i] = jb->jb_next;
+			kfree(jb);
+		}
+	}
+	while ((jf = j->j_pendfree) != NULL) {
+		j->j_pendfree = jf->jf_next;
+		kfree(jf);
+	}
+	while ((jf = j->j_revokes) != NULL) {
+		j->j_revokes = jf->jf_next;
+		kfree(jf);
+	}
+	cv_destroy(j->j_cv);
+	lock_destroy(j->j_lock);
+	kfree(j);
+}
+
+/*
+ * Commit whenever asked to, or every SFS_JCOMMIT_TICKS anyway.
+ * Checkpoint when the log is half full, or when there's nothing else
+ * to do, so that replay after a crash has little to do.
+ *
+ * At unmount the journal is detached from the fs and the thread
+ * destroys it on its way out.
+ */
+static
+void
+sfs_jthread(void *data1, unsigned long data2)
+{
+	struct sfs_journal *j = data1;
+	struct sfs_fs *sfs;
+	bool exiting, idle;
+	int result;
+
+	(void)data2;
+
+	while (1) {
+		lock_acquire(j->j_lock);
+		while (!j->j_wantcommit && !j->j_exiting) {
+			if (cv_timedwait(j->j_cv, j->j_lock,
+					 SFS_JCOMMIT_TICKS) == ETIMEDOUT) {
+				break;
+			}
+		}
+		j->j_wantcommit = false;
+		lock_release(j->j_lock);
+
+		/*
+		 * j_exiting is set with the biglock held, so check it
+		 * under the biglock. This also keeps us from destroying
+		 * the journal before unmount is done with it.
+		 */
+		vfs_biglock_acquire();
+		exiting = j->j_exiting;
+		if (!exiting) {
+			sfs = j->j_sfs;
+			idle = (j->j_nstaged == 0 && j->j_nrevokes == 0 &&
+				!sfs->sfs_freemapdirty);
+			result = sfs_jcommit(sfs);
+			if (result == 0 &&
+			    (idle || j->j_used > j->j_size / 2)) {
+				result = sfs_jcheckpoint(sfs);
+			}
+			if (result) {
+				kprintf("sfs: %s: journal: %s\n",
+					sfs->sfs_sb.sb_volname,
+					strerror(result));
+			}
+		}
+		vfs_biglock_release();
+
+		if (exiting) {
+			sfs_journal_destroy(j);
+			thread_exit();
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Mount and unmount
+
+/*
+ * Read the transaction at POS with sequence number SEQ and check
+ * that it's complete. If APPLY is set, load it into the jbufs.
+ * Returns the transaction's size in SIZE, or 0 if it isn't there.
+ */
+static
+int
+sfs_jreplay_txn(struct sfs_fs *sfs, uint32_t pos, uint32_t seq,
+		bool apply, uint32_t *size)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *jd;
+	struct sfs_jcommit *jc;
+	struct sfs_jbuf *jb;
+	uint32_t *list, sum, start, avail;
+	unsigned i, n, nimages, nlist;
+	int result;
+
+	*size = 0;
+	start = pos;
+	avail = j->j_size - (pos + j->j_size - j->j_tail) % j->j_size;
+
+	jd = (struct sfs_jdesc *)j->j_buf;
+	result = sfs_readblock(sfs, sfs_jlogblock(j, pos), jd, sizeof(*jd));
+	if (result) {
+		return result;
+	}
+	if (jd->jd_magic != SFS_JDESC_MAGIC || jd->jd_seq != seq ||
+	    jd->jd_nimages > j->j_size || jd->jd_nrevokes > SFS_FS_NBLOCKS(sfs)) {
+		return 0;
+	}
+	nimages = jd->jd_nimages;
+	n = nimages + jd->jd_nrevokes;
+	if (n == 0 || sfs_jtxnsize(n, nimages) > avail) {
+		/* empty transactions are never written */
+		return 0;
+	}
+
+	/* Collect the block list */
+	list = kmalloc(n * sizeof(uint32_t));
+	if (list == NULL) {
+		return ENOMEM;
+	}
+	sum = 0;
+	nlist = n < SFS_JDESC_ENTRIES ? n : SFS_JDESC_ENTRIES;
+	memcpy(list, jd->jd_blocks, nlist * sizeof(uint32_t));
+	sfs_jsum(&sum, jd);
+	pos++;
+	while (nlist < n) {
+		result = sfs_readblock(sfs, sfs_jlogblock(j, pos), j->j_buf,
+				       SFS_BLOCKSIZE);
+		if (result) {
+			kfree(list);
+			return result;
+		}
+		sfs_jsum(&sum, j->j_buf);
+		pos++;
+		for (i = 0; i < SFS_JLIST_ENTRIES && nlist < n; i++) {
+			list[nlist++] = j->j_buf[i];
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (list[i] >= SFS_FS_NBLOCKS(sfs)) {
+			kfree(list);
+			return 0;
+		}
+	}
+
+	/* Revokes cancel anything earlier transactions logged */
+	if (apply) {
+		for (i = nimages; i < n; i++) {
+			sfs_jbuf_drop(j, list[i]);
+		}
+	}
+
+	/* Images */
+	for (i = 0; i < nimages; i++) {
+		result = sfs_readblock(sfs, sfs_jlogblock(j, pos), j->j_buf,
+				       SFS_BLOCKSIZE);
+		if (result) {
+			kfree(list);
+			return result;
+		}
+		sfs_jsum(&sum, j->j_buf);
+		pos++;
+		if (!apply) {
+			continue;
+		}
+		jb = sfs_jfind(j, list[i]);
+		if (jb == NULL) {
+			jb = sfs_jbuf_create(j, list[i]);
+			if (jb == NULL) {
+				kfree(list);
+				return ENOMEM;
+			}
+			jb->jb_logged = true;
+			j->j_nlogged++;
+		}
+		memcpy(jb->jb_data, j->j_buf, SFS_BLOCKSIZE);
+	}
+	kfree(list);
+
+	/* Commit record */
+	jc = (struct sfs_jcommit *)j->j_buf;
+	result = sfs_readblock(sfs, sfs_jlogblock(j, pos), jc, sizeof(*jc));
+	if (result) {
+		return result;
+	}
+	pos++;
+	if (jc->jc_magic != SFS_JCOMMIT_MAGIC || jc->jc_seq != seq ||
+	    jc->jc_sum != sum) {
+		KASSERT(!apply);
+		return 0;
+	}
+
+	*size = pos - start;
+	return 0;
+}
+
+/*
+ * Replay committed transactions after an unclean shutdown, then
+ * checkpoint them so the log starts out empty.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	uint32_t size, ntxns, nblocks;
+	int result;
+
+	ntxns = nblocks = 0;
+	while (1) {
+		result = sfs_jreplay_txn(sfs, j->j_head, j->j_headseq, false,
+					 &size);
+		if (result) {
+			return result;
+		}
+		if (size == 0) {
+			break;
+		}
+		result = sfs_jreplay_txn(sfs, j->j_head, j->j_headseq, true,
+					 &size);
+		if (result) {
+			return result;
+		}
+		KASSERT(size > 0);
+		j->j_head = (j->j_head + size) % j->j_size;
+		j->j_headseq++;
+		j->j_used += size;
+		ntxns++;
+		nblocks += size;
+	}
+
+	if (ntxns > 0) {
+		kprintf("sfs: %s: journal: replaying %u transactions "
+			"(%u blocks)\n", sfs->sfs_sb.sb_volname, ntxns,
+			nblocks);
+	}
+	return sfs_jcheckpoint(sfs);
+}
+
+/*
+ * Set up the journal at mount time: replay it, and start the journal
+ * thread. This must happen before the freemap is loaded, since
+ * replay may change it. Does nothing on volumes without a journal.
+ */
+int
+sfs_journal_mount(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j;
+	struct sfs_jheader *jh;
+	uint32_t jstart, jblocks;
+	unsigned i;
+	int result;
+
+	KASSERT(sfs->sfs_journal == NULL);
+
+	jstart = sfs->sfs_sb.sb_journalstart;
+	jblocks = sfs->sfs_sb.sb_journalblocks;
+	if (jblocks == 0) {
+		return 0;
+	}
+	if (jblocks < SFS_JOURNAL_MINBLOCKS ||
+	    jstart <= SFS_FREEMAP_START ||
+	    jstart + jblocks > SFS_FS_NBLOCKS(sfs)) {
+		kprintf("sfs: %s: invalid journal location %u+%u\n",
+			sfs->sfs_sb.sb_volname, jstart, jblocks);
+		return EINVAL;
+	}
+
+	j = kmalloc(sizeof(*j));
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	j->j_sfs = sfs;
+	j->j_start = jstart;
+	j->j_size = jblocks - 1;
+	for (i = 0; i < SFS_JHASHSIZE; i++) {
+		j->j_hash[i] = NULL;
+	}
+	j->j_nstaged = j->j_nlogged = 0;
+	j->j_pendfree = j->j_revokes = NULL;
+	j->j_nrevokes = 0;
+	j->j_wantcommit = j->j_exiting = false;
+	j->j_ncommits = j->j_nlogblocks = j->j_ncheckpoints = 0;
+	j->j_warned = false;
+	j->j_lock = lock_create("sfs journal");
+	if (j->j_lock == NULL) {
+		kfree(j);
+		return ENOMEM;
+	}
+	j->j_cv = cv_create("sfs journal");
+	if (j->j_cv == NULL) {
+		lock_destroy(j->j_lock);
+		kfree(j);
+		return ENOMEM;
+	}
+	sfs->sfs_journal = j;
+
+	jh = (struct sfs_jheader *)j->j_buf;
+	result = sfs_readblock(sfs, jstart, jh, sizeof(*jh));
+	if (result) {
+		goto fail;
+	}
+	if (jh->jh_magic != SFS_JOURNAL_MAGIC || jh->jh_tail >= j->j_size) {
+		kprintf("sfs: %s: bad journal header\n",
+			sfs->sfs_sb.sb_volname);
+		result = EINVAL;
+		goto fail;
+	}
+	j->j_tail = j->j_head = jh->jh_tail;
+	j->j_tailseq = j->j_headseq = jh->jh_tailseq;
+	j->j_used = 0;
+
+	result = sfs_jreplay(sfs);
+	if (result) {
+		goto fail;
+	}
+
+	/* The superblock may have been in the log. */
+	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+			       sizeof(sfs->sfs_sb));
+	if (result) {
+		goto fail;
+	}
+
+	result = thread_fork("sfs journal", NULL, sfs_jthread, j, 0);
+	if (result) {
+		goto fail;
+	}
+	return 0;
+
+ fail:
+	sfs->sfs_journal = NULL;
+	sfs_journal_destroy(j);
+	return result;
+}
+
+/*
+ * Detach the journal at unmount. Everything must have been flushed.
+ * The journal thread cleans up the rest.
+ */
+void
+sfs_journal_unmount(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (j == NULL) {
+		return;
+	}
+	KASSERT(j->j_nstaged == 0 && j->j_nlogged == 0);
+	KASSERT(j->j_pendfree == NULL && j->j_revokes == NULL);
+
+	DEBUG(DB_SFS, "sfs: %s: journal: %u commits, %u log blocks, "
+	      "%u checkpoints\n", sfs->sfs_sb.sb_volname, j->j_ncommits,
+	      j->j_nlogblocks, j->j_ncheckpoints);
+
+	sfs->sfs_journal = NULL;
+	lock_acquire(j->j_lock);
+	j->j_sfs = NULL;
+	j->j_exiting = true;
+	cv_signal(j->j_cv, j->j_lock);
+	lock_release(j->j_lock);
+}
@@ -35,10 +35,13 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/ioctl.h>
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
+#include <copyinout.h>
 #include <vfs.h>
+#include <pagecache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -102,8 +105,17 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	/* Pick up stores made through mappings of the file. */
+	result = pagecache_flush(v, uio->uio_offset,
+				 uio->uio_offset + uio->uio_resid);
+	if (result) {
+		return result;
+	}
+
 	vfs_biglock_acquire();
+	pagecache_fsio_enter();
 	result = sfs_io(sv, uio);
+	pagecache_fsio_leave();
 	vfs_biglock_release();
 
 	return result;
@@ -117,14 +129,28 @@ int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	off_t start = uio->uio_offset;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	/*
+	 * Mapped pages in the range go to disk first and are reread
+	 * after, so neither the mapping's stores nor ours get lost.
+	 */
+	result = pagecache_flush(v, start, start + uio->uio_resid);
+	if (result) {
+		return result;
+	}
+
 	vfs_biglock_acquire();
+	pagecache_fsio_enter();
 	result = sfs_io(sv, uio);
+	pagecache_fsio_leave();
 	vfs_biglock_release();
 
+	pagecache_refresh(v, start, uio->uio_offset);
+
 	return result;
 }
 
@@ -135,13 +161,25 @@ static
 int
 sfs_ioctl(struct vnode *v, int op, userptr_t data)
 {
-	/*
-	 * No ioctls.
-	 */
+	struct sfs_vnode *sv = v->vn_data;
+	off_t pos;
+	int result;
 
-	(void)v;
-	(void)op;
-	(void)data;
+	switch (op) {
+	    case FIOSEEKDATA:
+	    case FIOSEEKHOLE:
+		result = copyin(data, &pos, sizeof(pos));
+		if (result) {
+			return result;
+		}
+		vfs_biglock_acquire();
+		result = sfs_seekhole(sv, op == FIOSEEKDATA, &pos);
+		vfs_biglock_release();
+		if (result) {
+			return result;
+		}
+		return copyout(&pos, data, sizeof(pos));
+	}
 
 	return EINVAL;
 }
@@ -232,14 +270,16 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Any file can be mapped; the page cache does the
+ * actual work with sfs_read and sfs_write.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, int prot)
 {
 	(void)v;
-	return ENOSYS;
+	(void)prot;
+	return 0;
 }
 
 /*
@@ -317,7 +357,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, SFS_TYPE_FILE, sv->sv_ino, &newguy);
 	if (result) {
 		vfs_biglock_release();
 		return result;
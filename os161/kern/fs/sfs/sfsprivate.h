@@ -37,19 +37,38 @@
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
+/* Shortcuts for the size macros in kern/sfs.h */
+#define SFS_FS_NBLOCKS(sfs)        ((sfs)->sfs_sb.sb_nblocks)
+#define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
+#define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
+
+/*
+ * Number of blocks set aside at a time for a growing regular file,
+ * so files written side by side don't end up interleaved on disk.
+ */
+#define SFS_PREALLOC 8
+
 /* Macro for initializing a uio structure */
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_clearblock(struct sfs_fs *sfs, daddr_t block);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t hint, daddr_t *diskblock);
+int sfs_balloc_run(struct sfs_fs *sfs, daddr_t hint, unsigned want,
+		   daddr_t *start, unsigned *count);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
+void sfs_bfree_now(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-		daddr_t *diskblock);
+		daddr_t *diskblock, bool *fresh);
+void sfs_prealloc_release(struct sfs_vnode *sv);
+int sfs_findblock(struct sfs_vnode *sv, uint32_t fileblock, uint32_t limit,
+		  bool wantdata, uint32_t *ret);
+int sfs_seekhole(struct sfs_vnode *sv, bool wantdata, off_t *pos);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
 /* Functions in sfs_dir.c */
@@ -62,17 +81,29 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/* Functions in sfs_journal.c */
+int sfs_journal_mount(struct sfs_fs *sfs);
+void sfs_journal_unmount(struct sfs_fs *sfs);
+int sfs_jwrite(struct sfs_fs *sfs, daddr_t block, const void *data);
+bool sfs_jread(struct sfs_fs *sfs, daddr_t block, void *data);
+void sfs_jfree(struct sfs_fs *sfs, daddr_t block);
+int sfs_jcommit(struct sfs_fs *sfs);
+int sfs_jcommit_all(struct sfs_fs *sfs);
+int sfs_jflush(struct sfs_fs *sfs);
+
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
-int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_makeobj(struct sfs_fs *sfs, int type, uint32_t nearino,
+		struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_writemeta(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
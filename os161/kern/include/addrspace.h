@@ -39,6 +39,38 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pcpage;
+
+#if OPT_DUMBVM
+/*
+ * A region set up by mmap(). File pages come from the page cache;
+ * private copies of them, and anonymous memory, belong to the region.
+ */
+struct dumbvm_map {
+        vaddr_t dm_base;		/* first address, or 0 if unused */
+        unsigned dm_npages;		/* size in pages */
+        int dm_prot;			/* PROT_* from kern/mman.h */
+        int dm_flags;			/* MAP_* from kern/mman.h */
+        struct vnode *dm_vn;		/* file, or NULL for MAP_ANON */
+        off_t dm_offset;		/* file offset of dm_base */
+        struct pcpage **dm_shared;	/* cache page per page, or NULL */
+        paddr_t *dm_private;		/* own page per page, or 0 */
+};
+
+#define DUMBVM_NMAPS 8
+
+/*
+ * Software TLB: recent translations, direct-mapped by page number,
+ * that vm_fault reloads without looking at the regions. ste_elo is
+ * the whole TLBLO value; an entry is in use if it has TLBLO_VALID.
+ */
+struct dumbvm_stlbent {
+        vaddr_t ste_vaddr;		/* page address */
+        uint32_t ste_elo;		/* what to put in the TLB */
+};
+
+#define DUMBVM_STLBSIZE 128
+#endif
 
 
 /*
@@ -57,11 +89,38 @@ struct addrspace {
         paddr_t as_pbase2;
         size_t as_npages2;
         paddr_t as_stackpbase;
+        vaddr_t as_heapbase;		/* start of heap */
+        vaddr_t as_heaptop;		/* current break */
+        paddr_t *as_heappages;		/* page per heap page, or 0 */
+        unsigned as_heapslots;		/* size of as_heappages */
+        struct dumbvm_map as_maps[DUMBVM_NMAPS]; /* mmap regions */
+        vaddr_t as_mapbase;		/* lowest mmap region, or stack */
+        struct dumbvm_stlbent as_stlb[DUMBVM_STLBSIZE]; /* software TLB */
+        unsigned as_resident;		/* pages in memory */
+        unsigned as_maxresident;	/* most as_resident has been */
+        unsigned as_minflt;		/* pages made without I/O */
+        unsigned as_majflt;		/* file pages brought in */
+        unsigned as_evictions;		/* pages taken by the RSS limit */
+        unsigned as_evicthand;		/* where eviction looks next */
 #else
         /* Put stuff here for your VM system */
 #endif
 };
 
+/*
+ * Memory use of an address space, for getrusage() and friends. Sizes
+ * are in pages.
+ */
+struct as_usage {
+        unsigned au_virtual;		/* pages mapped */
+        unsigned au_resident;		/* pages in memory */
+        unsigned au_maxresident;	/* most ever in memory at once */
+        unsigned au_swapped;		/* pages out on swap */
+        unsigned au_minflt;		/* faults that didn't need I/O */
+        unsigned au_majflt;		/* faults that did (or might have) */
+        unsigned au_evictions;		/* pages taken to stay in RLIMIT_RSS */
+};
+
 /*
  * Functions in addrspace.c:
  *
@@ -99,6 +158,25 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_sbrk   - move the end of the heap region by AMOUNT bytes, as
+ *                for sbrk(), and hand back the old end. The heap
+ *                starts out empty just past the last region defined.
+ *
+ *    as_mmap   - map LEN bytes of file VN starting at OFFSET (or, for
+ *                MAP_ANON, zero-filled memory, with VN NULL) with
+ *                protection PROT and flags FLAGS, as for mmap(), and
+ *                hand back the address chosen.
+ *
+ *    as_munmap - remove the mapping at ADDR, as for munmap().
+ *
+ *    as_msync  - write back the dirty shared file pages mapped in
+ *                [ADDR, ADDR+LEN), as for msync().
+ *
+ *    as_getusage - report the memory use of AS. The VM system keeps
+ *                the resident set of the current process within its
+ *                RLIMIT_RSS by replacing its own pages when it
+ *                faults.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +195,15 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, struct vnode *vn,
+                          off_t offset, size_t len, int prot, int flags,
+                          vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t addr, size_t len,
+                           int flags);
+void              as_getusage(struct addrspace *as, struct as_usage *ret);
 
 
 /*
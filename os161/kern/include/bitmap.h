@@ -38,9 +38,18 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *     bitmap_alloc_range - same, but only look at bits START..END-1.
+ *     bitmap_alloc_near  - same, but take the first cleared bit at or
+ *                      after HINT, wrapping around to the start.
+ *     bitmap_alloc_run   - locate N consecutive cleared bits, searching
+ *                      from HINT and wrapping, set them all, and return
+ *                      the index of the first.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
+ *     bitmap_rebuild - resynchronize after the data returned by
+ *                      bitmap_getdata has been modified directly
+ *                      (e.g. read in from disk).
  *     bitmap_destroy - destroy bitmap.
  */
 
@@ -50,9 +59,16 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_range(struct bitmap *, unsigned start,
+                                  unsigned end, unsigned *index);
+int            bitmap_alloc_near(struct bitmap *, unsigned hint,
+                                 unsigned *index);
+int            bitmap_alloc_run(struct bitmap *, unsigned n, unsigned hint,
+                                unsigned *start);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
 int            bitmap_isset(struct bitmap *, unsigned index);
+void           bitmap_rebuild(struct bitmap *);
 void           bitmap_destroy(struct bitmap *);
 
 
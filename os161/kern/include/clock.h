@@ -79,5 +79,41 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * Timeouts: one-shot callbacks run from hardclock() after a given
+ * number of hardclock ticks.
+ *
+ * A timeout is queued on the cpu that arms it and fires on that cpu,
+ * in interrupt context; the callback may take spinlocks and wake
+ * threads but must not sleep. The struct timeout is owned by the
+ * caller (it is often on the stack) and must not be freed or reused
+ * while armed; timeout_cancel guarantees the callback is not running
+ * when it returns.
+ *
+ *    timeout_init   - set up TO to call FUNC(ARG) when it expires.
+ *    timeout_arm    - queue TO to expire in TICKS hardclocks.
+ *    timeout_cancel - dequeue TO if it hasn't fired. Returns the
+ *                     number of ticks that were left, or 0 if the
+ *                     timeout already fired (or was never armed).
+ *
+ * MSEC_TO_HARDCLOCKS rounds up so that a nonzero interval never
+ * becomes a zero-tick (that is, immediate) timeout.
+ */
+
+struct timeout {
+	struct timeout *to_next;	/* link on the cpu's timeout list */
+	struct cpu *to_cpu;		/* cpu whose list we're on */
+	unsigned to_expires;		/* c_hardclocks value to fire at */
+	void (*to_func)(void *);
+	void *to_arg;
+	bool to_pending;		/* true while queued */
+};
+
+#define MSEC_TO_HARDCLOCKS(ms)	(((ms) * HZ + 999) / 1000)
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_arm(struct timeout *to, unsigned ticks);
+unsigned timeout_cancel(struct timeout *to);
+
 
 #endif /* _CLOCK_H_ */
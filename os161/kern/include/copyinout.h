@@ -50,6 +50,15 @@
  * returns the actual length of string found in GOT. DEST is always
  * null-terminated on success. LEN and GOT include the null terminator.
  *
+ * copyin_bulk copies an array of NELEM objects of ELEMSIZE bytes each
+ * from USERSRC to DEST, checking the size computation for overflow.
+ * Use it for syscall arguments that are arrays (argv, iovecs) rather
+ * than calling copyin per element.
+ *
+ * copyuio is the user-space half of uiomove(); it checks all the user
+ * ranges of the transfer before copying any of them. It's not meant
+ * to be called directly.
+ *
  * All of these functions return 0 on success, EFAULT if a memory
  * addressing error was encountered, or (for the string versions)
  * ENAMETOOLONG if the space available was insufficient.
@@ -68,6 +77,11 @@ int copyin(const_userptr_t usersrc, void *dest, size_t len);
 int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
+int copyin_bulk(const_userptr_t usersrc, void *dest, size_t nelem,
+		size_t elemsize);
+
+struct uio; /* from <uio.h> */
+int copyuio(void *ptr, size_t n, struct uio *uio);
 
 
 #endif /* _COPYINOUT_H_ */
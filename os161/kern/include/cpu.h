@@ -35,6 +35,9 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct timeout; /* from <clock.h> */
+struct addrspace; /* from <addrspace.h> */
+
 extern unsigned num_cpus;
 
 /*
@@ -63,14 +66,45 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Accessed by other cpus (to cancel timeouts).
+	 * Protected by the timeout lock.
+	 *
+	 * c_timeouts is sorted by expiry time. c_timeout_running is
+	 * the timeout whose callback is executing right now, if any.
+	 */
+	struct timeout *c_timeouts;	/* Pending timeouts for this cpu */
+	struct timeout *c_timeout_running;
+	struct spinlock c_timeout_lock;
+
 	/*
 	 * Accessed by other cpus.
-	 * Protected by the runqueue lock.
+	 * Protected by the runqueue lock. (Except that c_isidle is
+	 * also peeked at without it when handing over wakeups.)
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus without locking.
+	 *
+	 * Threads made runnable from other cpus are pushed onto
+	 * c_wakeups (linked through t_wakenext) with atomic
+	 * operations instead of taking this cpu's runqueue lock. Only
+	 * this cpu takes them off, in thread_switch.
+	 */
+	struct thread *volatile c_wakeups;
+
+	/*
+	 * Accessed by other cpus without locking.
+	 *
+	 * c_curas is the address space this cpu last activated, which
+	 * is the only one that can have entries in its TLB. Other cpus
+	 * look at it to decide whether to send us shootdowns.
+	 */
+	struct addrspace *volatile c_curas;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -83,10 +117,23 @@ struct cpu {
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
+	 *
+	 * Requests that arrive while a shootdown IPI is already pending
+	 * just join the queue. If it fills up, c_shootdown_all is set
+	 * and the whole TLB gets flushed instead. c_shootdown_queued
+	 * and c_shootdown_done count requests taken and finished, so
+	 * senders can wait for theirs. The remaining counters are
+	 * statistics.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	bool c_shootdown_all;		/* Queue overflowed: flush all */
+	unsigned c_shootdown_queued;	/* Requests queued, ever */
+	volatile unsigned c_shootdown_done; /* Requests completed, ever */
+	unsigned c_shootdown_ipis;	/* Shootdown IPIs sent to us */
+	unsigned c_shootdown_entries;	/* TLB entries invalidated */
+	unsigned c_shootdown_flushes;	/* Whole-TLB flushes */
 	struct spinlock c_ipi_lock;
 
 	/*
@@ -156,6 +203,19 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * It only interrupts the target if it doesn't already have a
+ * shootdown pending, and returns a ticket for ipi_tlbshootdown_wait,
+ * which spins until the target has done the request. Call that with
+ * interrupts on and no spinlocks held, since the target may be
+ * waiting on us the same way.
+ *
+ * ipi_tlbshootdown_sync does MAPPING on every CPU (this one included)
+ * whose current address space is AS, or on every CPU if AS is NULL,
+ * and waits until they've all done it. The caller must have already
+ * changed the mappings; CPUs that switch to AS afterwards flush their
+ * TLB when they do (in as_activate) so don't need it.
+ *
+ * tlbshootdown_getstats adds up the shootdown counters of all CPUs.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,7 +229,19 @@ void cpu_halt(void);
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown(struct cpu *target,
+			  const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
+void ipi_tlbshootdown_sync(struct addrspace *as,
+			   const struct tlbshootdown *mapping);
+
+struct tlbshootdown_stats {
+	unsigned tss_requests;		/* requests queued to other cpus */
+	unsigned tss_ipis;		/* interrupts actually sent */
+	unsigned tss_entries;		/* TLB entries invalidated */
+	unsigned tss_flushes;		/* whole-TLB flushes on overflow */
+};
+void tlbshootdown_getstats(struct tlbshootdown_stats *stats);
 
 void interprocessor_interrupt(void);
 
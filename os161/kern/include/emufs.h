@@ -41,10 +41,43 @@
  * Our structures
  */
 
+/*
+ * Each file vnode can cache one EMU_MAXIO-sized piece of the file
+ * (ev_rbuf, allocated on first use) and its size. Both are tagged
+ * with the device's write generation (e_gen) and are only good while
+ * that hasn't changed. They're protected by the device lock. Changes
+ * made to the files on the host behind our back aren't noticed.
+ */
 struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+
+	char *ev_rbuf;			/* read cache, or NULL */
+	off_t ev_rstart;		/* file offset of ev_rbuf[0] */
+	uint32_t ev_rlen;		/* bytes valid in ev_rbuf */
+	uint32_t ev_rgen;		/* e_gen when ev_rbuf was filled */
+	bool ev_rvalid;			/* ev_rbuf holds anything */
+
+	off_t ev_size;			/* cached file size */
+	uint32_t ev_sizegen;		/* e_gen when ev_size was fetched */
+	bool ev_sizevalid;		/* ev_size holds anything */
+};
+
+/*
+ * Name lookup cache: recently looked up names, keyed by directory
+ * and relative path. Each entry holds a reference to its vnode (and
+ * so keeps the host file handle open), which lets repeated lookups
+ * of the same path skip the device entirely. Protected by the vfs
+ * biglock.
+ */
+#define EMUFS_NCACHE		32
+#define EMUFS_NCNAMELEN		48
+
+struct emufs_ncentry {
+	struct emufs_vnode *nc_dir;	/* directory looked up in */
+	struct emufs_vnode *nc_vn;	/* result, or NULL if unused */
+	char nc_name[EMUFS_NCNAMELEN];	/* path looked up */
 };
 
 struct emufs_fs {
@@ -52,6 +85,7 @@ struct emufs_fs {
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	struct emufs_ncentry ef_ncache[EMUFS_NCACHE]; /* name cache */
 };
 
 
@@ -34,6 +34,16 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * Hole-aware seeking, for copying sparse files without reading or
+ * writing their holes. The argument points to an off_t holding a
+ * file position, which is replaced with the position of the next
+ * data (FIOSEEKDATA) or the start of the next hole (FIOSEEKHOLE) at
+ * or after it. End of file counts as a hole. Both fail with ENXIO if
+ * the position is at or past end of file, and FIOSEEKDATA also fails
+ * with ENXIO if there's no data after it.
+ */
+#define FIOSEEKDATA	1	/* Find next data */
+#define FIOSEEKHOLE	2	/* Find next hole */
 
 #endif /* _KERN_IOCTL_H_*/
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap(), munmap(), and msync().
+ *
+ * A mapping is either MAP_SHARED, where stores go to the file's pages
+ * in the page cache and are seen by every other mapping of the file
+ * and by read(), or MAP_PRIVATE, where the first store to each page
+ * copies it. MAP_ANON maps zero-filled memory with no file behind it.
+ */
+
+/* Protection bits for mmap() */
+#define PROT_NONE     0      /* Page can't be touched */
+#define PROT_READ     1      /* Page can be read */
+#define PROT_WRITE    2      /* Page can be written */
+#define PROT_EXEC     4      /* Page can be executed */
+
+/* Flags for mmap() */
+#define MAP_SHARED    1      /* Stores go to the file */
+#define MAP_PRIVATE   2      /* Stores are copy-on-write */
+#define MAP_ANON      4      /* Zero-filled memory, no file */
+
+/* Flags for msync() */
+#define MS_ASYNC      1      /* Schedule write-back (done synchronously) */
+#define MS_SYNC       2      /* Write back before returning */
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -43,5 +43,14 @@
 #define SEEK_CUR      1      /* Seek relative to current position in file */
 #define SEEK_END      2      /* Seek relative to end of file */
 
+/*
+ * Seek to the next data or hole at or after the given offset. These
+ * have the same meaning as the FIOSEEKDATA and FIOSEEKHOLE ioctls in
+ * <kern/ioctl.h>, which is how an lseek() implementation should ask
+ * the filesystem for them.
+ */
+#define SEEK_DATA     3      /* Seek to next data */
+#define SEEK_HOLE     4      /* Seek to next hole */
+
 
 #endif /* _KERN_SEEK_H_ */
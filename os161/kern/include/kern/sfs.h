@@ -74,7 +74,9 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First block of journal */
+	uint32_t sb_journalblocks;		/* Journal size; 0 if none */
+	uint32_t reserved[116];			/* unused, set to 0 */
 };
 
 /*
@@ -97,5 +99,58 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Metadata journal
+ *
+ * If sb_journalblocks is nonzero, that many blocks starting at
+ * sb_journalstart (they are marked in use in the freemap) hold a
+ * write-ahead log of metadata updates. The first is a header; the
+ * rest are a circular log. The log holds a sequence of transactions,
+ * each laid out as:
+ *
+ *    sfs_jdesc
+ *    further lists of block numbers, if they don't fit in the
+ *        sfs_jdesc (SFS_JLIST_ENTRIES per block)
+ *    the new contents of each block in jd_blocks[0..jd_nimages-1]
+ *    sfs_jcommit
+ *
+ * The block numbers after the images in the list are revoked: they
+ * were freed in that transaction, so older images of them must not
+ * be replayed. A transaction counts only if its commit record is
+ * present with the right sequence number and checksum. jh_tail and
+ * jh_tailseq locate the oldest transaction that may not have been
+ * written to its home locations yet; replay starts there and follows
+ * the sequence numbers.
+ */
+
+#define SFS_JOURNAL_MAGIC   0x5f5a10c0  /* journal header */
+#define SFS_JDESC_MAGIC     0x5f5a7e00  /* transaction descriptor */
+#define SFS_JCOMMIT_MAGIC   0x5f5ac0de  /* transaction commit */
+#define SFS_JDESC_ENTRIES   124         /* block numbers in sfs_jdesc */
+#define SFS_JLIST_ENTRIES   128         /* block numbers per list block */
+#define SFS_JOURNAL_MINBLOCKS 16        /* smallest usable journal */
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JOURNAL_MAGIC */
+	uint32_t jh_tail;			/* Log offset of oldest txn */
+	uint32_t jh_tailseq;			/* Its sequence number */
+	uint32_t jh_waste[125];			/* unused, set to 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JDESC_MAGIC */
+	uint32_t jd_seq;			/* Transaction sequence number */
+	uint32_t jd_nimages;			/* Blocks logged */
+	uint32_t jd_nrevokes;			/* Blocks revoked */
+	uint32_t jd_blocks[SFS_JDESC_ENTRIES];	/* First block numbers */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;			/* SFS_JCOMMIT_MAGIC */
+	uint32_t jc_seq;			/* Same as jd_seq */
+	uint32_t jc_sum;			/* Checksum of the other blocks */
+	uint32_t jc_waste[125];			/* unused, set to 0 */
+};
+
 
 #endif /* _KERN_SFS_H_ */
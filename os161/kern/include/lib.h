@@ -179,6 +179,9 @@ void beep(void);
  * kprintf_bootstrap sets up a lock for kprintf and should be called
  * during boot once malloc is available and before any additional
  * threads are created.
+ *
+ * panicstart is set once a panic is under way; console code checks it
+ * so as not to wait for locks another cpu may never let go of.
  */
 int kprintf(const char *format, ...) __PF(1,2);
 __DEAD void panic(const char *format, ...) __PF(1,2);
@@ -188,6 +191,7 @@ __DEAD void badassert(const char *expr, const char *file,
 void kgets(char *buf, size_t maxbuflen);
 
 void kprintf_bootstrap(void);
+extern volatile bool panicstart;
 
 /*
  * Other miscellaneous stuff
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for mapped files.
+ *
+ * Every page of a file that some address space has mapped lives here
+ * exactly once, so all MAP_SHARED mappings of it (and the read-only
+ * view MAP_PRIVATE mappings have before they copy) are the same
+ * physical page. A page holds a reference to its vnode and exists
+ * only while it's mapped; the last pagecache_put writes it back if
+ * it's dirty and recycles the memory.
+ *
+ * Pages are filled with VOP_READ and cleaned with VOP_WRITE, so any
+ * filesystem whose files can be read and written can be mapped. To
+ * keep read() and write() coherent with mappings, the filesystem
+ * calls pagecache_flush before reading a range of a file and
+ * pagecache_refresh after writing one. Both are cheap no-ops for
+ * files that have nothing mapped.
+ *
+ *    pagecache_bootstrap - set up the cache; call once during boot.
+ *
+ *    pagecache_get     - hand back the page for page-aligned OFFSET of
+ *                        VN, reading it in if it isn't cached, and
+ *                        take a reference to it.
+ *
+ *    pagecache_put     - drop a reference from pagecache_get.
+ *
+ *    pagecache_dirty   - note that PP has been (or is about to be)
+ *                        written through a mapping.
+ *
+ *    pagecache_paddr   - physical address of PP, for the TLB.
+ *
+ *    pagecache_flush   - write back the dirty pages of VN that overlap
+ *                        [START, END).
+ *
+ *    pagecache_refresh - reread the cached pages of VN that overlap
+ *                        [START, END) after the file changed under
+ *                        them. Dirty pages are left alone.
+ *
+ *    pagecache_sync    - write back every dirty page, for sync().
+ *
+ *    pagecache_fsio_enter,
+ *    pagecache_fsio_leave - bracket filesystem code that copies to or
+ *                        from user memory while holding the
+ *                        filesystem's own locks. A fault in between
+ *                        that finds its page busy with another
+ *                        thread's I/O doesn't wait for it, as that
+ *                        I/O may be waiting for the same locks:
+ *                        pagecache_get fails with EFAULT, and a
+ *                        pagecache_put that would have to wait
+ *                        leaves the rest to the thread doing the I/O.
+ *
+ * Dirty tracking relies on the VM system mapping cache pages without
+ * write permission until pagecache_dirty has been called; cleaning a
+ * page invalidates every TLB so the next store faults and marks it
+ * dirty again.
+ */
+
+struct vnode;
+struct pcpage;
+
+void pagecache_bootstrap(void);
+
+int pagecache_get(struct vnode *vn, off_t offset, struct pcpage **ret);
+void pagecache_put(struct pcpage *pp);
+void pagecache_dirty(struct pcpage *pp);
+paddr_t pagecache_paddr(struct pcpage *pp);
+
+int pagecache_flush(struct vnode *vn, off_t start, off_t end);
+void pagecache_refresh(struct vnode *vn, off_t start, off_t end);
+int pagecache_sync(void);
+
+void pagecache_fsio_enter(void);
+void pagecache_fsio_leave(void);
+
+
+#endif /* _PAGECACHE_H_ */
@@ -37,6 +37,8 @@
  */
 
 #include <spinlock.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 
 struct addrspace;
 struct thread;
@@ -70,6 +72,9 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
+	/* Limits (only RLIMIT_RSS is enforced, by the VM system) */
+	struct rlimit p_rlimit[__RLIMIT_NUM];
+
 	/* add more material here as needed */
 };
 
@@ -97,5 +102,9 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
+/* Fetch or change one of the resource limits of a process. */
+void proc_getrlimit(struct proc *proc, int which, struct rlimit *ret);
+int proc_setrlimit(struct proc *proc, int which, const struct rlimit *rl);
+
 
 #endif /* _PROC_H_ */
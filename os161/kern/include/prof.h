@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/*
+ * Sampling kernel profiler.
+ *
+ * While it's running, every timer interrupt on every cpu records
+ * where that cpu was: the interrupted PC, the return address register
+ * (for most samples, the call site in the caller of the function that
+ * was running), whether it was in user mode, and the names of the
+ * current thread and process. Each cpu has its own ring of samples,
+ * so taking one costs no locks; when a ring is full the oldest
+ * samples are overwritten.
+ *
+ *    prof_start  - throw away any old samples and start sampling, with
+ *                  NSAMPLES per cpu. Fails with EINVAL if NSAMPLES
+ *                  is 0 or over PROF_MAXSAMPLES, and with EBUSY if
+ *                  already running.
+ *
+ *    prof_stop   - stop sampling. When it returns no cpu is still
+ *                  taking a sample.
+ *
+ *    prof_dump   - print the samples, added up by kernel PC, by call
+ *                  site, by thread, and by process, as "prof:" lines.
+ *                  Addresses are printed raw: there's no symbol table
+ *                  in the kernel, so feed the output and the kernel
+ *                  binary to test161/tests/bench/profile.py for a
+ *                  profile by function. Fails with EBUSY if running.
+ *
+ *    prof_sample - take a sample on this cpu; called by the timer
+ *                  interrupt just before hardclock(), since that's
+ *                  where the trapframe is.
+ */
+
+#define PROF_DEFSAMPLES	1024	/* per cpu; about 10 seconds at HZ */
+#define PROF_MAXSAMPLES	65536	/* per cpu */
+
+int prof_start(unsigned nsamples);
+void prof_stop(void);
+int prof_dump(void);
+void prof_sample(vaddr_t pc, vaddr_t caller, bool user);
+
+
+#endif /* _PROF_H_ */
@@ -48,6 +48,8 @@
  */
 #include <kern/sfs.h>
 
+struct sfs_journal;  /* Opaque; in sfs_journal.c */
+
 /*
  * In-memory inode
  */
@@ -56,6 +58,8 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	daddr_t sv_prealloc;            /* next preallocated block */
+	unsigned sv_nprealloc;          /* preallocated blocks left */
 };
 
 /*
@@ -69,6 +73,9 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_freemapblkdirty; /* which freemap blocks changed */
+	unsigned *sfs_freemapfree;      /* free blocks per freemap block */
+	struct sfs_journal *sfs_journal; /* metadata journal, if any */
 };
 
 /*
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include <thread.h>	/* for NPRI */
 
 /*
  * Dijkstra-style semaphore.
@@ -62,6 +63,13 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P_timed is P, but gives up after TICKS hardclocks (see <clock.h>).
+ * Returns 0 if the count was decremented, or ETIMEDOUT. With TICKS 0
+ * it never blocks.
+ */
+int P_timed(struct semaphore *, unsigned ticks);
+
 /*
  * Simple lock for mutual exclusion.
  *
@@ -80,8 +88,18 @@ struct lock {
         volatile bool is_locked;
 
         struct thread* owner;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+
+        /*
+         * Priority inheritance. lk_nextheld links the owner's
+         * t_heldlocks list. lk_waitpri[p] counts waiters whose
+         * effective priority is p; lk_nwaiters is their total, and
+         * includes waiters that have been woken but haven't yet
+         * retaken the lock. The counts are protected by both the
+         * lock's spinlock and the inheritance lock in synch.c.
+         */
+        struct lock *lk_nextheld;
+        unsigned lk_nwaiters;
+        unsigned lk_waitpri[NPRI];
 };
 
 struct lock *lock_create(const char *name);
@@ -95,14 +113,41 @@ void lock_destroy(struct lock *);
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
+ *    lock_handoff - Keep the lock locked but give up owning it, so any
+ *                   thread may then fancy_lock_release it.
  *
  * These operations must be atomic. You get to write them.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 void fancy_lock_release(struct lock *);
+void lock_handoff(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+/*
+ * lock_acquire_timed is lock_acquire, but gives up after TICKS
+ * hardclocks. Returns 0 with the lock held, or ETIMEDOUT without it.
+ */
+int lock_acquire_timed(struct lock *, unsigned ticks);
+
+/*
+ * Priority inheritance.
+ *
+ * A thread waiting for a lock lends its effective priority to the
+ * owner, and on down the chain if the owner is itself waiting for
+ * another lock. The owner drops back when it releases the lock. (A
+ * waiter that times out doesn't take its loan back early; the owner
+ * keeps it until it next releases a lock.)
+ *
+ * lock_inheritance turns the lending on and off; it exists so tests
+ * can show what happens without it.
+ *
+ * lock_inherit_update recomputes the current thread's effective
+ * priority, after its base priority has changed.
+ */
+extern bool lock_inheritance;
+void lock_inherit_update(void);
+
 
 /*
  * Condition variable.
@@ -146,6 +191,13 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * cv_timedwait is cv_wait, but stops waiting after TICKS hardclocks
+ * and returns ETIMEDOUT. (Returns 0 if signalled.) The lock is
+ * re-acquired in both cases; reacquiring it is not timed.
+ */
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
+
 /*
  * Reader-writer locks.
  *
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYSCALLSTATS_H_
+#define _SYSCALLSTATS_H_
+
+/*
+ * Per-syscall accounting. Enable with "options syscallstats" in the
+ * kernel config.
+ *
+ * With it, the syscall dispatcher counts every call, and every call
+ * that fails, by call number. It also adds up the time each call took
+ * and keeps a log2 histogram of those times. Each cpu has its own
+ * counters, so recording takes no locks. Readers add the cpus'
+ * counters together. Readers don't lock either, so a call that
+ * finishes while a report is being made may be counted in some totals
+ * and not others.
+ *
+ *    syscallstats_bootstrap - allocate the counters, once all cpus are
+ *                             up, and attach the "syscallstats:"
+ *                             device. Reading the device gives the
+ *                             same report as syscallstats_print.
+ *
+ *    syscallstats_print     - print the report on the console.
+ *
+ *    syscallstats_reset     - zero the counters.
+ *
+ *    syscallstats_record    - count one call. It is used through
+ *                             SYSCALLSTATS_START and SYSCALLSTATS_END,
+ *                             which compile to nothing without the
+ *                             option.
+ *
+ * Call numbers from SYSCALLSTATS_NCALLS up, and negative ones, are
+ * counted together as "other".
+ *
+ * Bucket 0 of the histogram holds calls that took under 1us. Bucket
+ * N holds calls that took at least 2^(N-1)us and under 2^N us. The
+ * last bucket also holds everything longer.
+ */
+
+#include "opt-syscallstats.h"
+
+#define SYSCALLSTATS_NCALLS	128	/* call numbers kept separately */
+#define SYSCALLSTATS_NBUCKETS	24	/* last one is 4s and up */
+
+#if OPT_SYSCALLSTATS
+
+#include <clock.h>	/* for gettime */
+
+void syscallstats_bootstrap(void);
+void syscallstats_print(void);
+void syscallstats_reset(void);
+void syscallstats_record(int callno, int err, const struct timespec *start);
+
+#define SYSCALLSTATS_START(ts)		gettime(ts)
+#define SYSCALLSTATS_END(n, err, ts)	syscallstats_record(n, err, ts)
+
+#else
+
+#define SYSCALLSTATS_START(ts)		((void)(ts))
+#define SYSCALLSTATS_END(n, err, ts)	((void)(ts))
+
+#endif /* OPT_SYSCALLSTATS */
+
+
+#endif /* _SYSCALLSTATS_H_ */
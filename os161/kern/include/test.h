@@ -51,6 +51,8 @@
 int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
+int bitmapbench(int, char **);
+int copybench(int, char **);
 int threadlisttest(int, char **);
 
 /* thread tests */
@@ -74,6 +76,23 @@ int rwtest3(int, char **);
 int rwtest4(int, char **);
 int rwtest5(int, char **);
 
+/* timed synchronization tests */
+int timedsemtest(int, char **);
+int timedlocktest(int, char **);
+int timedcvtest(int, char **);
+
+/* priority inheritance tests */
+int pritest(int, char **);
+int pritest2(int, char **);
+int pritest3(int, char **);
+
+/* TLB shootdown test */
+int tlbshoottest(int, char **);
+int tlbshoottest2(int, char **);
+
+/* futex wakeup test */
+int futextest(int, char **);
+
 /* semaphore unit tests */
 int semu1(int, char **);
 int semu2(int, char **);
@@ -105,6 +124,8 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int mmaptest(int, char **);
+int rsstest(int, char **);
 int printfile(int, char **);
 
 /* HMAC/hash tests */
@@ -184,6 +205,15 @@ int ll16test(int, char **);
 void random_yielder(uint32_t);
 void random_spinner(uint32_t);
 
+/*
+ * User address space with two LEN-byte regions at these addresses,
+ * for tests that exercise user memory from the kernel.
+ */
+#define TEST_UBASE1	0x00400000
+#define TEST_UBASE2	0x10000000
+struct addrspace;
+struct addrspace *test_makeas(size_t len);
+
 /*
  * kprintf variants that do not (or only) print during automated testing.
  */
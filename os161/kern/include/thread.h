@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock; /* from <synch.h> */
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -57,6 +58,16 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Thread priorities. Larger numbers are more urgent. The scheduler
+ * always runs the highest-priority ready thread on each cpu, round-
+ * robin among equals.
+ */
+#define PRI_MIN		0
+#define PRI_DEFAULT	8
+#define PRI_MAX		15
+#define NPRI		(PRI_MAX - PRI_MIN + 1)
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -92,9 +103,26 @@ struct thread {
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	struct wchan *t_wchan;		/* Wait channel, if sleeping */
+	struct thread *t_wakenext;	/* Link for cpu's c_wakeups */
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Priority fields.
+	 *
+	 * t_basepri is the priority the thread asked for. t_pri is
+	 * the one it runs at, which is raised above t_basepri while
+	 * it holds locks that higher-priority threads are waiting
+	 * for (see synch.c). t_pri and t_blockedon are protected by
+	 * the priority inheritance lock in synch.c; t_heldlocks is
+	 * only touched by the thread itself.
+	 */
+	int t_basepri;			/* Requested priority */
+	volatile int t_pri;		/* Effective priority */
+	struct lock *t_blockedon;	/* Lock we're waiting for, if any */
+	struct lock *t_heldlocks;	/* Locks we hold (via lk_nextheld) */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -112,6 +140,12 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Nesting depth of filesystem code copying to or from user
+	 * memory with its locks held (see pagecache_fsio_enter).
+	 */
+	unsigned t_fsio;
+
 	/*
 	 * Public fields
 	 */
@@ -168,6 +202,13 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Get or set the current thread's (base) priority. Lowering it yields
+ * right away if that lets something else run.
+ */
+int thread_getpriority(void);
+void thread_setpriority(int pri);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
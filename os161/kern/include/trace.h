@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Static kernel tracepoints. Enable with "options trace" in the
+ * kernel config; without it TRACE() compiles to nothing.
+ *
+ * With it, TRACE(event, a, b) appends a record to the current cpu's
+ * ring while tracing is running, and costs a load and a branch while
+ * it isn't. A record holds the time, the cpu, the current
+ * thread (address and the start of its name), the event, and two
+ * event-specific words. When a ring is full the oldest records are
+ * overwritten, so the dump is the last stretch before trace_stop.
+ *
+ *    trace_start - throw away any old records and start tracing, with
+ *                  NRECS records per cpu. Fails with EINVAL if NRECS
+ *                  is 0 or over TRACE_MAXRECS, and with EBUSY if
+ *                  already running.
+ *
+ *    trace_stop  - stop tracing. When it returns no cpu is still
+ *                  writing a record.
+ *
+ *    trace_dump  - write the records, oldest first for each cpu, to
+ *                  the file PATH: a struct traceheader and then
+ *                  th_nrecs struct tracerecs, in the kernel's byte
+ *                  order. Write it to emu0: to get at it from the
+ *                  host, and turn it into a timeline with
+ *                  test161/tests/bench/trace.py. Fails with EBUSY if
+ *                  running.
+ */
+
+#include "opt-trace.h"
+
+/* Events, and what goes in the two argument words. */
+#define TRACE_SWITCH	1	/* thread switched to, old thread's state */
+#define TRACE_SLEEP	2	/* wchan, 0 */
+#define TRACE_WAKE	3	/* wchan, thread woken */
+#define TRACE_LOCKWAIT	4	/* lock, 0 */
+#define TRACE_LOCKGOT	5	/* lock, 1 if we had to wait */
+#define TRACE_FAULT	6	/* fault address, fault type */
+#define TRACE_FAULTDONE	7	/* fault address, error */
+#define TRACE_SYSCALL	8	/* call number, 0 */
+#define TRACE_SYSRET	9	/* call number, error */
+#define TRACE_DISKIO	10	/* sector, 1 for a write */
+#define TRACE_DISKDONE	11	/* sector, error */
+
+#define TRACE_MAGIC	"KTRC"
+#define TRACE_VERSION	1
+#define TRACE_NAMELEN	8	/* thread name bytes kept, not terminated */
+#define TRACE_DEFRECS	4096	/* per cpu */
+#define TRACE_MAXRECS	65536	/* per cpu; 2M each, more than we have */
+
+struct traceheader {
+	char th_magic[4];		/* TRACE_MAGIC */
+	uint32_t th_version;		/* TRACE_VERSION */
+	uint32_t th_recsize;		/* sizeof(struct tracerec) */
+	uint32_t th_ncpus;
+	uint32_t th_nrecs;		/* records in the file */
+	uint32_t th_lost;		/* records overwritten */
+};
+
+struct tracerec {
+	uint32_t tr_sec;		/* time from gettime() */
+	uint32_t tr_nsec;
+	uint16_t tr_event;
+	uint16_t tr_cpu;
+	uint32_t tr_thread;		/* address of current thread */
+	uint32_t tr_a;
+	uint32_t tr_b;
+	char tr_name[TRACE_NAMELEN];	/* current thread's name */
+};
+
+#if OPT_TRACE
+
+extern volatile bool trace_running;
+
+int trace_start(unsigned nrecs);
+void trace_stop(void);
+int trace_dump(char *path);
+void trace_record(unsigned event, uint32_t a, uint32_t b);
+
+#define TRACE(ev, a, b) \
+	do { \
+		if (trace_running) { \
+			trace_record(ev, (uint32_t)(uintptr_t)(a), \
+				     (uint32_t)(uintptr_t)(b)); \
+		} \
+	} while (0)
+
+#else
+
+#define TRACE(ev, a, b)
+
+#endif /* OPT_TRACE */
+
+
+#endif /* _TRACE_H_ */
@@ -51,6 +51,13 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Look up the physical address currently backing user address VADDR
+ * in the current process. Returns EFAULT if it isn't mapped. Used to
+ * name user memory independently of which address space maps it.
+ */
+int vm_translate(vaddr_t vaddr, paddr_t *ret);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
@@ -62,8 +69,36 @@ void free_kpages(vaddr_t addr);
  */
 unsigned int coremap_used_bytes(void);
 
-/* TLB shootdown handling called from interprocessor_interrupt */
-void vm_tlbshootdown(const struct tlbshootdown *);
+/*
+ * Counters kept by the VM system. The page counts are current; the
+ * rest only go up, so a benchmark can take the difference of two
+ * snapshots.
+ */
+struct vm_stats {
+	unsigned vs_freepages;		/* pages on the free lists */
+	unsigned vs_zeropages;		/* ...of which already zeroed */
+	unsigned vs_zerohits;		/* zeroed page wanted and ready */
+	unsigned vs_zeromisses;		/* zeroed page wanted, had to clear */
+	unsigned vs_zeroed;		/* pages zeroed in the background */
+	unsigned vs_fastfaults;		/* TLB refills from the software TLB */
+	unsigned vs_slowfaults;		/* faults that looked up the page */
+	unsigned vs_tlbflushes;		/* address space switches that flushed */
+	unsigned vs_lazyswitches;	/* ...that didn't need to */
+};
+
+/* Fetch the VM counters */
+void vm_getstats(struct vm_stats *stats);
+
+/* Print statistics about physical page allocation (for the menu) */
+void vm_printstats(void);
+
+/*
+ * TLB shootdown handling called from interprocessor_interrupt (and
+ * for the local cpu by ipi_tlbshootdown_sync). Both return the
+ * number of TLB entries actually invalidated.
+ */
+unsigned vm_tlbshootdown(const struct tlbshootdown *);
+unsigned vm_tlbshootdown_all(void);
 
 
 #endif /* _VM_H_ */
@@ -66,6 +66,14 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but wake up on our own after TICKS hardclocks if
+ * nobody else does first. Returns the number of ticks remaining if
+ * awakened, or 0 on timeout. Either way the lock is held on return.
+ */
+unsigned wchan_sleep_timed(struct wchan *wc, struct spinlock *lk,
+			   unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -47,11 +47,231 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * To keep searches from walking over long stretches of allocated
+ * bits, there is a second level: one summary bit per chunk of
+ * CHUNK_WORDS words, set when every bit in the chunk is in use. The
+ * summary is in memory only, so it can use wide words; it is derived
+ * from the data and bitmap_rebuild recomputes it if the data is
+ * changed behind our back through bitmap_getdata.
+ */
+#define CHUNK_WORDS     32
+#define CHUNK_BITS      (CHUNK_WORDS * BITS_PER_WORD)
+#define SUM_BITS        32
+#define SUM_ALLBITS     (0xffffffff)
+
 struct bitmap {
         unsigned nbits;
+        unsigned nwords;
+        unsigned nchunks;
         WORD_TYPE *v;
+        uint32_t *full;         /* one bit per chunk; set if chunk full */
 };
 
+/*
+ * Index of the lowest set bit of X, which must not be zero. (We
+ * can't use the compiler builtins for this because they may turn
+ * into libgcc calls, which the kernel doesn't link with.)
+ */
+static
+inline
+unsigned
+lowbit32(uint32_t x)
+{
+        unsigned n = 0;
+
+        KASSERT(x != 0);
+        if ((x & 0xffff) == 0) {
+                n += 16;
+                x >>= 16;
+        }
+        if ((x & 0xff) == 0) {
+                n += 8;
+                x >>= 8;
+        }
+        if ((x & 0xf) == 0) {
+                n += 4;
+                x >>= 4;
+        }
+        if ((x & 0x3) == 0) {
+                n += 2;
+                x >>= 2;
+        }
+        if ((x & 0x1) == 0) {
+                n += 1;
+        }
+        return n;
+}
+
+/* Index of the lowest clear bit in a word that isn't all ones. */
+#define FFZ_WORD(w)     lowbit32((uint32_t)(WORD_TYPE)~(w))
+#define FFZ_SUM(w)      lowbit32(~(uint32_t)(w))
+
+static
+inline
+bool
+chunk_isfull(struct bitmap *b, unsigned chunk)
+{
+        return (b->full[chunk / SUM_BITS] &
+                ((uint32_t)1 << (chunk % SUM_BITS))) != 0;
+}
+
+/*
+ * Recompute the summary bit for CHUNK from the data.
+ */
+static
+void
+chunk_update(struct bitmap *b, unsigned chunk)
+{
+        unsigned ix, maxix;
+        uint32_t mask;
+
+        ix = chunk * CHUNK_WORDS;
+        maxix = ix + CHUNK_WORDS;
+        if (maxix > b->nwords) {
+                maxix = b->nwords;
+        }
+        mask = (uint32_t)1 << (chunk % SUM_BITS);
+
+        for (; ix < maxix; ix++) {
+                if (b->v[ix] != WORD_ALLBITS) {
+                        b->full[chunk / SUM_BITS] &= ~mask;
+                        return;
+                }
+        }
+        b->full[chunk / SUM_BITS] |= mask;
+}
+
+/*
+ * Return the first chunk at or after CHUNK that isn't full, or
+ * b->nchunks if there isn't one.
+ */
+static
+unsigned
+chunk_nextfree(struct bitmap *b, unsigned chunk)
+{
+        unsigned sx, maxsx;
+        uint32_t w;
+
+        if (chunk >= b->nchunks) {
+                return b->nchunks;
+        }
+        maxsx = DIVROUNDUP(b->nchunks, SUM_BITS);
+        sx = chunk / SUM_BITS;
+
+        /* pretend the chunks before CHUNK in the first word are full */
+        w = b->full[sx] | (((uint32_t)1 << (chunk % SUM_BITS)) - 1);
+        while (w == SUM_ALLBITS) {
+                sx++;
+                if (sx >= maxsx) {
+                        return b->nchunks;
+                }
+                w = b->full[sx];
+        }
+        /* the padding bits past nchunks are set, so this is in range */
+        return sx * SUM_BITS + FFZ_SUM(w);
+}
+
+/*
+ * Find the first clear bit in START..END-1 without setting it.
+ */
+static
+int
+bitmap_findzero(struct bitmap *b, unsigned start, unsigned end,
+                unsigned *index)
+{
+        unsigned bit, ix, chunk;
+        WORD_TYPE w;
+
+        KASSERT(start <= end && end <= b->nbits);
+
+        bit = start;
+        while (bit < end) {
+                chunk = bit / CHUNK_BITS;
+                if (chunk_isfull(b, chunk)) {
+                        bit = chunk_nextfree(b, chunk + 1) * CHUNK_BITS;
+                        continue;
+                }
+                ix = bit / BITS_PER_WORD;
+                /* ignore the bits below START in the first word */
+                w = b->v[ix] |
+                        (WORD_TYPE)(((WORD_TYPE)1 << (bit % BITS_PER_WORD)) - 1);
+                if (w != WORD_ALLBITS) {
+                        bit = ix * BITS_PER_WORD + FFZ_WORD(w);
+                        if (bit >= end) {
+                                break;
+                        }
+                        *index = bit;
+                        return 0;
+                }
+                bit = (ix + 1) * BITS_PER_WORD;
+        }
+        return ENOSPC;
+}
+
+/*
+ * Count the clear bits starting at START, stopping at END or after
+ * MAX of them.
+ */
+static
+unsigned
+bitmap_zerorun(struct bitmap *b, unsigned start, unsigned end,
+               unsigned max)
+{
+        unsigned bit;
+
+        for (bit = start; bit < end && bit - start < max; bit++) {
+                if (bitmap_isset(b, bit)) {
+                        break;
+                }
+        }
+        return bit - start;
+}
+
+/*
+ * Find a run of N clear bits that starts in START..END-1 and ends
+ * before LIMIT.
+ */
+static
+int
+bitmap_findrun(struct bitmap *b, unsigned n, unsigned start,
+               unsigned end, unsigned limit, unsigned *index)
+{
+        unsigned bit, len;
+
+        while (start < end) {
+                if (bitmap_findzero(b, start, end, &bit)) {
+                        return ENOSPC;
+                }
+                len = bitmap_zerorun(b, bit, limit, n);
+                if (len == n) {
+                        *index = bit;
+                        return 0;
+                }
+                /* BIT+LEN is set (or past LIMIT); keep looking after it */
+                start = bit + len + 1;
+        }
+        return ENOSPC;
+}
+
+void
+bitmap_rebuild(struct bitmap *b)
+{
+        unsigned chunk, sx, maxsx;
+
+        maxsx = DIVROUNDUP(b->nchunks, SUM_BITS);
+        for (sx = 0; sx < maxsx; sx++) {
+                b->full[sx] = 0;
+        }
+        for (chunk = 0; chunk < b->nchunks; chunk++) {
+                chunk_update(b, chunk);
+        }
+        /* Mark the padding past the last chunk full */
+        for (chunk = b->nchunks; chunk < maxsx * SUM_BITS; chunk++) {
+                b->full[chunk / SUM_BITS] |=
+                        (uint32_t)1 << (chunk % SUM_BITS);
+        }
+}
 
 struct bitmap *
 bitmap_create(unsigned nbits)
@@ -69,9 +289,17 @@ bitmap_create(unsigned nbits)
                 kfree(b);
                 return NULL;
         }
+        b->nchunks = DIVROUNDUP(words, CHUNK_WORDS);
+        b->full = kmalloc(DIVROUNDUP(b->nchunks, SUM_BITS)*sizeof(uint32_t));
+        if (b->full == NULL) {
+                kfree(b->v);
+                kfree(b);
+                return NULL;
+        }
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->nwords = words;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -86,6 +314,7 @@ bitmap_create(unsigned nbits)
                 }
         }
 
+        bitmap_rebuild(b);
         return b;
 }
 
@@ -98,26 +327,67 @@ bitmap_getdata(struct bitmap *b)
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        return bitmap_alloc_range(b, 0, b->nbits, index);
+}
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+int
+bitmap_alloc_range(struct bitmap *b, unsigned start, unsigned end,
+                   unsigned *index)
+{
+        int result;
+
+        result = bitmap_findzero(b, start, end, index);
+        if (result) {
+                return result;
+        }
+        bitmap_mark(b, *index);
+        return 0;
+}
+
+int
+bitmap_alloc_near(struct bitmap *b, unsigned hint, unsigned *index)
+{
+        if (hint >= b->nbits) {
+                hint = 0;
+        }
+        if (bitmap_alloc_range(b, hint, b->nbits, index) == 0) {
+                return 0;
+        }
+        return bitmap_alloc_range(b, 0, hint, index);
+}
+
+int
+bitmap_alloc_run(struct bitmap *b, unsigned n, unsigned hint,
+                 unsigned *start)
+{
+        unsigned i, limit;
+        int result;
+
+        KASSERT(n > 0);
+        if (n > b->nbits) {
+                return ENOSPC;
+        }
+        if (hint >= b->nbits) {
+                hint = 0;
+        }
+
+        result = bitmap_findrun(b, n, hint, b->nbits, b->nbits, start);
+        if (result) {
+                /* Wrap; runs may reach up to where we started. */
+                limit = hint + n - 1;
+                if (limit > b->nbits) {
+                        limit = b->nbits;
+                }
+                result = bitmap_findrun(b, n, 0, hint, limit, start);
+                if (result) {
+                        return result;
                 }
         }
-        return ENOSPC;
+
+        for (i = 0; i < n; i++) {
+                bitmap_mark(b, *start + i);
+        }
+        return 0;
 }
 
 static
@@ -142,6 +412,9 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        if (b->v[ix] == WORD_ALLBITS) {
+                chunk_update(b, ix / CHUNK_WORDS);
+        }
 }
 
 void
@@ -155,6 +428,8 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        b->full[(ix / CHUNK_WORDS) / SUM_BITS] &=
+                ~((uint32_t)1 << ((ix / CHUNK_WORDS) % SUM_BITS));
 }
 
 
@@ -171,6 +446,7 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
+        kfree(b->full);
         kfree(b->v);
         kfree(b);
 }
@@ -52,6 +52,9 @@ static struct lock *kprintf_lock;
 /* Lock for polled kprintfs */
 static struct spinlock kprintf_spinlock;
 
+/* Set when panic() begins */
+volatile bool panicstart = false;
+
 
 /*
  * Warning: all this has to work from interrupt handlers and when
@@ -102,6 +105,11 @@ __kprintf(const char *fmt, va_list ap)
 	int chars;
 	bool dolock;
 
+	if (panicstart) {
+		/* Other cpus may have been stopped holding the locks. */
+		return __vprintf(console_send, NULL, fmt, ap);
+	}
+
 	dolock = kprintf_lock != NULL
 		&& current_thread->t_in_interrupt == false
 		&& current_thread->t_curspl == 0
@@ -167,6 +175,7 @@ panic(const char *fmt, ...)
 
 	if (evil == 0) {
 		evil = 1;
+		panicstart = true;
 
 		/*
 		 * Not only do we not want to be interrupted while
@@ -43,7 +43,6 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 {
 	struct iovec *iov;
 	size_t size;
-	int result;
 
 	if (uio->uio_rw != UIO_READ && uio->uio_rw != UIO_WRITE) {
 		panic("uiomove: Invalid uio_rw %d\n", (int) uio->uio_rw);
@@ -53,6 +52,11 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 	}
 	else {
 		KASSERT(uio->uio_space == proc_getas());
+		if (uio->uio_segflg == UIO_USERSPACE ||
+		    uio->uio_segflg == UIO_USERISPACE) {
+			/* Checked and copied in one go; see copyinout.c */
+			return copyuio(ptr, n, uio);
+		}
 	}
 
 	while (n > 0 && uio->uio_resid > 0) {
@@ -90,19 +94,6 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 			    }
 			    iov->iov_kbase = ((char *)iov->iov_kbase+size);
 			    break;
-		    case UIO_USERSPACE:
-		    case UIO_USERISPACE:
-			    if (uio->uio_rw == UIO_READ) {
-				    result = copyout(ptr, iov->iov_ubase,size);
-			    }
-			    else {
-				    result = copyin(iov->iov_ubase, ptr, size);
-			    }
-			    if (result) {
-				    return result;
-			    }
-			    iov->iov_ubase += size;
-			    break;
 		    default:
 			    panic("uiomove: Invalid uio_segflg %d\n",
 				  (int)uio->uio_segflg);
@@ -121,8 +112,11 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 int
 uiomovezeros(size_t n, struct uio *uio)
 {
-	/* static, so initialized as zero */
-	static char zeros[16];
+	/*
+	 * static, so initialized as zero. Big enough that zero-filling
+	 * a block takes one uiomove, not dozens.
+	 */
+	static char zeros[512];
 	size_t amt;
 	int result;
 
@@ -43,10 +43,12 @@
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <pagecache.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <syscallstats.h>
 #include <test.h>
 #include <kern/test161.h>
 #include <version.h>
@@ -126,8 +128,13 @@ boot(void)
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	pagecache_bootstrap();
 	kprintf_bootstrap();
+	futex_bootstrap();
 	thread_start_cpus();
+#if OPT_SYSCALLSTATS
+	syscallstats_bootstrap();
+#endif
 	test161_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
@@ -38,7 +38,12 @@
 #include <mainbus.h>
 #include <synch.h>
 #include <thread.h>
+#include <cpu.h>
 #include <proc.h>
+#include <prof.h>
+#include <trace.h>
+#include <syscallstats.h>
+#include <vm.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
@@ -48,6 +53,8 @@
 #include "opt-net.h"
 #include "opt-synchprobs.h"
 #include "opt-automationtest.h"
+#include "opt-trace.h"
+#include "opt-syscallstats.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -475,6 +482,146 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+
+/*
+ * Print the kernel's counters one per line as "perf: name value", for
+ * benchmark scripts (see test161/tests/bench) to pick up before and
+ * after a run. Names stay fixed so results from different kernels
+ * can be compared; add new ones at the end.
+ */
+static
+int
+cmd_perf(int nargs, char **args)
+{
+	struct timespec now;
+	struct vm_stats vs;
+	struct tlbshootdown_stats tss;
+
+	(void)nargs;
+	(void)args;
+
+	gettime(&now);
+	vm_getstats(&vs);
+	tlbshootdown_getstats(&tss);
+
+	kprintf("perf: time %llu.%09lu\n",
+		(unsigned long long)now.tv_sec, (unsigned long)now.tv_nsec);
+	kprintf("perf: threads %u\n", thread_count);
+	kprintf("perf: kheap_bytes %lu\n", kheap_getused());
+	kprintf("perf: vm_free_pages %u\n", vs.vs_freepages);
+	kprintf("perf: vm_zero_pages %u\n", vs.vs_zeropages);
+	kprintf("perf: vm_zero_hits %u\n", vs.vs_zerohits);
+	kprintf("perf: vm_zero_misses %u\n", vs.vs_zeromisses);
+	kprintf("perf: vm_zeroed %u\n", vs.vs_zeroed);
+	kprintf("perf: vm_fast_faults %u\n", vs.vs_fastfaults);
+	kprintf("perf: vm_slow_faults %u\n", vs.vs_slowfaults);
+	kprintf("perf: vm_tlb_flushes %u\n", vs.vs_tlbflushes);
+	kprintf("perf: vm_lazy_switches %u\n", vs.vs_lazyswitches);
+	kprintf("perf: shootdown_requests %u\n", tss.tss_requests);
+	kprintf("perf: shootdown_ipis %u\n", tss.tss_ipis);
+	kprintf("perf: shootdown_entries %u\n", tss.tss_entries);
+	kprintf("perf: shootdown_flushes %u\n", tss.tss_flushes);
+
+	return 0;
+}
+
+/*
+ * Command for the sampling profiler.
+ */
+static
+int
+cmd_prof(int nargs, char **args)
+{
+	unsigned nsamples;
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "stop")) {
+		prof_stop();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "dump")) {
+		return prof_dump();
+	}
+	if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "start")) {
+		nsamples = nargs == 3 ? atoi(args[2]) : PROF_DEFSAMPLES;
+		result = prof_start(nsamples);
+		if (result == 0) {
+			kprintf("prof: sampling, %u samples per cpu\n",
+				nsamples);
+		}
+		return result;
+	}
+
+	kprintf("Usage: prof start [samples-per-cpu] | stop | dump\n");
+	return EINVAL;
+}
+
+#if OPT_TRACE
+/*
+ * Command for the kernel tracepoints.
+ */
+static
+int
+cmd_trace(int nargs, char **args)
+{
+	unsigned nrecs;
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "stop")) {
+		trace_stop();
+		return 0;
+	}
+	if (nargs == 3 && !strcmp(args[1], "dump")) {
+		return trace_dump(args[2]);
+	}
+	if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "start")) {
+		nrecs = nargs == 3 ? atoi(args[2]) : TRACE_DEFRECS;
+		result = trace_start(nrecs);
+		if (result == 0) {
+			kprintf("trace: tracing, %u records per cpu\n",
+				nrecs);
+		}
+		return result;
+	}
+
+	kprintf("Usage: trace start [records-per-cpu] | stop | dump file\n");
+	return EINVAL;
+}
+#endif
+
+#if OPT_SYSCALLSTATS
+/*
+ * Command for the syscall counters.
+ */
+static
+int
+cmd_sysstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		syscallstats_print();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscallstats_reset();
+		return 0;
+	}
+
+	kprintf("Usage: sysstats [reset]\n");
+	return EINVAL;
+}
+#endif
+
 static
 int
 cmd_kheapused(int nargs, char **args)
@@ -577,6 +724,8 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[bmb] Bitmap benchmark              ",
+	"[cpb] Copyin/copyout benchmark      ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
@@ -605,6 +754,15 @@ static const char *testmenu[] = {
 	"[rwt3] RW lock test 3        (1?)   ",
 	"[rwt4] RW lock test 4        (1?)   ",
 	"[rwt5] RW lock test 5        (1?)   ",
+	"[tmt1] Timed semaphore test         ",
+	"[tmt2] Timed lock test       (1)    ",
+	"[tmt3] Timed CV test         (1)    ",
+	"[pit1] Priority chain test          ",
+	"[pit2] Priority inversion test      ",
+	"[pit3] Rwlock reader handoff test   ",
+	"[tlbt1] TLB shootdown test          ",
+	"[tlbt2] Heap shrink shootdown test  ",
+	"[fxt1] Futex wakeup order test      ",
 #if OPT_SYNCHPROBS
 	"[sp1] Whalemating test       (1)    ",
 	"[sp2] Stoplight test         (1)    ",
@@ -616,6 +774,8 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[mmt] mmap test                     ",
+	"[rsst] Resident set limit test      ",
 	"[hm1] HMAC unit test                ",
 	NULL
 };
@@ -667,6 +827,15 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[vm] VM page stats                  ",
+	"[perf] Performance counters         ",
+	"[prof] Kernel profiler              ",
+#if OPT_TRACE
+	"[trace] Kernel tracepoints          ",
+#endif
+#if OPT_SYSCALLSTATS
+	"[sysstats] Syscall statistics       ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -722,11 +891,22 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "vm",         cmd_vmstats },
+	{ "perf",       cmd_perf },
+	{ "prof",       cmd_prof },
+#if OPT_TRACE
+	{ "trace",      cmd_trace },
+#endif
+#if OPT_SYSCALLSTATS
+	{ "sysstats",   cmd_sysstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "bmb",	bitmapbench },
+	{ "cpb",	copybench },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
@@ -757,6 +937,15 @@ static struct {
 	{ "rwt3",	rwtest3 },
 	{ "rwt4",	rwtest4 },
 	{ "rwt5",	rwtest5 },
+	{ "tmt1",	timedsemtest },
+	{ "tmt2",	timedlocktest },
+	{ "tmt3",	timedcvtest },
+	{ "pit1",	pritest },
+	{ "pit2",	pritest2 },
+	{ "pit3",	pritest3 },
+	{ "tlbt1",	tlbshoottest },
+	{ "tlbt2",	tlbshoottest2 },
+	{ "fxt1",	futextest },
 #if OPT_SYNCHPROBS
 	{ "sp1",	whalemating },
 	{ "sp2",	stoplight },
@@ -793,6 +982,8 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "mmt",	mmaptest },
+	{ "rsst",	rsstest },
 
 	/* HMAC unit tests */
 	{ "hm1",	hmacu1 },
@@ -43,6 +43,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
@@ -62,6 +63,7 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+	int i;
 
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
@@ -82,6 +84,12 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
+	/* No limits until someone sets them */
+	for (i=0; i<__RLIMIT_NUM; i++) {
+		proc->p_rlimit[i].rlim_cur = RLIM_INFINITY;
+		proc->p_rlimit[i].rlim_max = RLIM_INFINITY;
+	}
+
 	return proc;
 }
 
@@ -207,15 +215,17 @@ proc_create_runprogram(const char *name)
 	/* VFS fields */
 
 	/*
-	 * Lock the current process to copy its current directory.
-	 * (We don't need to lock the new process, though, as we have
-	 * the only reference to it.)
+	 * Lock the current process to copy its current directory and
+	 * its limits. (We don't need to lock the new process, though,
+	 * as we have the only reference to it.)
 	 */
 	spinlock_acquire(&curproc->p_lock);
 	if (curproc->p_cwd != NULL) {
 		VOP_INCREF(curproc->p_cwd);
 		newproc->p_cwd = curproc->p_cwd;
 	}
+	memcpy(newproc->p_rlimit, curproc->p_rlimit,
+	       sizeof(newproc->p_rlimit));
 	spinlock_release(&curproc->p_lock);
 
 	return newproc;
@@ -318,3 +328,39 @@ proc_setas(struct addrspace *newas)
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+/*
+ * Fetch resource limit WHICH of PROC.
+ */
+void
+proc_getrlimit(struct proc *proc, int which, struct rlimit *ret)
+{
+	KASSERT(which >= 0 && which < __RLIMIT_NUM);
+
+	spinlock_acquire(&proc->p_lock);
+	*ret = proc->p_rlimit[which];
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Change resource limit WHICH of PROC. As usual, the soft limit can't
+ * be above the hard one, and the hard one can only be lowered.
+ */
+int
+proc_setrlimit(struct proc *proc, int which, const struct rlimit *rl)
+{
+	KASSERT(which >= 0 && which < __RLIMIT_NUM);
+
+	if (rl->rlim_cur > rl->rlim_max) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	if (rl->rlim_max > proc->p_rlimit[which].rlim_max) {
+		spinlock_release(&proc->p_lock);
+		return EPERM;
+	}
+	proc->p_rlimit[which] = *rl;
+	spinlock_release(&proc->p_lock);
+	return 0;
+}
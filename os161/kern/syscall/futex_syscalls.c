@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futex(): sleep and wake on a word of user memory.
+ *
+ * User-level locks and semaphores do their fast path with atomic
+ * operations on a shared int and only call in here when they actually
+ * have to sleep or have someone to wake. Sleepers are hashed by the
+ * physical address of the word into a fixed table of buckets, each
+ * with its own lock and condition variable.
+ *
+ * The value check in FUTEX_WAIT is done with the bucket lock held,
+ * and FUTEX_WAKE takes the same lock, so a waker that changes the
+ * word and then calls FUTEX_WAKE cannot slip in between a waiter's
+ * check and its going to sleep.
+ *
+ * Each bucket's waiters are kept in the order they went to sleep,
+ * so FUTEX_WAKE wakes the longest sleepers on the word first.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <vm.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_HASHSIZE  64
+
+struct futex_waiter {
+	struct futex_waiter *fw_next;
+	paddr_t fw_paddr;
+	bool fw_woken;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASHSIZE];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_cv = cv_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_cv == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(paddr_t pa)
+{
+	return &futex_table[((pa >> 2) ^ (pa >> 12)) % FUTEX_HASHSIZE];
+}
+
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_waiter *fw)
+{
+	struct futex_waiter **pp;
+
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		if (*pp == fw) {
+			*pp = fw->fw_next;
+			return;
+		}
+	}
+	panic("futex: waiter not on its bucket\n");
+}
+
+/*
+ * Hardclock ticks left until DEADLINE, or 0 if it has passed.
+ */
+static
+unsigned
+futex_ticksleft(const struct timespec *deadline)
+{
+	struct timespec now, left;
+
+	gettime(&now);
+	if (now.tv_sec > deadline->tv_sec ||
+	    (now.tv_sec == deadline->tv_sec &&
+	     now.tv_nsec >= deadline->tv_nsec)) {
+		return 0;
+	}
+	timespec_sub(deadline, &now, &left);
+	return left.tv_sec * HZ +
+		(left.tv_nsec + 1000000000 / HZ - 1) / (1000000000 / HZ);
+}
+
+static
+int
+futex_wait(userptr_t uaddr, paddr_t pa, int val, unsigned timeout_ms)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **pp;
+	struct timespec deadline, delta;
+	unsigned ticks;
+	int cur, result;
+
+	if (timeout_ms > 0) {
+		gettime(&deadline);
+		delta.tv_sec = timeout_ms / 1000;
+		delta.tv_nsec = (timeout_ms % 1000) * 1000000;
+		timespec_add(&deadline, &delta, &deadline);
+	}
+
+	fb = futex_hash(pa);
+	lock_acquire(fb->fb_lock);
+
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	fw.fw_paddr = pa;
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		/* nothing */
+	}
+	*pp = &fw;
+
+	/*
+	 * The cv is shared by the whole bucket, so we may be woken
+	 * for someone else's address; only fw_woken counts. On a
+	 * timeout, a wakeup that beat us to the lock still wins.
+	 */
+	while (!fw.fw_woken) {
+		if (timeout_ms == 0) {
+			cv_wait(fb->fb_cv, fb->fb_lock);
+			continue;
+		}
+		ticks = futex_ticksleft(&deadline);
+		if (ticks == 0 ||
+		    cv_timedwait(fb->fb_cv, fb->fb_lock, ticks) == ETIMEDOUT) {
+			if (!fw.fw_woken) {
+				futex_unlink(fb, &fw);
+				lock_release(fb->fb_lock);
+				return ETIMEDOUT;
+			}
+		}
+	}
+
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+static
+int
+futex_wake(paddr_t pa, int val, int32_t *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **pp, *fw;
+	int n;
+
+	fb = futex_hash(pa);
+	lock_acquire(fb->fb_lock);
+
+	n = 0;
+	pp = &fb->fb_waiters;
+	while (*pp != NULL && n < val) {
+		fw = *pp;
+		if (fw->fw_paddr != pa) {
+			pp = &fw->fw_next;
+			continue;
+		}
+		*pp = fw->fw_next;
+		fw->fw_woken = true;
+		n++;
+	}
+	if (n > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+
+	lock_release(fb->fb_lock);
+	*retval = n;
+	return 0;
+}
+
+int
+sys_futex(userptr_t uaddr, int op, int val, unsigned timeout_ms,
+	  int32_t *retval)
+{
+	paddr_t pa;
+	int result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	result = vm_translate((vaddr_t)uaddr, &pa);
+	if (result) {
+		return result;
+	}
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		return futex_wait(uaddr, pa, val, timeout_ms);
+	    case FUTEX_WAKE:
+		if (val < 0) {
+			return EINVAL;
+		}
+		return futex_wake(pa, val, retval);
+	}
+	return EINVAL;
+}
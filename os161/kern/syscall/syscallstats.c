@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Per-syscall accounting. See syscallstats.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <uio.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <clock.h>
+#include <vfs.h>
+#include <device.h>
+#include <syscallstats.h>
+
+/* One slot per call number, plus one for everything else. */
+#define NSLOTS	(SYSCALLSTATS_NCALLS + 1)
+
+struct callstats {
+	uint32_t cs_calls;
+	uint32_t cs_errors;
+	uint64_t cs_time;		/* microseconds */
+	uint32_t cs_hist[SYSCALLSTATS_NBUCKETS];
+};
+
+/*
+ * NSLOTS callstats for each cpu, cpu 0's first. Each cpu only ever
+ * writes its own, with interrupts off so it can't be preempted (and
+ * maybe moved to another cpu) partway through.
+ */
+static struct callstats *syscallstats;
+static unsigned syscallstats_ncpus;
+
+void
+syscallstats_record(int callno, int err, const struct timespec *start)
+{
+	struct timespec now, diff;
+	struct callstats *cs;
+	uint32_t us;
+	unsigned bucket;
+	int spl;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	if (diff.tv_sec >= 4000) {
+		us = 0xffffffff;
+	}
+	else {
+		us = diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+	}
+	for (bucket = 0;
+	     bucket < SYSCALLSTATS_NBUCKETS - 1 && (us >> bucket) != 0;
+	     bucket++) {
+		/* nothing */
+	}
+	if (callno < 0 || callno >= SYSCALLSTATS_NCALLS) {
+		callno = SYSCALLSTATS_NCALLS;
+	}
+
+	spl = splhigh();
+	cs = &syscallstats[curcpu->c_number * NSLOTS + callno];
+	cs->cs_calls++;
+	if (err) {
+		cs->cs_errors++;
+	}
+	cs->cs_time += us;
+	cs->cs_hist[bucket]++;
+	splx(spl);
+}
+
+void
+syscallstats_reset(void)
+{
+	bzero(syscallstats,
+	      syscallstats_ncpus * NSLOTS * sizeof(struct callstats));
+}
+
+/*
+ * Add up one slot over all the cpus.
+ */
+static
+void
+syscallstats_sum(unsigned slot, struct callstats *ret)
+{
+	struct callstats *cs;
+	unsigned i, j;
+
+	bzero(ret, sizeof(*ret));
+	for (i=0; i<syscallstats_ncpus; i++) {
+		cs = &syscallstats[i * NSLOTS + slot];
+		ret->cs_calls += cs->cs_calls;
+		ret->cs_errors += cs->cs_errors;
+		ret->cs_time += cs->cs_time;
+		for (j=0; j<SYSCALLSTATS_NBUCKETS; j++) {
+			ret->cs_hist[j] += cs->cs_hist[j];
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Reporting
+
+/*
+ * Where the report goes: the console, or a uio reading the device.
+ * For the device the report is generated from the start each time,
+ * and only the part at and after uio_offset is copied out, so it
+ * never needs to be held in memory all at once.
+ */
+struct statsink {
+	struct uio *ss_uio;		/* NULL for the console */
+	off_t ss_pos;			/* report bytes produced so far */
+};
+
+static
+int
+syscallstats_put(struct statsink *ss, const char *str)
+{
+	struct uio *uio = ss->ss_uio;
+	size_t len, skip;
+	int result;
+
+	len = strlen(str);
+	if (uio == NULL) {
+		kprintf("%s", str);
+		return 0;
+	}
+	if (uio->uio_resid > 0 && ss->ss_pos + (off_t)len > uio->uio_offset) {
+		skip = 0;
+		if (uio->uio_offset > ss->ss_pos) {
+			skip = uio->uio_offset - ss->ss_pos;
+		}
+		result = uiomove((char *)str + skip, len - skip, uio);
+		if (result) {
+			return result;
+		}
+	}
+	ss->ss_pos += len;
+	return 0;
+}
+
+static
+int
+syscallstats_putcall(struct statsink *ss, const char *name,
+		     const struct callstats *cs)
+{
+	char buf[80];
+	unsigned i;
+	int result;
+
+	snprintf(buf, sizeof(buf), "%-7s %8u %8u %13llu %10llu\n", name,
+		 cs->cs_calls, cs->cs_errors,
+		 (unsigned long long)cs->cs_time,
+		 (unsigned long long)(cs->cs_time / cs->cs_calls));
+	result = syscallstats_put(ss, buf);
+	if (result) {
+		return result;
+	}
+
+	result = syscallstats_put(ss, "       ");
+	for (i=0; i<SYSCALLSTATS_NBUCKETS && result == 0; i++) {
+		if (cs->cs_hist[i] == 0) {
+			continue;
+		}
+		if (i == SYSCALLSTATS_NBUCKETS - 1) {
+			snprintf(buf, sizeof(buf), " >=%luus:%u",
+				 1UL << (i - 1), cs->cs_hist[i]);
+		}
+		else {
+			snprintf(buf, sizeof(buf), " <%luus:%u",
+				 1UL << i, cs->cs_hist[i]);
+		}
+		result = syscallstats_put(ss, buf);
+	}
+	if (result == 0) {
+		result = syscallstats_put(ss, "\n");
+	}
+	return result;
+}
+
+/*
+ * The report: one line for each call number that has been used, most
+ * total time first, with its histogram underneath, and then the
+ * totals.
+ */
+static
+int
+syscallstats_report(struct statsink *ss)
+{
+	struct callstats cs, all;
+	uint64_t *times;
+	unsigned i, j, best;
+	char name[16];
+	int result;
+
+	times = kmalloc(NSLOTS * sizeof(*times));
+	if (times == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<NSLOTS; i++) {
+		syscallstats_sum(i, &cs);
+		/* Shift so unused slots sort below ones that took 0us. */
+		times[i] = cs.cs_calls == 0 ? 0 : cs.cs_time + 1;
+	}
+
+	result = syscallstats_put(ss, "syscall    calls   errors      "
+				  "total_us    mean_us\n");
+	bzero(&all, sizeof(all));
+	for (i=0; i<NSLOTS && result == 0; i++) {
+		best = 0;
+		for (j=1; j<NSLOTS; j++) {
+			if (times[j] > times[best]) {
+				best = j;
+			}
+		}
+		if (times[best] == 0) {
+			break;
+		}
+		times[best] = 0;
+
+		syscallstats_sum(best, &cs);
+		if (cs.cs_calls == 0) {
+			/* reset while we were at it */
+			continue;
+		}
+		if (best == SYSCALLSTATS_NCALLS) {
+			strcpy(name, "other");
+		}
+		else {
+			snprintf(name, sizeof(name), "%u", best);
+		}
+		result = syscallstats_putcall(ss, name, &cs);
+
+		all.cs_calls += cs.cs_calls;
+		all.cs_errors += cs.cs_errors;
+		all.cs_time += cs.cs_time;
+		for (j=0; j<SYSCALLSTATS_NBUCKETS; j++) {
+			all.cs_hist[j] += cs.cs_hist[j];
+		}
+	}
+	if (result == 0 && all.cs_calls > 0) {
+		result = syscallstats_putcall(ss, "all", &all);
+	}
+
+	kfree(times);
+	return result;
+}
+
+void
+syscallstats_print(void)
+{
+	struct statsink ss;
+
+	ss.ss_uio = NULL;
+	ss.ss_pos = 0;
+	syscallstats_report(&ss);
+}
+
+////////////////////////////////////////////////////////////
+// The syscallstats: device
+
+static
+int
+syscallstats_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+syscallstats_io(struct device *dev, struct uio *uio)
+{
+	struct statsink ss;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EROFS;
+	}
+	ss.ss_uio = uio;
+	ss.ss_pos = 0;
+	return syscallstats_report(&ss);
+}
+
+static
+int
+syscallstats_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static const struct device_ops syscallstats_devops = {
+	.devop_eachopen = syscallstats_eachopen,
+	.devop_io = syscallstats_io,
+	.devop_ioctl = syscallstats_ioctl,
+};
+
+void
+syscallstats_bootstrap(void)
+{
+	struct device *dev;
+	size_t size;
+	int result;
+
+	syscallstats_ncpus = num_cpus;
+	size = syscallstats_ncpus * NSLOTS * sizeof(struct callstats);
+	syscallstats = kmalloc(size);
+	if (syscallstats == NULL) {
+		panic("syscallstats_bootstrap: Out of memory\n");
+	}
+	bzero(syscallstats, size);
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev == NULL) {
+		panic("syscallstats_bootstrap: Out of memory\n");
+	}
+	dev->d_ops = &syscallstats_devops;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+	dev->d_data = NULL;
+
+	result = vfs_adddev("syscallstats", dev, 0);
+	if (result) {
+		panic("Could not add syscallstats device: %s\n",
+		      strerror(result));
+	}
+}
@@ -28,11 +28,20 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
+#define RUNSIZE 7
+
+/* bitmapbench parameters */
+#define BENCHSIZE	(256*1024)	/* bits */
+#define BENCHFULL	90		/* percent allocated during timing */
+#define BENCHOPS	20000
+#define BENCHRUN	8
 
 int
 bitmaptest(int nargs, char **args)
@@ -89,6 +98,16 @@ bitmaptest(int nargs, char **args)
 		}
 	}
 
+	while (bitmap_alloc_range(b, 100, 200, &x)==0) {
+		KASSERT(x >= 100 && x < 200);
+		KASSERT(bitmap_isset(b, x));
+		KASSERT(data[x]==1);
+		data[x] = 0;
+	}
+	for (i=100; i<200; i++) {
+		KASSERT(bitmap_isset(b, i));
+	}
+
 	while (bitmap_alloc(b, &x)==0) {
 		KASSERT(x < TESTSIZE);
 		KASSERT(bitmap_isset(b, x));
@@ -101,6 +120,160 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Now free a scattering of bits and get them back near hints. */
+	for (i=0; i<TESTSIZE; i++) {
+		if (random()%4 == 0) {
+			bitmap_unmark(b, i);
+			data[i] = 1;
+		}
+	}
+	for (i=0; i<TESTSIZE/8; i++) {
+		unsigned hint = random() % TESTSIZE;
+		unsigned expect;
+
+		if (bitmap_alloc_near(b, hint, &x)) {
+			break;
+		}
+		/* must be the first free bit at or after hint, wrapping */
+		expect = hint;
+		while (!data[expect]) {
+			expect = (expect + 1) % TESTSIZE;
+		}
+		KASSERT(x == expect);
+		KASSERT(bitmap_isset(b, x));
+		data[x] = 0;
+	}
+
+	/* Runs: everything handed out must be free and contiguous. */
+	while (bitmap_alloc_run(b, RUNSIZE, random() % TESTSIZE, &x)==0) {
+		KASSERT(x + RUNSIZE <= TESTSIZE);
+		for (i=0; i<RUNSIZE; i++) {
+			KASSERT(data[x+i]==1);
+			KASSERT(bitmap_isset(b, x+i));
+			data[x+i] = 0;
+		}
+	}
+	/* and there must be no run left anywhere */
+	for (i=0; i+RUNSIZE<=TESTSIZE; i++) {
+		unsigned j;
+
+		for (j=0; j<RUNSIZE; j++) {
+			if (!data[i+j]) {
+				break;
+			}
+		}
+		KASSERT(j < RUNSIZE);
+	}
+
+	while (bitmap_alloc_near(b, random() % TESTSIZE, &x)==0) {
+		KASSERT(data[x]==1);
+		data[x] = 0;
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(bitmap_isset(b, i));
+		KASSERT(data[i]==0);
+	}
+
+	/* A rebuild after editing the raw data must see the change. */
+	((unsigned char *)bitmap_getdata(b))[TESTSIZE/16] = 0;
+	bitmap_rebuild(b);
+	KASSERT(bitmap_alloc(b, &x)==0);
+	KASSERT(x == (TESTSIZE/16)*8);
+
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
+
+static
+void
+bench_report(const char *what, unsigned ops, struct timespec *start)
+{
+	struct timespec now, diff;
+	uint64_t usecs;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	usecs = (uint64_t)diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	kprintf("%-12s %6u ops in %lu.%06lu s: %lu ops/sec\n", what, ops,
+		(unsigned long)diff.tv_sec, (unsigned long)diff.tv_nsec / 1000,
+		(unsigned long)((uint64_t)ops * 1000000 / usecs));
+}
+
+/*
+ * Allocation throughput on a large, mostly full bitmap, which is the
+ * case where a flat scan hurts: most of the bits in front of any free
+ * one are in use.
+ */
+int
+bitmapbench(int nargs, char **args)
+{
+	struct bitmap *b;
+	struct timespec start;
+	unsigned i, j, x, nfull;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting bitmap benchmark (%u bits, %u%% full)...\n",
+		BENCHSIZE, BENCHFULL);
+
+	b = bitmap_create(BENCHSIZE);
+	if (b == NULL) {
+		kprintf("bitmapbench: out of memory\n");
+		return ENOMEM;
+	}
+
+	/* Fill it, then free bits at random until only BENCHFULL% used. */
+	for (i=0; i<BENCHSIZE; i++) {
+		bitmap_mark(b, i);
+	}
+	nfull = BENCHSIZE;
+	while (nfull > BENCHSIZE / 100 * BENCHFULL) {
+		x = random() % BENCHSIZE;
+		if (bitmap_isset(b, x)) {
+			bitmap_unmark(b, x);
+			nfull--;
+		}
+	}
+
+	/* Allocate from the front and free at random. */
+	gettime(&start);
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc(b, &x)==0);
+		do {
+			x = random() % BENCHSIZE;
+		} while (!bitmap_isset(b, x));
+		bitmap_unmark(b, x);
+	}
+	bench_report("alloc", BENCHOPS, &start);
+
+	/* Same, but near random hints (as a filesystem would). */
+	gettime(&start);
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc_near(b, random() % BENCHSIZE, &x)==0);
+		bitmap_unmark(b, x);
+	}
+	bench_report("alloc_near", BENCHOPS, &start);
+
+	/* Runs; give each back right away so the fill level stays put. */
+	gettime(&start);
+	for (i=0; i<BENCHOPS; i++) {
+		if (bitmap_alloc_run(b, BENCHRUN, random() % BENCHSIZE,
+				     &x)) {
+			break;
+		}
+		for (j=0; j<BENCHRUN; j++) {
+			bitmap_unmark(b, x+j);
+		}
+	}
+	bench_report("alloc_run", i, &start);
+
+	bitmap_destroy(b);
+	kprintf("Bitmap benchmark complete\n");
+	return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * copyin/copyout benchmark.
+ *
+ * Sets up a small user address space for the current thread, checks
+ * that copyin, copyout, copyin_bulk and uiomove to user memory copy
+ * correctly and fail cleanly on bad addresses, and then times each of
+ * them across a range of transfer sizes. Small sizes show the fixed
+ * cost per call; large ones show the copy loop itself.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <uio.h>
+#include <copyinout.h>
+#include <test.h>
+
+#define BENCHBASE1	TEST_UBASE1	/* user buffer for copyin/copyout */
+#define BENCHBASE2	TEST_UBASE2	/* second buffer for scattered uios */
+#define BENCHMAX	(64*1024)	/* largest transfer */
+#define BENCHTOTAL	(256*1024)	/* bytes moved per measurement */
+#define BENCHIOVS	8		/* iovecs per scattered uio */
+
+static const size_t benchsizes[] = { 1, 4, 16, 64, 256, 1024, 4096, 65536 };
+
+static
+void
+bench_report(const char *what, size_t size, unsigned ops,
+	     struct timespec *start)
+{
+	struct timespec now, diff;
+	uint64_t usecs;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	usecs = (uint64_t)diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	kprintf("%-8s %6lu bytes x %6u: %lu.%06lu s, %lu KB/sec\n", what,
+		(unsigned long)size, ops,
+		(unsigned long)diff.tv_sec, (unsigned long)diff.tv_nsec / 1000,
+		(unsigned long)((uint64_t)size * ops * 1000000 / 1024 / usecs));
+}
+
+/*
+ * The kernel has no memcmp.
+ */
+static
+bool
+samebytes(const char *a, const char *b, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Set up a uio over BENCHIOVS pieces of user memory totalling SIZE
+ * bytes, alternating between the two user buffers.
+ */
+static
+void
+bench_uio(struct iovec *iov, struct uio *u, size_t size, enum uio_rw rw)
+{
+	size_t each, done;
+	unsigned i;
+
+	each = size / BENCHIOVS;
+	done = 0;
+	for (i=0; i<BENCHIOVS; i++) {
+		iov[i].iov_ubase = (userptr_t)((i % 2 ? BENCHBASE2 : BENCHBASE1)
+					       + done);
+		iov[i].iov_len = (i == BENCHIOVS-1) ? size - done : each;
+		done += iov[i].iov_len;
+	}
+	u->uio_iov = iov;
+	u->uio_iovcnt = BENCHIOVS;
+	u->uio_offset = 0;
+	u->uio_resid = size;
+	u->uio_segflg = UIO_USERSPACE;
+	u->uio_rw = rw;
+	u->uio_space = proc_getas();
+}
+
+/*
+ * Correctness checks, at assorted alignments.
+ */
+static
+void
+bench_check(char *kbuf, char *kbuf2)
+{
+	struct iovec iov[BENCHIOVS];
+	struct uio u;
+	unsigned i, off, len;
+	int result;
+
+	for (i=0; i<BENCHMAX; i++) {
+		kbuf[i] = random();
+	}
+	for (off=0; off<8; off++) {
+		for (len=0; len<100; len += 7) {
+			bzero(kbuf2, len + 8);
+			result = copyout(kbuf + off,
+					 (userptr_t)(BENCHBASE1 + 8 - off),
+					 len + 1);
+			KASSERT(result == 0);
+			result = copyin((userptr_t)(BENCHBASE1 + 8 - off),
+					kbuf2 + off, len + 1);
+			KASSERT(result == 0);
+			KASSERT(samebytes(kbuf + off, kbuf2 + off, len + 1));
+		}
+	}
+
+	/* A scattered read must come back in order. */
+	result = copyout(kbuf, (userptr_t)BENCHBASE1, BENCHMAX);
+	KASSERT(result == 0);
+	bench_uio(iov, &u, BENCHMAX / 2, UIO_READ);
+	result = uiomove(kbuf, BENCHMAX / 2, &u);
+	KASSERT(result == 0);
+	KASSERT(u.uio_resid == 0);
+	bench_uio(iov, &u, BENCHMAX / 2, UIO_WRITE);
+	bzero(kbuf2, BENCHMAX);
+	result = uiomove(kbuf2, BENCHMAX / 2, &u);
+	KASSERT(result == 0);
+	KASSERT(samebytes(kbuf, kbuf2, BENCHMAX / 2));
+
+	/* Kernel addresses and overflowing sizes must be refused. */
+	result = copyin((const_userptr_t)kbuf, kbuf2, 4);
+	KASSERT(result == EFAULT);
+	result = copyout(kbuf, (userptr_t)kbuf2, 4);
+	KASSERT(result == EFAULT);
+	result = copyin_bulk((userptr_t)BENCHBASE1, kbuf2,
+			     (size_t)-1 / 4 + 1, 4);
+	KASSERT(result == EFAULT);
+	result = copyin_bulk((userptr_t)BENCHBASE1, kbuf2, 16, 4);
+	KASSERT(result == 0);
+	KASSERT(samebytes(kbuf, kbuf2, 64));
+
+	/*
+	 * A bad iovec anywhere in the uio must fail the transfer before
+	 * anything is copied.
+	 */
+	bzero(kbuf2, BENCHMAX);
+	result = copyout(kbuf2, (userptr_t)BENCHBASE1, BENCHMAX);
+	KASSERT(result == 0);
+	bench_uio(iov, &u, BENCHMAX / 2, UIO_READ);
+	iov[BENCHIOVS-1].iov_ubase = (userptr_t)kbuf2;
+	result = uiomove(kbuf, BENCHMAX / 2, &u);
+	KASSERT(result == EFAULT);
+	KASSERT(u.uio_resid == BENCHMAX / 2);
+	result = copyin((userptr_t)BENCHBASE1, kbuf, BENCHMAX);
+	KASSERT(result == 0);
+	for (i=0; i<BENCHMAX; i++) {
+		KASSERT(kbuf[i] == 0);
+	}
+}
+
+static
+void
+bench_run(char *kbuf)
+{
+	struct iovec iov[BENCHIOVS];
+	struct uio u;
+	struct timespec start;
+	unsigned i, j, ops;
+	size_t size;
+	int result;
+
+	for (i=0; i<sizeof(benchsizes)/sizeof(benchsizes[0]); i++) {
+		size = benchsizes[i];
+		ops = BENCHTOTAL / size;
+
+		gettime(&start);
+		for (j=0; j<ops; j++) {
+			result = copyin((userptr_t)BENCHBASE1, kbuf, size);
+			KASSERT(result == 0);
+		}
+		bench_report("copyin", size, ops, &start);
+
+		gettime(&start);
+		for (j=0; j<ops; j++) {
+			result = copyout(kbuf, (userptr_t)BENCHBASE1, size);
+			KASSERT(result == 0);
+		}
+		bench_report("copyout", size, ops, &start);
+
+		if (size < BENCHIOVS) {
+			continue;
+		}
+		gettime(&start);
+		for (j=0; j<ops; j++) {
+			bench_uio(iov, &u, size, UIO_READ);
+			result = uiomove(kbuf, size, &u);
+			KASSERT(result == 0);
+		}
+		bench_report("uiomove", size, ops, &start);
+	}
+}
+
+int
+copybench(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	char *kbuf, *kbuf2;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting copyin/copyout benchmark...\n");
+
+	kbuf = kmalloc(BENCHMAX);
+	kbuf2 = kmalloc(BENCHMAX);
+	as = test_makeas(BENCHMAX);
+	if (kbuf == NULL || kbuf2 == NULL || as == NULL) {
+		kprintf("copybench: out of memory\n");
+		result = ENOMEM;
+		goto fail;
+	}
+
+	oldas = proc_setas(as);
+	as_activate();
+
+	bench_check(kbuf, kbuf2);
+	bench_run(kbuf);
+
+	proc_setas(oldas);
+	as_activate();
+
+	kprintf("copyin/copyout benchmark complete\n");
+	result = 0;
+
+ fail:
+	if (as != NULL) {
+		as_destroy(as);
+	}
+	kfree(kbuf);
+	kfree(kbuf2);
+	return result;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futex wakeup test.
+ *
+ * Several threads share one user address space and go to sleep on
+ * the same futex word, one after another. Waking them one at a time
+ * must bring them back in the order they went to sleep, each
+ * FUTEX_WAKE must report the one thread it woke, and a wake for more
+ * than are waiting must report only the ones actually there.
+ *
+ * There's no way to see from out here that a thread has got all the
+ * way to sleep, so after starting each one we wait a while (on a
+ * second futex word, which also checks the timeout with other
+ * sleepers in the table) before starting the next.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <vm.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define FX_THREADS	8
+#define FX_SETTLE	50	/* ms to let each new waiter get to sleep */
+
+#define FX_WORD		((userptr_t)TEST_UBASE1)
+#define FX_TIMER	((userptr_t)(TEST_UBASE1 + sizeof(int)))
+
+static struct semaphore *readysem;
+static struct semaphore *donesem;
+static volatile unsigned long fx_woke;
+static volatile int fx_result[FX_THREADS];
+
+static
+void
+fx_waiter(void *junk, unsigned long num)
+{
+	int32_t rv;
+
+	(void)junk;
+
+	V(readysem);
+	fx_result[num] = sys_futex(FX_WORD, FUTEX_WAIT, 0, 0, &rv);
+	fx_woke = num;
+	V(donesem);
+}
+
+int
+futextest(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	bool status = TEST161_SUCCESS;
+	int32_t rv;
+	int zero = 0;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf_n("Starting fxt1...\n");
+
+	readysem = sem_create("readysem", 0);
+	donesem = sem_create("donesem", 0);
+	if (readysem == NULL || donesem == NULL) {
+		panic("fxt1: sem_create failed\n");
+	}
+	as = test_makeas(PAGE_SIZE);
+	if (as == NULL) {
+		panic("fxt1: test_makeas failed\n");
+	}
+	oldas = proc_setas(as);
+	as_activate();
+
+	result = copyout(&zero, FX_WORD, sizeof(zero));
+	KASSERT(result == 0);
+	result = copyout(&zero, FX_TIMER, sizeof(zero));
+	KASSERT(result == 0);
+
+	for (i=0; i<FX_THREADS; i++) {
+		fx_result[i] = -1;
+		result = thread_fork("fxt1", NULL, fx_waiter, NULL, i);
+		if (result) {
+			panic("fxt1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		P(readysem);
+		result = sys_futex(FX_TIMER, FUTEX_WAIT, 0, FX_SETTLE, &rv);
+		if (result != ETIMEDOUT) {
+			kprintf_n("fxt1: timed wait returned %d\n", result);
+			status = TEST161_FAIL;
+		}
+	}
+
+	/* Half of them one at a time, checking the order... */
+	for (i=0; i<FX_THREADS/2; i++) {
+		rv = -1;
+		result = sys_futex(FX_WORD, FUTEX_WAKE, 1, 0, &rv);
+		if (result || rv != 1) {
+			kprintf_n("fxt1: wake %d woke %d (error %d)\n",
+				  i, (int)rv, result);
+			status = TEST161_FAIL;
+			break;
+		}
+		P(donesem);
+		if (fx_woke != (unsigned long)i) {
+			kprintf_n("fxt1: wake %d woke thread %lu\n",
+				  i, fx_woke);
+			status = TEST161_FAIL;
+		}
+		kprintf_t(".");
+	}
+
+	/* ...then the rest at once, asking for more than are there. */
+	rv = -1;
+	result = sys_futex(FX_WORD, FUTEX_WAKE, FX_THREADS, 0, &rv);
+	if (result || rv != FX_THREADS - i) {
+		kprintf_n("fxt1: woke %d of the last %d (error %d)\n",
+			  (int)rv, FX_THREADS - i, result);
+		status = TEST161_FAIL;
+	}
+	for (; i<FX_THREADS; i++) {
+		P(donesem);
+	}
+
+	for (i=0; i<FX_THREADS; i++) {
+		if (fx_result[i] != 0) {
+			kprintf_n("fxt1: thread %d's wait returned %d\n",
+				  i, fx_result[i]);
+			status = TEST161_FAIL;
+		}
+	}
+	result = sys_futex(FX_WORD, FUTEX_WAKE, 1, 0, &rv);
+	if (result || rv != 0) {
+		kprintf_n("fxt1: wake with no waiters woke %d\n", (int)rv);
+		status = TEST161_FAIL;
+	}
+
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+	sem_destroy(readysem);
+	sem_destroy(donesem);
+	readysem = NULL;
+	donesem = NULL;
+
+	kprintf_t("\n");
+	success(status, SECRET, "fxt1");
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <thread.h>
 #include <test.h>
 #include <lib.h>
+#include <addrspace.h>
 
 /*
  * Helper functions used by testing and problem driver code
@@ -26,3 +27,40 @@ random_spinner(uint32_t max_spin_count)
 		spin += i;
 	}
 }
+
+/*
+ * Build a user address space for tests that copy to and from user
+ * memory without running a user program: two LEN-byte regions at
+ * TEST_UBASE1 and TEST_UBASE2 (the two dumbvm insists on) and a
+ * stack. Returns NULL if it can't be set up.
+ */
+struct addrspace *
+test_makeas(size_t len)
+{
+	struct addrspace *as;
+	vaddr_t stackptr;
+	int result;
+
+	as = as_create();
+	if (as == NULL) {
+		return NULL;
+	}
+	result = as_define_region(as, TEST_UBASE1, len, 1, 1, 0);
+	if (!result) {
+		result = as_define_region(as, TEST_UBASE2, len, 1, 1, 0);
+	}
+	if (!result) {
+		result = as_prepare_load(as);
+	}
+	if (!result) {
+		result = as_complete_load(as);
+	}
+	if (!result) {
+		result = as_define_stack(as, &stackptr);
+	}
+	if (result) {
+		as_destroy(as);
+		return NULL;
+	}
+	return as;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mmap test.
+ *
+ * Maps a file into two user address spaces for the current thread,
+ * switching between them, and checks that MAP_SHARED mappings see
+ * each other's stores, that read and write through the vnode stay
+ * coherent with the mappings, that msync and munmap write dirty pages
+ * back (including pages dirtied again after an msync), and that
+ * MAP_PRIVATE mappings copy on write without touching the file.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <uio.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+
+#define MMT_NPAGES	3
+#define MMT_LEN		(MMT_NPAGES * PAGE_SIZE)
+
+static
+char
+mmt_byte(unsigned pos, unsigned gen)
+{
+	return 'a' + (pos * 7 + gen) % 26;
+}
+
+static
+void
+mmt_use(struct addrspace *as)
+{
+	proc_setas(as);
+	as_activate();
+}
+
+static
+int
+mmt_fileio(struct vnode *vn, char *buf, size_t len, off_t pos,
+	   enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, pos, rw);
+	result = rw == UIO_READ ? VOP_READ(vn, &ku) : VOP_WRITE(vn, &ku);
+	if (result == 0 && ku.uio_resid != 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+/*
+ * Read one byte through the current address space.
+ */
+static
+char
+mmt_peek(vaddr_t va)
+{
+	char c;
+	int result;
+
+	result = copyin((const_userptr_t)va, &c, 1);
+	KASSERT(result == 0);
+	return c;
+}
+
+static
+void
+mmt_poke(vaddr_t va, char c)
+{
+	int result;
+
+	result = copyout(&c, (userptr_t)va, 1);
+	KASSERT(result == 0);
+}
+
+static
+char
+mmt_filebyte(struct vnode *vn, off_t pos)
+{
+	char c;
+	int result;
+
+	result = mmt_fileio(vn, &c, 1, pos, UIO_READ);
+	KASSERT(result == 0);
+	return c;
+}
+
+static
+void
+mmt_check(struct vnode *vn, struct addrspace *as1, struct addrspace *as2,
+	  char *kbuf)
+{
+	vaddr_t va1, va2, pva;
+	char y = 'Y';
+	unsigned i;
+	int result;
+
+	/* Fill the file and map it shared in both address spaces. */
+	for (i=0; i<MMT_LEN; i++) {
+		kbuf[i] = mmt_byte(i, 0);
+	}
+	result = mmt_fileio(vn, kbuf, MMT_LEN, 0, UIO_WRITE);
+	KASSERT(result == 0);
+
+	mmt_use(as1);
+	result = as_mmap(as1, vn, 0, MMT_LEN, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, &va1);
+	KASSERT(result == 0);
+	result = copyin((const_userptr_t)va1, kbuf, MMT_LEN);
+	KASSERT(result == 0);
+	for (i=0; i<MMT_LEN; i++) {
+		KASSERT(kbuf[i] == mmt_byte(i, 0));
+	}
+
+	mmt_use(as2);
+	result = as_mmap(as2, vn, PAGE_SIZE, 2 * PAGE_SIZE,
+			 PROT_READ | PROT_WRITE, MAP_SHARED, &va2);
+	KASSERT(result == 0);
+	result = as_mmap(as2, vn, 0, MMT_LEN, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE, &pva);
+	KASSERT(result == 0);
+	KASSERT(mmt_peek(va2) == mmt_byte(PAGE_SIZE, 0));
+
+	/* A store in one space shows up in the other, and in read(). */
+	mmt_use(as1);
+	mmt_poke(va1 + PAGE_SIZE + 100, 'X');
+	mmt_use(as2);
+	KASSERT(mmt_peek(va2 + 100) == 'X');
+	KASSERT(mmt_filebyte(vn, PAGE_SIZE + 100) == 'X');
+
+	/* write() shows up in both mappings. */
+	result = mmt_fileio(vn, &y, 1, PAGE_SIZE + 200, UIO_WRITE);
+	KASSERT(result == 0);
+	KASSERT(mmt_peek(va2 + 200) == 'Y');
+	KASSERT(mmt_peek(va2 + 100) == 'X');
+	mmt_use(as1);
+	KASSERT(mmt_peek(va1 + PAGE_SIZE + 200) == 'Y');
+
+	/* Private stores stay private. */
+	mmt_use(as2);
+	KASSERT(mmt_peek(pva + PAGE_SIZE + 100) == 'X');
+	mmt_poke(pva + PAGE_SIZE + 300, 'P');
+	mmt_poke(pva + 10, 'Q');
+	KASSERT(mmt_peek(pva + PAGE_SIZE + 300) == 'P');
+	KASSERT(mmt_peek(va2 + 300) == mmt_byte(PAGE_SIZE + 300, 0));
+	KASSERT(mmt_filebyte(vn, PAGE_SIZE + 300) ==
+		mmt_byte(PAGE_SIZE + 300, 0));
+	KASSERT(mmt_filebyte(vn, 10) == mmt_byte(10, 0));
+
+	/* Dirty, msync, dirty again: both stores must reach the file. */
+	mmt_use(as1);
+	mmt_poke(va1 + 2 * PAGE_SIZE, 'M');
+	result = as_msync(as1, va1, MMT_LEN, MS_SYNC);
+	KASSERT(result == 0);
+	mmt_poke(va1 + 2 * PAGE_SIZE + 1, 'N');
+	result = as_msync(as1, va1 + PAGE_SIZE, PAGE_SIZE + 1, MS_SYNC);
+	KASSERT(result == 0);
+	result = mmt_fileio(vn, kbuf, 2, 2 * PAGE_SIZE, UIO_READ);
+	KASSERT(result == 0);
+	KASSERT(kbuf[0] == 'M' && kbuf[1] == 'N');
+
+	/* Bad arguments. */
+	result = as_msync(as1, va1 + 1, 1, MS_SYNC);
+	KASSERT(result == EINVAL);
+	result = as_msync(as1, va1, MMT_LEN + PAGE_SIZE, MS_SYNC);
+	KASSERT(result == ENOMEM);
+	result = as_munmap(as1, va1, PAGE_SIZE);
+	KASSERT(result == EINVAL);
+	result = as_mmap(as1, vn, 1, PAGE_SIZE, PROT_READ, MAP_SHARED,
+			 &pva);
+	KASSERT(result == EINVAL);
+	result = as_mmap(as1, NULL, 0, PAGE_SIZE, PROT_READ,
+			 MAP_SHARED | MAP_PRIVATE | MAP_ANON, &pva);
+	KASSERT(result == EINVAL);
+
+	/* The last store, unmapped without msync, still gets written. */
+	mmt_poke(va1 + 5, 'U');
+	result = as_munmap(as1, va1, MMT_LEN);
+	KASSERT(result == 0);
+	result = copyin((const_userptr_t)va1, kbuf, 1);
+	KASSERT(result == EFAULT);
+	KASSERT(mmt_filebyte(vn, 5) == 'U');
+
+	mmt_use(as2);
+	KASSERT(mmt_peek(pva + 10) == 'Q');
+	result = as_munmap(as2, va2, 2 * PAGE_SIZE);
+	KASSERT(result == 0);
+	/* pva copied every page it wrote and never read page 2. */
+	KASSERT(vn->vn_pcpages == 0);
+
+	/* Anonymous memory is zeroed. */
+	result = as_mmap(as2, NULL, 0, MMT_LEN, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANON, &va2);
+	KASSERT(result == 0);
+	result = copyin((const_userptr_t)va2, kbuf, MMT_LEN);
+	KASSERT(result == 0);
+	for (i=0; i<MMT_LEN; i++) {
+		KASSERT(kbuf[i] == 0);
+	}
+}
+
+int
+mmaptest(int nargs, char **args)
+{
+	struct addrspace *as1, *as2, *oldas;
+	struct vnode *vn;
+	char name[64], buf[64];
+	char *kbuf;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: mmt filesystem:\n");
+		return EINVAL;
+	}
+
+	kprintf("Starting mmap test...\n");
+
+	snprintf(name, sizeof(name), "%s%smmaptest.dat", args[1],
+		 strchr(args[1], ':') ? "" : ":");
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(buf, name);
+	result = vfs_open(buf, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		kprintf("Could not open %s: %s\n", name, strerror(result));
+		return result;
+	}
+
+	kbuf = kmalloc(MMT_LEN);
+	as1 = test_makeas(PAGE_SIZE);
+	as2 = test_makeas(PAGE_SIZE);
+	if (kbuf == NULL || as1 == NULL || as2 == NULL) {
+		kprintf("mmaptest: out of memory\n");
+		result = ENOMEM;
+		goto fail;
+	}
+
+	oldas = proc_getas();
+	mmt_check(vn, as1, as2, kbuf);
+	mmt_use(oldas);
+
+	kprintf("mmap test done\n");
+	result = 0;
+
+ fail:
+	if (as1 != NULL) {
+		as_destroy(as1);
+	}
+	if (as2 != NULL) {
+		as_destroy(as2);
+	}
+	KASSERT(vn->vn_pcpages == 0);
+	kfree(kbuf);
+	vfs_close(vn);
+
+	strcpy(buf, name);
+	vfs_remove(buf);
+	return result;
+}
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests for priority inheritance on locks.
+ *
+ * pit1 builds a chain (a high-priority thread waits for a lock held by
+ * a thread that is itself waiting for a lock held by a low-priority
+ * one) and checks that the priority gets all the way down the chain
+ * and back off again as the locks are released.
+ *
+ * pit2 is the classic inversion: a low-priority thread holds a lock a
+ * high-priority thread wants, while medium-priority threads hog the
+ * cpu. It runs once with inheritance turned off and once with it on,
+ * and reports how long the high-priority thread waited each time.
+ * Without inheritance the wait is as long as the hogs run (on one cpu;
+ * with more, other cpus pick up the slack); with it, the wait must be
+ * short.
+ *
+ * pit3 has two readers share an rwlock, the first one in releasing
+ * first and exiting while the other still reads, with a high-priority
+ * writer waiting. No reader may end up with the rwlock's internal
+ * locks on its held list or be lent the writer's priority (nobody
+ * owns a read hold), and the writer must get in only once the last
+ * reader is out.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+#include <kern/test161.h>
+#include <spinlock.h>
+
+#define LOWPRI		(PRI_MIN + 1)
+#define MIDPRI		PRI_DEFAULT
+#define HIGHPRI		(PRI_MAX - 1)
+
+#define NHOGS		4
+#define HOGMSEC		500	/* how long each hog spins */
+#define LOWWORK		200	/* yields the low thread does with the lock */
+#define MAXWAITMSEC	(HOGMSEC / 4)	/* allowed wait with inheritance */
+
+static struct lock *lock1, *lock2;
+static struct semaphore *gatesem;
+static struct semaphore *readysem;
+static struct semaphore *donesem;
+static struct semaphore *napsem;	/* never posted */
+
+static struct spinlock status_lock = SPINLOCK_INITIALIZER;
+static bool test_status = TEST161_FAIL;
+
+static struct thread *volatile lowthread;
+static volatile int lowpeak;		/* highest t_pri the low thread saw */
+
+static
+bool
+failif(bool condition) {
+	if (condition) {
+		spinlock_acquire(&status_lock);
+		test_status = TEST161_FAIL;
+		spinlock_release(&status_lock);
+	}
+	return condition;
+}
+
+static
+void
+setup(const char *name)
+{
+	kprintf_n("Starting %s...\n", name);
+
+	lock1 = lock_create("lock1");
+	lock2 = lock_create("lock2");
+	gatesem = sem_create("gatesem", 0);
+	readysem = sem_create("readysem", 0);
+	donesem = sem_create("donesem", 0);
+	napsem = sem_create("napsem", 0);
+	if (lock1 == NULL || lock2 == NULL || gatesem == NULL ||
+	    readysem == NULL || donesem == NULL || napsem == NULL) {
+		panic("%s: create failed\n", name);
+	}
+
+	test_status = TEST161_SUCCESS;
+	lowthread = NULL;
+	lowpeak = PRI_MIN;
+
+	/* Stay ahead of everything we fork until we go to sleep. */
+	thread_setpriority(PRI_MAX);
+}
+
+static
+void
+cleanup(const char *name)
+{
+	thread_setpriority(PRI_DEFAULT);
+	lock_inheritance = true;
+
+	lock_destroy(lock1);
+	lock_destroy(lock2);
+	sem_destroy(gatesem);
+	sem_destroy(readysem);
+	sem_destroy(donesem);
+	sem_destroy(napsem);
+	lock1 = lock2 = NULL;
+	gatesem = readysem = donesem = napsem = NULL;
+
+	success(test_status, SECRET, name);
+}
+
+static
+void
+fork_at(const char *name, void (*func)(void *, unsigned long), int pri)
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, pri);
+	if (result) {
+		panic("%s: thread_fork failed: %s\n", name, strerror(result));
+	}
+}
+
+static
+unsigned
+msec_since(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+}
+
+////////////////////////////////////////////////////////////
+// pit1: transitive inheritance
+
+static
+void
+chainlow(void *junk, unsigned long pri)
+{
+	(void)junk;
+
+	thread_setpriority(pri);
+	lowthread = current_thread;
+	lock_acquire(lock1);
+	V(readysem);
+	P(gatesem);
+	lock_release(lock1);
+	failif(current_thread->t_pri != (int)pri);
+	V(donesem);
+}
+
+static
+void
+chainmid(void *junk, unsigned long pri)
+{
+	(void)junk;
+
+	thread_setpriority(pri);
+	lock_acquire(lock2);
+	V(readysem);
+	lock_acquire(lock1);
+	lock_release(lock1);
+	lock_release(lock2);
+	failif(current_thread->t_pri != (int)pri);
+	V(donesem);
+}
+
+static
+void
+chainhigh(void *junk, unsigned long pri)
+{
+	(void)junk;
+
+	thread_setpriority(pri);
+	V(readysem);
+	lock_acquire(lock2);
+	lock_release(lock2);
+	V(donesem);
+}
+
+/*
+ * Wait until T's effective priority is PRI, or give up after a second.
+ * We have to actually sleep: we outrank everyone, so yielding wouldn't
+ * let the thread that's about to block get there.
+ */
+static
+bool
+waitpri(struct thread *t, int pri)
+{
+	int i;
+
+	for (i=0; i<HZ && t->t_pri != pri; i++) {
+		P_timed(napsem, 1);
+	}
+	return t->t_pri == pri;
+}
+
+int
+pritest(int nargs, char **args)
+{
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	setup("pit1");
+
+	fork_at("pit1-low", chainlow, LOWPRI);
+	P(readysem);
+	failif(lowthread->t_pri != LOWPRI);
+
+	/* The middle thread waits for lock1 and lends the low one MIDPRI. */
+	fork_at("pit1-mid", chainmid, MIDPRI);
+	P(readysem);
+	failif(!waitpri(lowthread, MIDPRI));
+	kprintf_n("low thread at %d with one waiter\n", lowthread->t_pri);
+
+	/* The high thread waits for lock2; that goes through to lock1. */
+	fork_at("pit1-high", chainhigh, HIGHPRI);
+	P(readysem);
+	failif(!waitpri(lowthread, HIGHPRI));
+	kprintf_n("low thread at %d with a chain\n", lowthread->t_pri);
+
+	/* Let it all unwind; each thread checks it came back down. */
+	V(gatesem);
+	for (i=0; i<3; i++) {
+		P(donesem);
+	}
+	failif(lock1->lk_nwaiters != 0 || lock2->lk_nwaiters != 0);
+
+	cleanup("pit1");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// pit2: inversion with and without inheritance
+
+static volatile unsigned highwait;
+
+static
+void
+invlow(void *junk, unsigned long pri)
+{
+	int i;
+
+	(void)junk;
+
+	thread_setpriority(pri);
+	lock_acquire(lock1);
+	V(readysem);
+	for (i=0; i<LOWWORK; i++) {
+		if (current_thread->t_pri > lowpeak) {
+			lowpeak = current_thread->t_pri;
+		}
+		thread_yield();
+	}
+	lock_release(lock1);
+	V(donesem);
+}
+
+static
+void
+invhog(void *junk, unsigned long pri)
+{
+	struct timespec start;
+
+	(void)junk;
+
+	thread_setpriority(pri);
+	gettime(&start);
+	while (msec_since(&start) < HOGMSEC) {
+		/* spin; hardclock rotates us among the other hogs */
+	}
+	V(donesem);
+}
+
+static
+void
+invhigh(void *junk, unsigned long pri)
+{
+	struct timespec start;
+
+	(void)junk;
+
+	thread_setpriority(pri);
+	gettime(&start);
+	lock_acquire(lock1);
+	highwait = msec_since(&start);
+	lock_release(lock1);
+	V(donesem);
+}
+
+static
+unsigned
+inversion(bool inherit)
+{
+	int i;
+
+	lock_inheritance = inherit;
+	lowpeak = PRI_MIN;
+	highwait = 0;
+
+	fork_at("pit2-low", invlow, LOWPRI);
+	P(readysem);
+
+	/*
+	 * These all start out at our priority and sort themselves out
+	 * once we go to sleep: the high thread blocks on the lock, then
+	 * the hogs get the cpu unless the low thread has been lent
+	 * enough priority to beat them.
+	 */
+	fork_at("pit2-high", invhigh, HIGHPRI);
+	for (i=0; i<NHOGS; i++) {
+		fork_at("pit2-hog", invhog, MIDPRI);
+	}
+	for (i=0; i<NHOGS+2; i++) {
+		P(donesem);
+	}
+
+	kprintf_n("inheritance %s: high thread waited %u ms, "
+		  "low thread peaked at %d\n",
+		  inherit ? "on" : "off", highwait, lowpeak);
+	return highwait;
+}
+
+int
+pritest2(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	setup("pit2");
+
+	inversion(false);
+	failif(lowpeak != LOWPRI);
+
+	failif(inversion(true) > MAXWAITMSEC);
+	failif(lowpeak != HIGHPRI);
+
+	cleanup("pit2");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// pit3: rwlock readers releasing out of order
+
+static struct rwlock *rwlock;
+static struct semaphore *lastsem;
+static volatile bool wrote;
+
+static
+void
+rdthread(void *sem, unsigned long pri)
+{
+	thread_setpriority(pri);
+	rwlock_acquire_read(rwlock);
+	failif(current_thread->t_heldlocks != NULL);
+	V(readysem);
+	P(sem);
+	failif(wrote);
+	failif(current_thread->t_pri != (int)pri);
+	rwlock_release_read(rwlock);
+	failif(current_thread->t_heldlocks != NULL);
+	V(donesem);
+}
+
+static
+void
+wrthread(void *junk, unsigned long pri)
+{
+	(void)junk;
+
+	thread_setpriority(pri);
+	rwlock_acquire_write(rwlock);
+	wrote = true;
+	rwlock_release_write(rwlock);
+	failif(current_thread->t_heldlocks != NULL);
+	V(donesem);
+}
+
+static
+void
+fork_reader(struct semaphore *sem)
+{
+	int result;
+
+	result = thread_fork("pit3-reader", NULL, rdthread, sem, LOWPRI);
+	if (result) {
+		panic("pit3: thread_fork failed: %s\n", strerror(result));
+	}
+	P(readysem);
+}
+
+int
+pritest3(int nargs, char **args)
+{
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	setup("pit3");
+	rwlock = rwlock_create("pit3");
+	lastsem = sem_create("lastsem", 0);
+	if (rwlock == NULL || lastsem == NULL) {
+		panic("pit3: create failed\n");
+	}
+	wrote = false;
+
+	fork_reader(gatesem);
+	fork_reader(lastsem);
+	failif(rwlock->write_lock->owner != NULL);
+
+	/* Wait (up to a second) for the writer to block. */
+	fork_at("pit3-writer", wrthread, HIGHPRI);
+	for (i=0; i<HZ && rwlock->write_lock->lk_nwaiters == 0; i++) {
+		P_timed(napsem, 1);
+	}
+	failif(rwlock->write_lock->lk_nwaiters != 1);
+
+	/* The first reader leaves and exits; give it time to go. */
+	V(gatesem);
+	P(donesem);
+	P_timed(napsem, HZ / 10);
+	failif(wrote);
+	kprintf_n("first reader gone, writer %s\n",
+		  wrote ? "got in early" : "still waiting");
+
+	/* The last reader's release lets the writer in. */
+	V(lastsem);
+	P(donesem);
+	P(donesem);
+	failif(!wrote);
+	failif(rwlock->write_lock->is_locked ||
+	       rwlock->write_lock->lk_nwaiters != 0);
+
+	rwlock_destroy(rwlock);
+	sem_destroy(lastsem);
+	rwlock = NULL;
+	lastsem = NULL;
+
+	cleanup("pit3");
+	return 0;
+}
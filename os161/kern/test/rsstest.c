@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Resident set test.
+ *
+ * Builds a user address space for the current thread and checks that
+ * the resident and virtual sizes and fault counts follow the heap and
+ * mmap regions, that a file mapping larger than RLIMIT_RSS is kept
+ * within it by replacing its own pages (with dirty ones written back
+ * on the way out), and that memory which can't be replaced makes the
+ * fault fail instead of going over.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <uio.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+
+#define RST_HEAPPAGES	4
+#define RST_FILEPAGES	8
+#define RST_ROOM	3		/* file pages allowed in at once */
+
+static
+void
+rst_setlimit(unsigned npages)
+{
+	struct rlimit rl;
+	int result;
+
+	proc_getrlimit(curproc, RLIMIT_RSS, &rl);
+	rl.rlim_cur = npages * (rlim_t)PAGE_SIZE;
+	result = proc_setrlimit(curproc, RLIMIT_RSS, &rl);
+	KASSERT(result == 0);
+}
+
+static
+void
+rst_check(struct addrspace *as, struct vnode *vn)
+{
+	struct as_usage base, au;
+	vaddr_t heap, va, anon;
+	char c;
+	unsigned i;
+	int result;
+
+	as_getusage(as, &base);
+	KASSERT(base.au_resident == base.au_virtual);
+	KASSERT(base.au_swapped == 0);
+
+	/* Heap pages count when touched, not when sbrk'd. */
+	result = as_sbrk(as, RST_HEAPPAGES * PAGE_SIZE, &heap);
+	KASSERT(result == 0);
+	result = copyin((const_userptr_t)heap, &c, 1);
+	KASSERT(result == 0);
+	result = copyin((const_userptr_t)(heap + PAGE_SIZE), &c, 1);
+	KASSERT(result == 0);
+	as_getusage(as, &au);
+	KASSERT(au.au_virtual == base.au_virtual + RST_HEAPPAGES);
+	KASSERT(au.au_resident == base.au_resident + 2);
+	KASSERT(au.au_minflt == base.au_minflt + 2);
+
+	/* Squeeze a file mapping into RST_ROOM pages. */
+	result = as_mmap(as, vn, 0, RST_FILEPAGES * PAGE_SIZE,
+			 PROT_READ | PROT_WRITE, MAP_SHARED, &va);
+	KASSERT(result == 0);
+	rst_setlimit(au.au_resident + RST_ROOM);
+	for (i=0; i<RST_FILEPAGES; i++) {
+		c = 'a' + i;
+		result = copyout(&c, (userptr_t)(va + i * PAGE_SIZE), 1);
+		KASSERT(result == 0);
+		as_getusage(as, &au);
+		KASSERT(au.au_resident <= base.au_resident + 2 + RST_ROOM);
+	}
+	kprintf("rsstest: %u resident (max %u), %u major faults, "
+		"%u evictions\n", au.au_resident, au.au_maxresident,
+		au.au_majflt, au.au_evictions);
+	KASSERT(au.au_maxresident == base.au_resident + 2 + RST_ROOM);
+	KASSERT(au.au_majflt == RST_FILEPAGES);
+	KASSERT(au.au_evictions == RST_FILEPAGES - RST_ROOM);
+
+	/* Every store made it, whether evicted or not. */
+	for (i=0; i<RST_FILEPAGES; i++) {
+		result = copyin((const_userptr_t)(va + i * PAGE_SIZE), &c, 1);
+		KASSERT(result == 0);
+		KASSERT(c == 'a' + (int)i);
+	}
+	as_getusage(as, &au);
+	KASSERT(au.au_resident == base.au_resident + 2 + RST_ROOM);
+
+	/* Anonymous memory can't be given up, so it can't come in. */
+	result = as_munmap(as, va, RST_FILEPAGES * PAGE_SIZE);
+	KASSERT(result == 0);
+	rst_setlimit(base.au_resident + 2);
+	result = as_mmap(as, NULL, 0, PAGE_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANON, &anon);
+	KASSERT(result == 0);
+	result = copyin((const_userptr_t)anon, &c, 1);
+	KASSERT(result == EFAULT);
+	result = copyin((const_userptr_t)(heap + 2 * PAGE_SIZE), &c, 1);
+	KASSERT(result == EFAULT);
+	rst_setlimit(base.au_resident + 3);
+	result = copyin((const_userptr_t)anon, &c, 1);
+	KASSERT(result == 0);
+
+	/* Shrinking the heap gives its pages back. */
+	result = as_sbrk(as, -RST_HEAPPAGES * PAGE_SIZE, &va);
+	KASSERT(result == 0);
+	as_getusage(as, &au);
+	KASSERT(au.au_resident == base.au_resident + 1);
+	KASSERT(au.au_virtual == base.au_virtual + 1);
+}
+
+int
+rsstest(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	struct rlimit saved;
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char name[64], buf[64];
+	char c;
+	unsigned i;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: rsst filesystem:\n");
+		return EINVAL;
+	}
+
+	kprintf("Starting resident set test...\n");
+
+	snprintf(name, sizeof(name), "%s%srsstest.dat", args[1],
+		 strchr(args[1], ':') ? "" : ":");
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(buf, name);
+	result = vfs_open(buf, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		kprintf("Could not open %s: %s\n", name, strerror(result));
+		return result;
+	}
+
+	/* Make the file long enough to map. */
+	c = 0;
+	result = 0;
+	for (i=0; i<RST_FILEPAGES && result == 0; i++) {
+		uio_kinit(&iov, &ku, &c, 1, (i + 1) * PAGE_SIZE - 1,
+			  UIO_WRITE);
+		result = VOP_WRITE(vn, &ku);
+	}
+	if (result) {
+		kprintf("rsstest: write: %s\n", strerror(result));
+		goto fail;
+	}
+
+	as = test_makeas(PAGE_SIZE);
+	if (as == NULL) {
+		kprintf("rsstest: out of memory\n");
+		result = ENOMEM;
+		goto fail;
+	}
+
+	proc_getrlimit(curproc, RLIMIT_RSS, &saved);
+	oldas = proc_setas(as);
+	as_activate();
+
+	rst_check(as, vn);
+
+	proc_setas(oldas);
+	as_activate();
+	result = proc_setrlimit(curproc, RLIMIT_RSS, &saved);
+	KASSERT(result == 0);
+	as_destroy(as);
+
+	kprintf("resident set test done\n");
+	result = 0;
+
+ fail:
+	KASSERT(vn->vn_pcpages == 0);
+	vfs_close(vn);
+
+	strcpy(buf, name);
+	vfs_remove(buf);
+	return result;
+}
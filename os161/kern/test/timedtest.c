@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests for the timed synchronization operations: P_timed,
+ * lock_acquire_timed, and cv_timedwait.
+ *
+ * Each test first checks the simple cases (an expired wait really
+ * returns ETIMEDOUT and leaves nothing behind on the wait channel)
+ * and then runs many threads whose timeouts are short enough that
+ * they keep colliding with real wakeups. On a multiprocessor config
+ * the timeout callbacks fire on whatever cpu each waiter went to
+ * sleep on, so the wakeup-vs-timeout races are exercised across
+ * cpus. At the end every wakeup must be accounted for exactly once.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+#include <kern/test161.h>
+#include <spinlock.h>
+#include <wchan.h>
+
+#define NTHREADS	16
+#define NLOOPS		40
+#define MAXTICKS	3
+
+static struct semaphore *testsem;
+static struct lock *testlock;
+static struct cv *testcv;
+static struct semaphore *donesem;
+
+static struct spinlock status_lock = SPINLOCK_INITIALIZER;
+static bool test_status = TEST161_FAIL;
+
+static volatile unsigned long testval;
+static volatile unsigned got;		/* successful waits */
+static volatile unsigned timedout;	/* expired waits */
+
+static
+bool
+failif(bool condition) {
+	if (condition) {
+		spinlock_acquire(&status_lock);
+		test_status = TEST161_FAIL;
+		spinlock_release(&status_lock);
+	}
+	return condition;
+}
+
+static
+void
+count(int result)
+{
+	failif(result != 0 && result != ETIMEDOUT);
+
+	spinlock_acquire(&status_lock);
+	if (result == 0) {
+		got++;
+	}
+	else {
+		timedout++;
+	}
+	spinlock_release(&status_lock);
+}
+
+static
+unsigned
+randticks(void)
+{
+	return 1 + random() % MAXTICKS;
+}
+
+static
+void
+setup(const char *name)
+{
+	kprintf_n("Starting %s...\n", name);
+
+	testsem = sem_create("testsem", 0);
+	testlock = lock_create("testlock");
+	testcv = cv_create("testcv");
+	donesem = sem_create("donesem", 0);
+	if (testsem == NULL || testlock == NULL || testcv == NULL ||
+	    donesem == NULL) {
+		panic("%s: create failed\n", name);
+	}
+
+	test_status = TEST161_SUCCESS;
+	testval = 0;
+	got = timedout = 0;
+}
+
+static
+void
+cleanup(const char *name)
+{
+	sem_destroy(testsem);
+	lock_destroy(testlock);
+	cv_destroy(testcv);
+	sem_destroy(donesem);
+	testsem = NULL;
+	testlock = NULL;
+	testcv = NULL;
+	donesem = NULL;
+
+	kprintf_t("\n");
+	success(test_status, SECRET, name);
+}
+
+static
+void
+forkall(const char *name, void (*func)(void *, unsigned long))
+{
+	int i, result;
+
+	for (i=0; i<NTHREADS; i++) {
+		kprintf_t(".");
+		result = thread_fork(name, NULL, func, NULL, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n",
+			      name, strerror(result));
+		}
+	}
+}
+
+static
+void
+waitall(void)
+{
+	int i;
+
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// tmt1: P_timed
+
+static
+void
+semtimedthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NLOOPS; i++) {
+		kprintf_t(".");
+		count(P_timed(testsem, randticks()));
+	}
+	V(donesem);
+}
+
+int
+timedsemtest(int nargs, char **args)
+{
+	unsigned posted;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	setup("tmt1");
+
+	/* Zero ticks never sleeps. */
+	failif(P_timed(testsem, 0) != ETIMEDOUT);
+	V(testsem);
+	failif(P_timed(testsem, 0) != 0);
+
+	/* An expired wait leaves the channel empty. */
+	failif(P_timed(testsem, 2) != ETIMEDOUT);
+	spinlock_acquire(&testsem->sem_lock);
+	failif(!wchan_isempty(testsem->sem_wchan, &testsem->sem_lock));
+	spinlock_release(&testsem->sem_lock);
+
+	/* Now race V against the waiters' timeouts. */
+	forkall("tmt1", semtimedthread);
+	posted = 0;
+	for (i=0; i<NTHREADS*NLOOPS/2; i++) {
+		V(testsem);
+		posted++;
+		random_yielder(4);
+	}
+	waitall();
+
+	/*
+	 * Every V must have been consumed by exactly one successful
+	 * P_timed or still be in the count; and every wait either
+	 * succeeded or timed out.
+	 */
+	kprintf_n("%u waits, %u timeouts, %u left over\n",
+		  got, timedout, testsem->sem_count);
+	failif(got + testsem->sem_count != posted);
+	failif(got + timedout != NTHREADS*NLOOPS);
+
+	spinlock_acquire(&testsem->sem_lock);
+	failif(!wchan_isempty(testsem->sem_wchan, &testsem->sem_lock));
+	spinlock_release(&testsem->sem_lock);
+
+	while (testsem->sem_count > 0) {
+		P(testsem);
+	}
+	cleanup("tmt1");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// tmt2: lock_acquire_timed
+
+static
+void
+locktimedthread(void *junk, unsigned long num)
+{
+	int i, result;
+
+	(void)junk;
+
+	for (i=0; i<NLOOPS; i++) {
+		kprintf_t(".");
+		result = lock_acquire_timed(testlock, randticks());
+		count(result);
+		if (result) {
+			failif(lock_do_i_hold(testlock));
+			continue;
+		}
+		testval = num;
+		random_yielder(8);
+		failif(testval != num);
+		failif(!lock_do_i_hold(testlock));
+		lock_release(testlock);
+	}
+	V(donesem);
+}
+
+int
+timedlocktest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	setup("tmt2");
+
+	/* Uncontended: succeeds without sleeping. */
+	failif(lock_acquire_timed(testlock, 0) != 0);
+	failif(!lock_do_i_hold(testlock));
+	lock_release(testlock);
+
+	forkall("tmt2", locktimedthread);
+
+	/* Hold the lock long enough that some waiters must give up. */
+	lock_acquire(testlock);
+	clocksleep(1);
+	lock_release(testlock);
+
+	waitall();
+
+	kprintf_n("%u acquires, %u timeouts\n", got, timedout);
+	failif(got + timedout != NTHREADS*NLOOPS);
+	failif(timedout == 0);
+	failif(testlock->is_locked);
+
+	spinlock_acquire(&testlock->spinlock);
+	failif(!wchan_isempty(testlock->wait_channel, &testlock->spinlock));
+	spinlock_release(&testlock->spinlock);
+
+	cleanup("tmt2");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// tmt3: cv_timedwait
+
+static volatile unsigned tokens;
+
+static
+void
+cvtimedthread(void *junk, unsigned long num)
+{
+	int i, result;
+
+	(void)junk;
+	(void)num;
+
+	lock_acquire(testlock);
+	for (i=0; i<NLOOPS; i++) {
+		kprintf_t(".");
+		while (tokens == 0) {
+			result = cv_timedwait(testcv, testlock, randticks());
+			failif(!lock_do_i_hold(testlock));
+			if (result) {
+				break;
+			}
+		}
+		if (tokens > 0) {
+			tokens--;
+			count(0);
+		}
+		else {
+			count(ETIMEDOUT);
+		}
+	}
+	lock_release(testlock);
+	V(donesem);
+}
+
+int
+timedcvtest(int nargs, char **args)
+{
+	unsigned posted;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	setup("tmt3");
+	tokens = 0;
+
+	/* Nobody will signal this. */
+	lock_acquire(testlock);
+	failif(cv_timedwait(testcv, testlock, 2) != ETIMEDOUT);
+	failif(!lock_do_i_hold(testlock));
+	lock_release(testlock);
+
+	forkall("tmt3", cvtimedthread);
+	posted = 0;
+	for (i=0; i<NTHREADS*NLOOPS/2; i++) {
+		lock_acquire(testlock);
+		tokens++;
+		posted++;
+		cv_signal(testcv, testlock);
+		lock_release(testlock);
+		random_yielder(4);
+	}
+	waitall();
+
+	kprintf_n("%u waits, %u timeouts, %u left over\n",
+		  got, timedout, tokens);
+	failif(got + tokens != posted);
+	failif(got + timedout != NTHREADS*NLOOPS);
+
+	spinlock_acquire(&testcv->spinlock);
+	failif(!wchan_isempty(testcv->wait_channel, &testcv->spinlock));
+	spinlock_release(&testcv->spinlock);
+
+	cleanup("tmt3");
+	return 0;
+}
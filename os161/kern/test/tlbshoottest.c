@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * TLB shootdown test.
+ *
+ * Many threads at once push synchronous shootdowns of assorted sizes
+ * at every cpu. Each ipi_tlbshootdown_sync must come back (that is,
+ * every request gets done even when the queues overflow and requests
+ * pile up behind an IPI already in flight), every request must be
+ * accounted for, and the batching should mean fewer IPIs than
+ * requests.
+ *
+ * No user process is running, so the TLBs have nothing in them worth
+ * keeping; the invalidations are harmless.
+ *
+ * tlbt2 shares one user address space among several threads, which
+ * keep reading its heap pages while the first thread shrinks the heap
+ * and grows it back. Each page holds a stamp naming it; a thread that
+ * reads a stamp for another page (or a free-list link) was using a
+ * translation for memory that had already been handed back.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <vm.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <kern/errno.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define NTHREADS	16
+#define NREQUESTS	200
+
+#define T2_THREADS	8
+#define T2_PAGES	48	/* more than one batch of as_sbrk's */
+#define T2_ROUNDS	40
+
+static struct semaphore *donesem;
+
+static
+void
+shootthread(void *junk, unsigned long num)
+{
+	struct tlbshootdown ts;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NREQUESTS; i++) {
+		ts.ts_vaddr = (num * 0x100000) + (random() % 256) * PAGE_SIZE;
+		/* mostly small ranges, sometimes more than half the TLB */
+		ts.ts_npages = (i % 8 == 0) ? 1 + random() % 128 :
+			1 + random() % 4;
+		ipi_tlbshootdown_sync(NULL, &ts);
+		if (i % 20 == 0) {
+			kprintf_t(".");
+		}
+	}
+	V(donesem);
+}
+
+int
+tlbshoottest(int nargs, char **args)
+{
+	struct tlbshootdown_stats before, after;
+	unsigned requests, ipis;
+	bool status = TEST161_SUCCESS;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf_n("Starting tlbt1...\n");
+
+	donesem = sem_create("donesem", 0);
+	if (donesem == NULL) {
+		panic("tlbt1: sem_create failed\n");
+	}
+
+	tlbshootdown_getstats(&before);
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("tlbt1", NULL, shootthread, NULL, i);
+		if (result) {
+			panic("tlbt1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	tlbshootdown_getstats(&after);
+	requests = after.tss_requests - before.tss_requests;
+	ipis = after.tss_ipis - before.tss_ipis;
+
+	kprintf_n("\n%u requests to other cpus, %u IPIs, %u entries, "
+		  "%u full flushes\n", requests, ipis,
+		  after.tss_entries - before.tss_entries,
+		  after.tss_flushes - before.tss_flushes);
+
+	if (requests != NTHREADS * NREQUESTS * (num_cpus - 1)) {
+		kprintf_n("tlbt1: expected %u requests\n",
+			  NTHREADS * NREQUESTS * (num_cpus - 1));
+		status = TEST161_FAIL;
+	}
+	if (ipis > requests) {
+		status = TEST161_FAIL;
+	}
+
+	sem_destroy(donesem);
+	donesem = NULL;
+
+	kprintf_t("\n");
+	success(status, SECRET, "tlbt1");
+	return 0;
+}
+
+static vaddr_t t2_heap;
+static volatile unsigned t2_round;
+static volatile bool t2_growing;
+static volatile bool t2_done;
+static volatile unsigned t2_reads[T2_THREADS];
+static volatile unsigned t2_bad[T2_THREADS];
+
+static
+void
+t2_reader(void *junk, unsigned long num)
+{
+	uint32_t stamp;
+	unsigned k;
+	int result;
+
+	(void)junk;
+
+	while (!t2_done) {
+		for (k=0; k<T2_PAGES; k++) {
+			/* dumbvm doesn't lock; don't fill pages alongside */
+			if (t2_growing) {
+				continue;
+			}
+			result = copyin((const_userptr_t)
+					(t2_heap + k * PAGE_SIZE),
+					&stamp, sizeof(stamp));
+			if (result == 0) {
+				/* Stamps go in just before t2_round moves. */
+				if (stamp / T2_PAGES > t2_round + 1 ||
+				    (stamp != 0 && stamp % T2_PAGES != k)) {
+					t2_bad[num]++;
+				}
+			}
+			else if (result != EFAULT) {
+				t2_bad[num]++;
+			}
+			t2_reads[num]++;
+		}
+	}
+	V(donesem);
+}
+
+static
+unsigned
+t2_totalreads(void)
+{
+	unsigned i, total;
+
+	total = 0;
+	for (i=0; i<T2_THREADS; i++) {
+		total += t2_reads[i];
+	}
+	return total;
+}
+
+/*
+ * Put round R's stamps in the heap, filling it as it goes.
+ */
+static
+void
+t2_stamp(unsigned r)
+{
+	uint32_t stamp;
+	unsigned k;
+	int result;
+
+	for (k=0; k<T2_PAGES; k++) {
+		stamp = r * T2_PAGES + k;
+		result = copyout(&stamp, (userptr_t)(t2_heap + k * PAGE_SIZE),
+				 sizeof(stamp));
+		KASSERT(result == 0);
+	}
+}
+
+int
+tlbshoottest2(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	bool status = TEST161_SUCCESS;
+	unsigned r, start, bad;
+	vaddr_t junk;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf_n("Starting tlbt2...\n");
+
+	donesem = sem_create("donesem", 0);
+	if (donesem == NULL) {
+		panic("tlbt2: sem_create failed\n");
+	}
+	as = test_makeas(PAGE_SIZE);
+	if (as == NULL) {
+		panic("tlbt2: test_makeas failed\n");
+	}
+	oldas = proc_setas(as);
+	as_activate();
+
+	/* Grow once up front; the page table never has to move after. */
+	result = as_sbrk(as, T2_PAGES * PAGE_SIZE, &t2_heap);
+	KASSERT(result == 0);
+	t2_stamp(1);
+	t2_round = 1;
+	t2_growing = false;
+	t2_done = false;
+	for (i=0; i<T2_THREADS; i++) {
+		t2_reads[i] = 0;
+		t2_bad[i] = 0;
+		result = thread_fork("tlbt2", NULL, t2_reader, NULL, i);
+		if (result) {
+			panic("tlbt2: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (r=1; r<=T2_ROUNDS; r++) {
+		/* Let the readers pull the pages into their TLBs. */
+		start = t2_totalreads();
+		while (t2_totalreads() - start < T2_THREADS * T2_PAGES) {
+			thread_yield();
+		}
+
+		/* Take the heap away from under them. */
+		result = as_sbrk(as, -T2_PAGES * PAGE_SIZE, &junk);
+		KASSERT(result == 0);
+
+		if (r < T2_ROUNDS) {
+			t2_growing = true;
+			result = as_sbrk(as, T2_PAGES * PAGE_SIZE, &junk);
+			KASSERT(result == 0);
+			t2_stamp(r + 1);
+			t2_round = r + 1;
+			t2_growing = false;
+		}
+		if (r % 4 == 0) {
+			kprintf_t(".");
+		}
+	}
+
+	t2_done = true;
+	for (i=0; i<T2_THREADS; i++) {
+		P(donesem);
+	}
+
+	bad = 0;
+	for (i=0; i<T2_THREADS; i++) {
+		bad += t2_bad[i];
+	}
+	kprintf_n("\n%u reads, %u of freed memory\n", t2_totalreads(), bad);
+	if (bad != 0) {
+		status = TEST161_FAIL;
+	}
+
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+	sem_destroy(donesem);
+	donesem = NULL;
+
+	kprintf_t("\n");
+	success(status, SECRET, "tlbt2");
+	return 0;
+}
@@ -85,6 +85,40 @@ timerclock(void)
 	spinlock_release(&lbolt_lock);
 }
 
+/*
+ * Run the callbacks of any of this cpu's timeouts that have expired.
+ *
+ * The callback is called without the timeout lock held, so it can
+ * take whatever spinlocks it needs (e.g. a wchan's lock, which is
+ * held while arming, so it comes before the timeout lock). While it
+ * runs, c_timeout_running points at it so timeout_cancel can wait.
+ */
+static
+void
+timeout_run(void)
+{
+	struct timeout *to;
+	unsigned now;
+
+	now = curcpu->c_hardclocks;
+
+	spinlock_acquire(&curcpu->c_timeout_lock);
+	while ((to = curcpu->c_timeouts) != NULL &&
+	       (int)(now - to->to_expires) >= 0) {
+		curcpu->c_timeouts = to->to_next;
+		to->to_next = NULL;
+		to->to_pending = false;
+		curcpu->c_timeout_running = to;
+		spinlock_release(&curcpu->c_timeout_lock);
+
+		to->to_func(to->to_arg);
+
+		spinlock_acquire(&curcpu->c_timeout_lock);
+		curcpu->c_timeout_running = NULL;
+	}
+	spinlock_release(&curcpu->c_timeout_lock);
+}
+
 /*
  * This is called HZ times a second (on each processor) by the timer
  * code.
@@ -93,10 +127,12 @@ void
 hardclock(void)
 {
 	/*
-	 * Collect statistics here as desired.
+	 * Collect statistics here as desired. (The profiler samples
+	 * from the timer interrupt just before this; see prof.h.)
 	 */
 
 	curcpu->c_hardclocks++;
+	timeout_run();
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
@@ -119,3 +155,91 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Timeouts.
+ */
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_next = NULL;
+	to->to_cpu = NULL;
+	to->to_expires = 0;
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_pending = false;
+}
+
+/*
+ * Queue TO on the current cpu, keeping the list sorted so hardclock
+ * only ever has to look at the head.
+ */
+void
+timeout_arm(struct timeout *to, unsigned ticks)
+{
+	struct cpu *c;
+	struct timeout **p;
+
+	KASSERT(to->to_func != NULL);
+	KASSERT(!to->to_pending);
+
+	c = curcpu->c_self;
+
+	spinlock_acquire(&c->c_timeout_lock);
+	to->to_cpu = c;
+	to->to_expires = c->c_hardclocks + ticks;
+	for (p = &c->c_timeouts; *p != NULL; p = &(*p)->to_next) {
+		if ((int)((*p)->to_expires - to->to_expires) > 0) {
+			break;
+		}
+	}
+	to->to_next = *p;
+	*p = to;
+	to->to_pending = true;
+	spinlock_release(&c->c_timeout_lock);
+}
+
+/*
+ * Dequeue TO. If it has already been taken off the list but its
+ * callback is still running on its cpu, spin until that finishes, so
+ * the caller may reuse or free TO as soon as we return.
+ */
+unsigned
+timeout_cancel(struct timeout *to)
+{
+	struct cpu *c;
+	struct timeout **p;
+	unsigned left;
+
+	c = to->to_cpu;
+	if (c == NULL) {
+		/* never armed */
+		return 0;
+	}
+
+	left = 0;
+	spinlock_acquire(&c->c_timeout_lock);
+	if (to->to_pending) {
+		for (p = &c->c_timeouts; *p != to; p = &(*p)->to_next) {
+			KASSERT(*p != NULL);
+		}
+		*p = to->to_next;
+		to->to_next = NULL;
+		to->to_pending = false;
+		if ((int)(to->to_expires - c->c_hardclocks) > 0) {
+			left = to->to_expires - c->c_hardclocks;
+		}
+		else {
+			/* due, but hardclock hasn't gotten to it yet */
+			left = 1;
+		}
+	}
+	while (c->c_timeout_running == to) {
+		spinlock_release(&c->c_timeout_lock);
+		spinlock_acquire(&c->c_timeout_lock);
+	}
+	spinlock_release(&c->c_timeout_lock);
+
+	return left;
+}
@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Sampling profiler. See prof.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <prof.h>
+
+#define PROF_NAMELEN	16	/* thread/process name bytes kept */
+#define PROF_MAXNAMES	64	/* distinct names prof_dump reports */
+
+struct profsample {
+	vaddr_t ps_pc;
+	vaddr_t ps_caller;
+	bool ps_user;
+	char ps_thread[PROF_NAMELEN];
+	char ps_proc[PROF_NAMELEN];
+};
+
+/*
+ * One cpu's ring. pr_next counts every sample ever taken, so the
+ * newest is at (pr_next - 1) % pr_size. pr_busy is set while the
+ * owning cpu is inside prof_sample, for prof_stop to wait on.
+ */
+struct profring {
+	struct profsample *pr_samples;
+	unsigned pr_size;
+	unsigned pr_next;
+	volatile bool pr_busy;
+};
+
+/*
+ * The rings, one per cpu, indexed by c_number. They are kept from one
+ * run to the next and only reallocated to get bigger, since dumbvm
+ * can't give kernel pages back.
+ *
+ * Everything here is changed only by prof_start/stop/dump, which are
+ * called from the menu and serialized by prof_lock, and by each cpu
+ * in prof_sample on its own ring.
+ */
+static struct profring *prof_rings;
+static unsigned prof_nrings;
+static unsigned prof_ringsize;
+static volatile bool prof_running;
+static struct spinlock prof_lock = SPINLOCK_INITIALIZER;
+static bool prof_inuse;		/* start/stop/dump in progress */
+
+static
+bool
+prof_enter(void)
+{
+	bool ok;
+
+	spinlock_acquire(&prof_lock);
+	ok = !prof_inuse;
+	prof_inuse = true;
+	spinlock_release(&prof_lock);
+	return ok;
+}
+
+static
+void
+prof_leave(void)
+{
+	spinlock_acquire(&prof_lock);
+	prof_inuse = false;
+	spinlock_release(&prof_lock);
+}
+
+int
+prof_start(unsigned nsamples)
+{
+	struct profring *rings;
+	unsigned i;
+	int result;
+
+	if (nsamples == 0 || nsamples > PROF_MAXSAMPLES) {
+		return EINVAL;
+	}
+	if (!prof_enter()) {
+		return EBUSY;
+	}
+	if (prof_running) {
+		result = EBUSY;
+		goto out;
+	}
+
+	if (prof_rings == NULL || nsamples > prof_ringsize) {
+		rings = kmalloc(num_cpus * sizeof(*rings));
+		if (rings == NULL) {
+			result = ENOMEM;
+			goto out;
+		}
+		for (i=0; i<num_cpus; i++) {
+			rings[i].pr_samples =
+				kmalloc(nsamples * sizeof(struct profsample));
+			if (rings[i].pr_samples == NULL) {
+				while (i-- > 0) {
+					kfree(rings[i].pr_samples);
+				}
+				kfree(rings);
+				result = ENOMEM;
+				goto out;
+			}
+		}
+		if (prof_rings != NULL) {
+			for (i=0; i<prof_nrings; i++) {
+				kfree(prof_rings[i].pr_samples);
+			}
+			kfree(prof_rings);
+		}
+		prof_rings = rings;
+		prof_nrings = num_cpus;
+		prof_ringsize = nsamples;
+	}
+
+	for (i=0; i<prof_nrings; i++) {
+		prof_rings[i].pr_size = nsamples;
+		prof_rings[i].pr_next = 0;
+		prof_rings[i].pr_busy = false;
+	}
+
+	/* Rings first, then the flag that lets cpus at them. */
+	membar_store_store();
+	prof_running = true;
+	result = 0;
+
+ out:
+	prof_leave();
+	return result;
+}
+
+void
+prof_stop(void)
+{
+	unsigned i;
+
+	if (!prof_enter()) {
+		return;
+	}
+
+	prof_running = false;
+
+	/*
+	 * A cpu that got past the check in prof_sample set pr_busy
+	 * first, and one that sets it from now on will see
+	 * prof_running false, so once the flags are clear nobody is
+	 * touching the rings.
+	 */
+	membar_any_any();
+	for (i=0; i<prof_nrings; i++) {
+		while (prof_rings[i].pr_busy) {
+			membar_load_load();
+		}
+	}
+
+	prof_leave();
+}
+
+/*
+ * Copy a thread or process name, cutting it short if need be.
+ */
+static
+void
+prof_copyname(char *dest, const char *src)
+{
+	unsigned i;
+
+	for (i=0; i<PROF_NAMELEN - 1 && src[i] != 0; i++) {
+		dest[i] = src[i];
+	}
+	dest[i] = 0;
+}
+
+/*
+ * Called with interrupts off, from the timer interrupt.
+ */
+void
+prof_sample(vaddr_t pc, vaddr_t caller, bool user)
+{
+	struct profring *pr;
+	struct profsample *ps;
+	struct proc *proc;
+
+	if (!prof_running) {
+		return;
+	}
+
+	pr = &prof_rings[curcpu->c_number];
+	pr->pr_busy = true;
+	membar_any_any();
+	if (!prof_running) {
+		pr->pr_busy = false;
+		return;
+	}
+
+	ps = &pr->pr_samples[pr->pr_next % pr->pr_size];
+	pr->pr_next++;
+
+	ps->ps_pc = pc;
+	ps->ps_caller = caller;
+	ps->ps_user = user;
+	prof_copyname(ps->ps_thread, current_thread->t_name);
+	proc = current_thread->t_proc;
+	prof_copyname(ps->ps_proc, proc != NULL ? proc->p_name : "");
+
+	membar_store_store();
+	pr->pr_busy = false;
+}
+
+////////////////////////////////////////////////////////////
+// Dumping
+
+/*
+ * Counts keyed by address, in an open-addressed hash table whose size
+ * is a power of two at least twice the number of samples, so it
+ * never fills up.
+ */
+struct profcount {
+	vaddr_t pc_addr;
+	unsigned pc_count;
+};
+
+static
+void
+prof_countaddr(struct profcount *table, unsigned mask, vaddr_t addr)
+{
+	unsigned i;
+
+	i = (addr >> 2) & mask;
+	while (table[i].pc_count != 0 && table[i].pc_addr != addr) {
+		i = (i + 1) & mask;
+	}
+	table[i].pc_addr = addr;
+	table[i].pc_count++;
+}
+
+static
+void
+prof_printaddrs(const char *what, struct profcount *table, unsigned size)
+{
+	unsigned i;
+
+	for (i=0; i<size; i++) {
+		if (table[i].pc_count != 0) {
+			kprintf("prof: %s 0x%08lx %u\n", what,
+				(unsigned long)table[i].pc_addr,
+				table[i].pc_count);
+		}
+	}
+}
+
+/*
+ * Counts keyed by name; there are few enough threads that a list
+ * will do. Past PROF_MAXNAMES they're lumped together.
+ */
+struct profname {
+	char pn_name[PROF_NAMELEN];
+	unsigned pn_count;
+};
+
+static
+void
+prof_countname(struct profname *names, unsigned *nnames,
+	       unsigned *others, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<*nnames; i++) {
+		if (!strcmp(names[i].pn_name, name)) {
+			names[i].pn_count++;
+			return;
+		}
+	}
+	if (*nnames == PROF_MAXNAMES) {
+		(*others)++;
+		return;
+	}
+	strcpy(names[i].pn_name, name);
+	names[i].pn_count = 1;
+	(*nnames)++;
+}
+
+static
+void
+prof_printnames(const char *what, struct profname *names, unsigned nnames,
+		unsigned others)
+{
+	unsigned i;
+
+	for (i=0; i<nnames; i++) {
+		kprintf("prof: %s %s %u\n", what,
+			names[i].pn_name[0] ? names[i].pn_name : "-",
+			names[i].pn_count);
+	}
+	if (others > 0) {
+		kprintf("prof: %s (others) %u\n", what, others);
+	}
+}
+
+int
+prof_dump(void)
+{
+	struct profcount *pcs, *sites;
+	struct profname *threads, *procs;
+	unsigned nthreads, nprocs, otherthreads, otherprocs;
+	unsigned i, j, kept, total, lost, user, size;
+	struct profring *pr;
+	struct profsample *ps;
+	int result;
+
+	if (!prof_enter()) {
+		return EBUSY;
+	}
+	if (prof_running) {
+		prof_leave();
+		return EBUSY;
+	}
+
+	total = lost = user = 0;
+	for (i=0; i<prof_nrings; i++) {
+		pr = &prof_rings[i];
+		kept = pr->pr_next < pr->pr_size ? pr->pr_next : pr->pr_size;
+		total += kept;
+		lost += pr->pr_next - kept;
+	}
+
+	size = 1;
+	while (size < 2 * total) {
+		size *= 2;
+	}
+	pcs = kmalloc(size * sizeof(*pcs));
+	sites = kmalloc(size * sizeof(*sites));
+	threads = kmalloc(PROF_MAXNAMES * sizeof(*threads));
+	procs = kmalloc(PROF_MAXNAMES * sizeof(*procs));
+	if (pcs == NULL || sites == NULL || threads == NULL || procs == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	bzero(pcs, size * sizeof(*pcs));
+	bzero(sites, size * sizeof(*sites));
+	nthreads = nprocs = otherthreads = otherprocs = 0;
+
+	for (i=0; i<prof_nrings; i++) {
+		pr = &prof_rings[i];
+		kept = pr->pr_next < pr->pr_size ? pr->pr_next : pr->pr_size;
+		for (j=0; j<kept; j++) {
+			ps = &pr->pr_samples[j];
+			if (ps->ps_user) {
+				user++;
+			}
+			else {
+				prof_countaddr(pcs, size - 1, ps->ps_pc);
+				prof_countaddr(sites, size - 1,
+					       ps->ps_caller);
+			}
+			prof_countname(threads, &nthreads, &otherthreads,
+				       ps->ps_thread);
+			prof_countname(procs, &nprocs, &otherprocs,
+				       ps->ps_proc);
+		}
+	}
+
+	kprintf("prof: samples %u kernel %u user %u lost %u\n",
+		total, total - user, user, lost);
+	prof_printaddrs("pc", pcs, size);
+	prof_printaddrs("site", sites, size);
+	prof_printnames("thread", threads, nthreads, otherthreads);
+	prof_printnames("proc", procs, nprocs, otherprocs);
+	result = 0;
+
+ out:
+	kfree(pcs);
+	kfree(sites);
+	kfree(threads);
+	kfree(procs);
+	prof_leave();
+	return result;
+}
@@ -30,9 +30,11 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
+#include <atomic.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -33,12 +33,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <trace.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -118,6 +121,30 @@ P(struct semaphore *sem) {
 	spinlock_release(&sem->sem_lock);
 }
 
+// Try to get a semaphore, but not for more than TICKS hardclocks
+int
+P_timed(struct semaphore *sem, unsigned ticks) {
+	KASSERT(sem != NULL);
+	KASSERT(current_thread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0) {
+		/*
+		 * If we're woken but someone else gets the count
+		 * first, go back to sleep for whatever time is left.
+		 */
+		ticks = wchan_sleep_timed(sem->sem_wchan, &sem->sem_lock, ticks);
+		if (ticks == 0 && sem->sem_count == 0) {
+			spinlock_release(&sem->sem_lock);
+			return ETIMEDOUT;
+		}
+	}
+	KASSERT(sem->sem_count > 0);
+	sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+	return 0;
+}
+
 // Release a sempahore
 void
 V(struct semaphore *sem) {
@@ -143,9 +170,215 @@ V(struct semaphore *sem) {
 		- hangman lockable
 */
 
+/*
+ * Priority inheritance state (t_pri and t_blockedon of every thread,
+ * lk_waitpri/lk_nwaiters of every lock, and the owner of any lock
+ * that has waiters) is protected by lock_pi_lock. It comes after the
+ * per-lock spinlocks in the lock order. Uncontended acquires and
+ * releases don't take it.
+ */
+static struct spinlock lock_pi_lock = SPINLOCK_INITIALIZER;
+
+bool lock_inheritance = true;
+
+/*
+ * Highest effective priority among LOCK's waiters, or -1 if none.
+ */
+static
+int
+lock_toppri(struct lock *lock)
+{
+	int pri;
+
+	KASSERT(spinlock_do_i_hold(&lock_pi_lock));
+
+	if (lock->lk_nwaiters == 0 || !lock_inheritance) {
+		return -1;
+	}
+	for (pri = PRI_MAX; pri >= PRI_MIN; pri--) {
+		if (lock->lk_waitpri[pri] > 0) {
+			return pri;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Push LOCK's top waiter priority to its owner, and on through
+ * whatever lock the owner is waiting for, until it stops making a
+ * difference.
+ */
+static
+void
+lock_donate(struct lock *lock)
+{
+	struct thread *t;
+	int pri;
+
+	KASSERT(spinlock_do_i_hold(&lock_pi_lock));
+
+	while (lock != NULL) {
+		t = lock->owner;
+		pri = lock_toppri(lock);
+		if (t == NULL || pri <= t->t_pri) {
+			break;
+		}
+		lock = t->t_blockedon;
+		if (lock != NULL) {
+			lock->lk_waitpri[t->t_pri]--;
+			lock->lk_waitpri[pri]++;
+		}
+		t->t_pri = pri;
+	}
+}
+
+/*
+ * Effective priority of the current thread: its own, or the best
+ * waiter on any lock it holds.
+ */
+static
+int
+lock_computepri(void)
+{
+	struct lock *lk;
+	int pri, top;
+
+	KASSERT(spinlock_do_i_hold(&lock_pi_lock));
+
+	pri = current_thread->t_basepri;
+	for (lk = current_thread->t_heldlocks; lk != NULL;
+	     lk = lk->lk_nextheld) {
+		top = lock_toppri(lk);
+		if (top > pri) {
+			pri = top;
+		}
+	}
+	return pri;
+}
+
+void
+lock_inherit_update(void)
+{
+	spinlock_acquire(&lock_pi_lock);
+	current_thread->t_pri = lock_computepri();
+	spinlock_release(&lock_pi_lock);
+}
+
+/*
+ * Register the current thread as waiting for LOCK and lend it our
+ * priority. Call with the lock's spinlock held.
+ */
+static
+void
+lock_wait_begin(struct lock *lock)
+{
+	spinlock_acquire(&lock_pi_lock);
+	current_thread->t_blockedon = lock;
+	lock->lk_nwaiters++;
+	lock->lk_waitpri[current_thread->t_pri]++;
+	lock_donate(lock);
+	spinlock_release(&lock_pi_lock);
+}
+
+static
+void
+lock_wait_end(struct lock *lock)
+{
+	spinlock_acquire(&lock_pi_lock);
+	KASSERT(current_thread->t_blockedon == lock);
+	KASSERT(lock->lk_waitpri[current_thread->t_pri] > 0);
+	lock->lk_waitpri[current_thread->t_pri]--;
+	lock->lk_nwaiters--;
+	current_thread->t_blockedon = NULL;
+	spinlock_release(&lock_pi_lock);
+}
+
+/*
+ * Take ownership of LOCK, which must be free. If others are still
+ * waiting for it, we inherit from them straight away.
+ */
+static
+void
+lock_take(struct lock *lock)
+{
+	int pri;
+
+	KASSERT(!lock->is_locked);
+
+	lock->is_locked = true;
+	if (lock->lk_nwaiters > 0) {
+		spinlock_acquire(&lock_pi_lock);
+		lock->owner = current_thread;
+		pri = lock_toppri(lock);
+		if (pri > current_thread->t_pri) {
+			current_thread->t_pri = pri;
+		}
+		spinlock_release(&lock_pi_lock);
+	}
+	else {
+		lock->owner = current_thread;
+	}
+	lock->lk_nextheld = current_thread->t_heldlocks;
+	current_thread->t_heldlocks = lock;
+}
+
+/*
+ * Stop owning LOCK, which we hold, without unlocking it: take it off
+ * our held list and give back anything its waiters lent us. Returns
+ * true if our effective priority went down.
+ */
+static
+bool
+lock_disown(struct lock *lock)
+{
+	struct lock **pp;
+	int oldpri;
+	bool lowered = false;
+
+	KASSERT(lock->owner == current_thread);
+
+	for (pp = &current_thread->t_heldlocks; *pp != lock;
+	     pp = &(*pp)->lk_nextheld) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+
+	if (lock->lk_nwaiters > 0 ||
+	    current_thread->t_pri != current_thread->t_basepri) {
+		spinlock_acquire(&lock_pi_lock);
+		lock->owner = NULL;
+		oldpri = current_thread->t_pri;
+		current_thread->t_pri = lock_computepri();
+		lowered = current_thread->t_pri < oldpri;
+		spinlock_release(&lock_pi_lock);
+	}
+	else {
+		lock->owner = NULL;
+	}
+	return lowered;
+}
+
+/*
+ * Give up LOCK, which we own, and wake a waiter. Returns true if our
+ * effective priority went down.
+ */
+static
+bool
+lock_drop(struct lock *lock)
+{
+	bool lowered;
+
+	lowered = lock_disown(lock);
+	lock->is_locked = false;
+	wchan_wakeone(lock->wait_channel, &lock->spinlock);
+	return lowered;
+}
+
 struct lock *
 lock_create(const char *name) {
 	struct lock *lock;
+	int i;
 
 	lock = kmalloc(sizeof(*lock));
 
@@ -168,6 +401,13 @@ lock_create(const char *name) {
 
 	spinlock_init(&lock->spinlock);
 	lock->is_locked = false;
+	lock->owner = NULL;
+
+	lock->lk_nextheld = NULL;
+	lock->lk_nwaiters = 0;
+	for (i=0; i<NPRI; i++) {
+		lock->lk_waitpri[i] = 0;
+	}
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
@@ -181,12 +421,11 @@ lock_destroy(struct lock *lock) {
 	if (lock->is_locked) {
 		panic("#### Trying to destroy a lock that is still locked.");
 	}
+	KASSERT(lock->lk_nwaiters == 0);
 
 	spinlock_cleanup(&lock->spinlock);
 	wchan_destroy(lock->wait_channel);
 
-	kfree(lock->owner);
-
 	kfree(lock->lk_name);
 	kfree(lock);
 }
@@ -203,60 +442,145 @@ lock_acquire(struct lock *lock) {
 		panic("#### Trying to re-aquire lock.");
 	}
 
-	while (lock->is_locked) {
-		wchan_sleep(lock->wait_channel, &lock->spinlock);
+	if (lock->is_locked) {
+		TRACE(TRACE_LOCKWAIT, lock, 0);
+		lock_wait_begin(lock);
+		while (lock->is_locked) {
+			wchan_sleep(lock->wait_channel, &lock->spinlock);
+		}
+		lock_wait_end(lock);
+		TRACE(TRACE_LOCKGOT, lock, 1);
 	}
-
-	lock->is_locked = true;
-	lock->owner = current_thread;
+	else {
+		TRACE(TRACE_LOCKGOT, lock, 0);
+	}
+	lock_take(lock);
 
 	spinlock_release(&lock->spinlock);
 
-	// P(lock->semaphore);
-	// lock->owner = current_thread;
-	// (void)lock;  // suppress warning until code gets written
-
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&current_thread->t_hangman, &lock->lk_hangman);
 }
 
+int
+lock_acquire_timed(struct lock *lock, unsigned ticks) {
+
+	HANGMAN_WAIT(&current_thread->t_hangman, &lock->lk_hangman);
+
+	spinlock_acquire(&lock->spinlock);
+
+	if (lock->owner == current_thread) {
+		panic("#### Trying to re-aquire lock.");
+	}
+
+	if (lock->is_locked) {
+		lock_wait_begin(lock);
+		while (lock->is_locked) {
+			ticks = wchan_sleep_timed(lock->wait_channel,
+						  &lock->spinlock, ticks);
+			if (ticks == 0 && lock->is_locked) {
+				lock_wait_end(lock);
+				spinlock_release(&lock->spinlock);
+				HANGMAN_GIVEUP(&current_thread->t_hangman,
+					       &lock->lk_hangman);
+				return ETIMEDOUT;
+			}
+		}
+		lock_wait_end(lock);
+	}
+	lock_take(lock);
+
+	spinlock_release(&lock->spinlock);
+
+	HANGMAN_ACQUIRE(&current_thread->t_hangman, &lock->lk_hangman);
+	return 0;
+}
+
 void
 lock_release(struct lock *lock) {
+	bool lowered;
+
 	spinlock_acquire(&lock->spinlock);
 
 	if (lock->owner != current_thread) {
 		panic("#### Owner is trying to release thread it doesn't own.");
 	}
 	
-	lock->is_locked = false;
-	wchan_wakeone(lock->wait_channel, &lock->spinlock);
-	lock->owner = NULL;
+	lowered = lock_drop(lock);
 	spinlock_release(&lock->spinlock);
 
 
 	/* Call this (atomically) when the lock is released */
 	HANGMAN_RELEASE(&current_thread->t_hangman, &lock->lk_hangman);
-	// (void)lock;  // suppress warning until code gets written
+
+	/*
+	 * If we were running on borrowed priority, let the lender go.
+	 * (Not if we're inside a spinlock: cv_wait releases the lock
+	 * that way, and it's about to sleep anyway.)
+	 */
+	if (lowered && curcpu->c_spinlocks == 0) {
+		thread_yield();
+	}
 }
 
+/*
+ * Release a lock that is either ours or has been handed over with
+ * lock_handoff, and so has no owner; any thread may release the
+ * latter. Nobody's held-lock list but our own is touched.
+ */
 void
 fancy_lock_release(struct lock *lock) {
+	bool owned, lowered = false;
+
 	spinlock_acquire(&lock->spinlock);
 
-	lock->is_locked = false;
-	wchan_wakeone(lock->wait_channel, &lock->spinlock);
-	lock->owner = NULL;
+	KASSERT(lock->is_locked);
+	owned = lock->owner == current_thread;
+	if (owned) {
+		lowered = lock_drop(lock);
+	}
+	else {
+		KASSERT(lock->owner == NULL);
+		lock->is_locked = false;
+		wchan_wakeone(lock->wait_channel, &lock->spinlock);
+	}
 	spinlock_release(&lock->spinlock);
 
 
 	/* Call this (atomically) when the lock is released */
+	if (owned) {
+		HANGMAN_RELEASE(&current_thread->t_hangman,
+				&lock->lk_hangman);
+	}
+
+	if (lowered && curcpu->c_spinlocks == 0) {
+		thread_yield();
+	}
+}
+
+/*
+ * Keep LOCK locked but stop owning it, so that whichever thread is
+ * done with it last can fancy_lock_release it. Waiters can't lend
+ * priority to an unowned lock.
+ */
+void
+lock_handoff(struct lock *lock) {
+	bool lowered;
+
+	spinlock_acquire(&lock->spinlock);
+	lowered = lock_disown(lock);
+	spinlock_release(&lock->spinlock);
+
+	/* As far as deadlock detection goes, we no longer hold it. */
 	HANGMAN_RELEASE(&current_thread->t_hangman, &lock->lk_hangman);
-	// (void)lock;  // suppress warning until code gets written
+
+	if (lowered && curcpu->c_spinlocks == 0) {
+		thread_yield();
+	}
 }
 
 bool
 lock_do_i_hold(struct lock *lock) {
-	// (void)lock;  // suppress warning until code gets written
 	return lock->owner == current_thread;
 }
 
@@ -331,6 +655,23 @@ cv_wait(struct cv *cv, struct lock *lock) {
 	// (void)lock;  // suppress warning until code gets written
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks) {
+	unsigned left;
+
+	if (!lock->is_locked) {
+		panic("You think you can waltz in here without holding the lock?! Get outta here!");
+	}
+
+	spinlock_acquire(&cv->spinlock);
+	lock_release(lock);
+	left = wchan_sleep_timed(cv->wait_channel, &cv->spinlock, ticks);
+	spinlock_release(&cv->spinlock);
+
+	lock_acquire(lock);
+	return left == 0 ? ETIMEDOUT : 0;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock) {
 	if (!lock->is_locked) {
@@ -405,7 +746,9 @@ void rwlock_acquire_read(struct rwlock * rwlock) {
 	rwlock->counter += 1;
 
 	if (rwlock->counter == 1) {
+		/* Held for all the readers; the last one out releases it. */
 		lock_acquire(rwlock->write_lock);
+		lock_handoff(rwlock->write_lock);
 	}
 
 	fancy_lock_release(rwlock->count_lock);
@@ -50,6 +50,11 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <atomic.h>
+#include <membar.h>
+#include <trace.h>
+#include <platform/maxcpus.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -144,14 +149,24 @@ thread_create(const char *name)
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
+	thread->t_wchan = NULL;
+	thread->t_wakenext = NULL;
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
+	/* Priority fields */
+	thread->t_basepri = PRI_DEFAULT;
+	thread->t_pri = PRI_DEFAULT;
+	thread->t_blockedon = NULL;
+	thread->t_heldlocks = NULL;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	thread->t_fsio = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -185,12 +200,25 @@ cpu_create(unsigned hardware_number)
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
 
+	c->c_timeouts = NULL;
+	c->c_timeout_running = NULL;
+	spinlock_init(&c->c_timeout_lock);
+
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_wakeups = NULL;
+
+	c->c_curas = NULL;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_all = false;
+	c->c_shootdown_queued = 0;
+	c->c_shootdown_done = 0;
+	c->c_shootdown_ipis = 0;
+	c->c_shootdown_entries = 0;
+	c->c_shootdown_flushes = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -333,6 +361,7 @@ thread_panic(void)
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
 	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	curcpu->c_wakeups = NULL;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -455,10 +484,84 @@ thread_start_cpus(void)
 	thread_count = 1;
 }
 
+/*
+ * Hand a thread to another cpu without touching its run queue lock:
+ * push it on the cpu's c_wakeups list, which the cpu drains into its
+ * run queue the next time it goes through thread_switch.
+ *
+ * Only the push that finds the list empty considers sending an
+ * IPI; anyone else pushing before the cpu drains the list rides on
+ * that one, so waking N threads on one cpu costs at most one
+ * interrupt.
+ *
+ * The push is a full barrier, so the load of c_isidle below can't
+ * be satisfied before it. thread_switch sets c_isidle and then
+ * checks c_wakeups with a barrier in between, so either it sees our
+ * thread or we see it idle.
+ *
+ * The target's state is set to S_READY by the receiving cpu when it
+ * drains the list; the target might not even be off its cpu yet.
+ */
+static
+void
+thread_push_wakeup(struct thread *target, struct cpu *targetcpu)
+{
+	struct thread *head;
+
+	do {
+		head = targetcpu->c_wakeups;
+		target->t_wakenext = head;
+	} while (atomic_cas_ptr((void *volatile *)&targetcpu->c_wakeups,
+				head, target) != head);
+
+	if (head == NULL && targetcpu->c_isidle) {
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+}
+
+/*
+ * Move threads that other cpus have woken for us onto our run queue.
+ * The list was built by pushing on the front, so reverse it to run
+ * them in the order they were woken.
+ *
+ * Must hold our run queue lock.
+ */
+static
+void
+thread_drain_wakeups(void)
+{
+	struct thread *list, *rev, *t;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_wakeups == NULL) {
+		return;
+	}
+	list = atomic_swap_ptr((void *volatile *)&curcpu->c_wakeups, NULL);
+
+	rev = NULL;
+	while (list != NULL) {
+		t = list;
+		list = t->t_wakenext;
+		t->t_wakenext = rev;
+		rev = t;
+	}
+
+	while (rev != NULL) {
+		t = rev;
+		rev = t->t_wakenext;
+		t->t_wakenext = NULL;
+		KASSERT(t->t_cpu == curcpu->c_self);
+		t->t_state = S_READY;
+		threadlist_addtail(&curcpu->c_runqueue, t);
+	}
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * targetcpu might be curcpu; it might not be, too. If it isn't, the
+ * thread goes on the other cpu's lock-free wakeup list.
  */
 static
 void
@@ -473,6 +576,10 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
+	else if (targetcpu != curcpu->c_self) {
+		thread_push_wakeup(target, targetcpu);
+		return;
+	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
@@ -533,6 +640,10 @@ thread_fork(const char *name,
 	/* Thread subsystem fields */
 	newthread->t_cpu = current_thread->t_cpu;
 
+	/* Inherit the parent's own priority, but not any it's borrowing */
+	newthread->t_basepri = current_thread->t_basepri;
+	newthread->t_pri = current_thread->t_basepri;
+
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
 		proc = current_thread->t_proc;
@@ -565,6 +676,46 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Take the highest-priority thread off TL, or return NULL if TL is
+ * empty. Among equals the one nearest the head wins, so threads of
+ * the same priority still run (and wake) in FIFO order.
+ */
+static
+struct thread *
+thread_rembest(struct threadlist *tl)
+{
+	struct thread *t, *best;
+
+	best = NULL;
+	THREADLIST_FORALL(t, *tl) {
+		if (best == NULL || t->t_pri > best->t_pri) {
+			best = t;
+		}
+	}
+	if (best != NULL) {
+		threadlist_remove(tl, best);
+	}
+	return best;
+}
+
+/*
+ * Check if anything on TL is at least as urgent as PRI.
+ */
+static
+bool
+thread_anyready(struct threadlist *tl, int pri)
+{
+	struct thread *t;
+
+	THREADLIST_FORALL(t, *tl) {
+		if (t->t_pri >= pri) {
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -605,8 +756,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/* Pick up threads other cpus woke for us. */
+	thread_drain_wakeups();
+
+	/*
+	 * If we're only yielding and nothing ready is as urgent as we
+	 * are, keep running.
+	 */
+	if (newstate == S_READY &&
+	    !thread_anyready(&curcpu->c_runqueue, cur->t_pri)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -621,6 +779,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_wchan = wc;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -652,14 +811,22 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
-	 * idle. However, because one is supposed to hold the runqueue
-	 * lock to look at it, this should not be visible or matter.
+	 * idle. Other cpus peek at it without the runqueue lock when
+	 * pushing wakeups (see thread_push_wakeup); at worst that
+	 * costs them an unneeded IPI.
+	 *
+	 * The barrier after setting c_isidle pairs with the one in
+	 * thread_push_wakeup: a wakeup pushed after we last drain
+	 * c_wakeups is guaranteed to see c_isidle and send an IPI,
+	 * which gets us out of cpu_idle.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	membar_any_any();
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		thread_drain_wakeups();
+		next = thread_rembest(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
@@ -668,6 +835,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	TRACE(TRACE_SWITCH, next, newstate);
+
 	/*
 	 * Note that curcpu->c_current_thread may be the same variable as
 	 * current_thread and it may not be, depending on how current_thread and
@@ -842,13 +1011,36 @@ thread_yield(void)
 	thread_switch(S_READY, NULL, NULL);
 }
 
+int
+thread_getpriority(void)
+{
+	return current_thread->t_basepri;
+}
+
+void
+thread_setpriority(int pri)
+{
+	int oldpri;
+
+	KASSERT(pri >= PRI_MIN && pri <= PRI_MAX);
+
+	oldpri = current_thread->t_pri;
+	current_thread->t_basepri = pri;
+	lock_inherit_update();
+	if (current_thread->t_pri < oldpri) {
+		thread_yield();
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Scheduler.
  *
  * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * the current CPU's run queue by job priority. (Strict priorities
+ * are already handled when picking the next thread in thread_switch;
+ * this is the place for anything that adjusts them over time.)
  */
 
 void
@@ -1041,10 +1233,97 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	/* must not hold other spinlocks */
 	KASSERT(curcpu->c_spinlocks == 1);
 
+	TRACE(TRACE_SLEEP, wc, 0);
 	thread_switch(S_SLEEP, wc, lk);
 	spinlock_acquire(lk);
 }
 
+/*
+ * State shared between a thread in wchan_sleep_timed and the timeout
+ * callback that may pull it back off the wait channel. Lives on the
+ * sleeping thread's stack.
+ */
+struct wchan_timedsleep {
+	struct thread *ts_thread;
+	struct wchan *ts_wc;
+	struct spinlock *ts_lk;
+	bool ts_timedout;
+};
+
+/*
+ * Timeout callback for wchan_sleep_timed. Runs from hardclock.
+ *
+ * If a wakeup got there first the thread is no longer on the channel
+ * (t_wchan was cleared under the same spinlock) and there's nothing
+ * to do.
+ */
+static
+void
+wchan_timedout(void *data)
+{
+	struct wchan_timedsleep *ts = data;
+	struct thread *target = ts->ts_thread;
+
+	spinlock_acquire(ts->ts_lk);
+	if (target->t_wchan == ts->ts_wc) {
+		threadlist_remove(&ts->ts_wc->wc_threads, target);
+		target->t_wchan = NULL;
+		ts->ts_timedout = true;
+		thread_make_runnable(target, false);
+	}
+	spinlock_release(ts->ts_lk);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks. Returns the
+ * number of ticks that were left when we were woken, which is always
+ * nonzero, or 0 if we timed out instead.
+ *
+ * The timeout is armed while LK is still held, which also blocks
+ * hardclock on this cpu, so it cannot fire before we're on the
+ * channel. It is cancelled before LK is reacquired, since the
+ * callback needs LK and timeout_cancel may have to wait for it.
+ */
+unsigned
+wchan_sleep_timed(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timedsleep ts;
+	struct timeout to;
+	unsigned left;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!current_thread->t_in_interrupt);
+
+	/* must hold the spinlock */
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/* must not hold other spinlocks */
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	if (ticks == 0) {
+		return 0;
+	}
+
+	ts.ts_thread = current_thread;
+	ts.ts_wc = wc;
+	ts.ts_lk = lk;
+	ts.ts_timedout = false;
+	timeout_init(&to, wchan_timedout, &ts);
+	timeout_arm(&to, ticks);
+
+	TRACE(TRACE_SLEEP, wc, 0);
+	thread_switch(S_SLEEP, wc, lk);
+
+	left = timeout_cancel(&to);
+	spinlock_acquire(lk);
+
+	if (ts.ts_timedout) {
+		return 0;
+	}
+	/* Woken just as the timeout came due; call it a wakeup. */
+	return left > 0 ? left : 1;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1055,20 +1334,23 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 
 	KASSERT(spinlock_do_i_hold(lk));
 
-	/* Grab a thread from the channel */
-	target = threadlist_remhead(&wc->wc_threads);
+	/* Grab the most urgent thread from the channel */
+	target = thread_rembest(&wc->wc_threads);
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
 		return;
 	}
+	target->t_wchan = NULL;
+	TRACE(TRACE_WAKE, wc, target);
 
 	/*
-	 * Note that thread_make_runnable acquires a runqueue lock
-	 * while we're holding LK. This is ok; all spinlocks
+	 * Note that thread_make_runnable may acquire our own runqueue
+	 * lock while we're holding LK. This is ok; all spinlocks
 	 * associated with wchans must come before the runqueue locks,
 	 * as we also bridge from the wchan lock to the runqueue lock
-	 * in thread_switch.
+	 * in thread_switch. Threads belonging to other cpus are
+	 * handed over without taking their runqueue locks at all.
 	 */
 
 	thread_make_runnable(target, false);
@@ -1092,13 +1374,15 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * private list.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
+		TRACE(TRACE_WAKE, wc, target);
 		threadlist_addtail(&list, target);
 	}
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Threads on other cpus go onto those cpus' lock-free wakeup
+	 * lists, which sends at most one IPI per cpu however many
+	 * threads we wake, so there's no need to sort by cpu first.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
 		thread_make_runnable(target, false);
@@ -1160,37 +1444,133 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Queue a TLB shootdown for the specified CPU, and send it an IPI if
+ * it doesn't already have one coming. Returns a ticket for
+ * ipi_tlbshootdown_wait.
  */
-void
+unsigned
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	unsigned n;
+	unsigned n, ticket;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+	if (target->c_shootdown_all) {
+		/* Already flushing everything; nothing to add. */
+	}
+	else if (n == TLBSHOOTDOWN_MAX) {
+		/* Out of room: give up on the list and flush it all. */
+		target->c_shootdown_all = true;
+		target->c_numshootdown = 0;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+	ticket = ++target->c_shootdown_queued;
 
-	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
+	if ((target->c_ipi_pending & ((uint32_t)1 << IPI_TLBSHOOTDOWN)) == 0) {
+		target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+		target->c_shootdown_ipis++;
+		mainbus_send_ipi(target);
+	}
 
 	spinlock_release(&target->c_ipi_lock);
+	return ticket;
+}
+
+/*
+ * Wait until TARGET has finished the shootdown that got TICKET.
+ * Spin rather than sleep: this is meant for VM code that may not be
+ * in a position to sleep, and the wait is one interrupt's worth.
+ *
+ * Interrupts must be on. The caller may have been moved onto TARGET
+ * since queueing the request; then the IPI is taken right here.
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	KASSERT(current_thread->t_curspl == 0);
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	while ((int)(target->c_shootdown_done - ticket) < 0) {
+		membar_load_load();
+	}
+}
+
+void
+ipi_tlbshootdown_sync(struct addrspace *as, const struct tlbshootdown *mapping)
+{
+	unsigned tickets[MAXCPUS];
+	uint32_t targets;
+	struct cpu *c, *self;
+	unsigned i, num;
+	unsigned entries;
+	int spl;
+
+	/*
+	 * Stay on one cpu while choosing targets and flushing locally;
+	 * if we moved in between, the cpu we left would be skipped.
+	 */
+	spl = splhigh();
+	self = curcpu->c_self;
+
+	/* Make the caller's mapping changes visible before we look. */
+	membar_any_any();
+
+	num = cpuarray_num(&allcpus);
+	KASSERT(num <= MAXCPUS);
+
+	targets = 0;
+	for (i=0; i<num; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == self ||
+		    (as != NULL && c->c_curas != as)) {
+			continue;
+		}
+		tickets[i] = ipi_tlbshootdown(c, mapping);
+		targets |= (uint32_t)1 << i;
+	}
+
+	if (as == NULL || self->c_curas == as) {
+		entries = vm_tlbshootdown(mapping);
+		spinlock_acquire(&self->c_ipi_lock);
+		self->c_shootdown_entries += entries;
+		spinlock_release(&self->c_ipi_lock);
+	}
+
+	/* The targets may be waiting on us likewise; take IPIs. */
+	splx(spl);
+
+	for (i=0; i<num; i++) {
+		if (targets & ((uint32_t)1 << i)) {
+			ipi_tlbshootdown_wait(cpuarray_get(&allcpus, i),
+					      tickets[i]);
+		}
+	}
+}
+
+void
+tlbshootdown_getstats(struct tlbshootdown_stats *stats)
+{
+	struct cpu *c;
+	unsigned i;
+
+	stats->tss_requests = 0;
+	stats->tss_ipis = 0;
+	stats->tss_entries = 0;
+	stats->tss_flushes = 0;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_ipi_lock);
+		stats->tss_requests += c->c_shootdown_queued;
+		stats->tss_ipis += c->c_shootdown_ipis;
+		stats->tss_entries += c->c_shootdown_entries;
+		stats->tss_flushes += c->c_shootdown_flushes;
+		spinlock_release(&c->c_ipi_lock);
+	}
 }
 
 /*
@@ -1233,10 +1613,22 @@ interprocessor_interrupt(void)
 		 * need to release the ipi lock while calling
 		 * vm_tlbshootdown.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		if (curcpu->c_shootdown_all) {
+			curcpu->c_shootdown_entries += vm_tlbshootdown_all();
+			curcpu->c_shootdown_flushes++;
+		}
+		else {
+			for (i=0; i<curcpu->c_numshootdown; i++) {
+				curcpu->c_shootdown_entries +=
+					vm_tlbshootdown(&curcpu->c_shootdown[i]);
+			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_all = false;
+
+		/* Let ipi_tlbshootdown_wait callers go. */
+		membar_store_store();
+		curcpu->c_shootdown_done = curcpu->c_shootdown_queued;
 	}
 
 	curcpu->c_ipi_pending = 0;
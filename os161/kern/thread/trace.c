@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Kernel tracepoints. See trace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <uio.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <membar.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <trace.h>
+
+/*
+ * One cpu's ring. tr_next counts every record ever written, so the
+ * newest is at (tr_next - 1) % tr_size. tr_busy is set while the
+ * owning cpu is inside trace_record, for trace_stop to wait on.
+ */
+struct tracering {
+	struct tracerec *tr_recs;
+	unsigned tr_size;
+	unsigned tr_next;
+	volatile bool tr_busy;
+};
+
+/*
+ * The rings, one per cpu, indexed by c_number. As with the profiler's,
+ * they're kept from one run to the next and only reallocated to get
+ * bigger.
+ *
+ * Everything here is changed only by trace_start/stop/dump, which are
+ * serialized by trace_lock, and by each cpu in trace_record on its
+ * own ring.
+ */
+static struct tracering *trace_rings;
+static unsigned trace_nrings;
+static unsigned trace_ringsize;
+static struct spinlock trace_lock = SPINLOCK_INITIALIZER;
+static bool trace_inuse;	/* start/stop/dump in progress */
+
+volatile bool trace_running;
+
+static
+bool
+trace_enter(void)
+{
+	bool ok;
+
+	spinlock_acquire(&trace_lock);
+	ok = !trace_inuse;
+	trace_inuse = true;
+	spinlock_release(&trace_lock);
+	return ok;
+}
+
+static
+void
+trace_leave(void)
+{
+	spinlock_acquire(&trace_lock);
+	trace_inuse = false;
+	spinlock_release(&trace_lock);
+}
+
+int
+trace_start(unsigned nrecs)
+{
+	struct tracering *rings;
+	unsigned i;
+	int result;
+
+	if (nrecs == 0 || nrecs > TRACE_MAXRECS) {
+		return EINVAL;
+	}
+	if (!trace_enter()) {
+		return EBUSY;
+	}
+	if (trace_running) {
+		result = EBUSY;
+		goto out;
+	}
+
+	if (trace_rings == NULL || nrecs > trace_ringsize) {
+		rings = kmalloc(num_cpus * sizeof(*rings));
+		if (rings == NULL) {
+			result = ENOMEM;
+			goto out;
+		}
+		for (i=0; i<num_cpus; i++) {
+			rings[i].tr_recs =
+				kmalloc(nrecs * sizeof(struct tracerec));
+			if (rings[i].tr_recs == NULL) {
+				while (i-- > 0) {
+					kfree(rings[i].tr_recs);
+				}
+				kfree(rings);
+				result = ENOMEM;
+				goto out;
+			}
+		}
+		if (trace_rings != NULL) {
+			for (i=0; i<trace_nrings; i++) {
+				kfree(trace_rings[i].tr_recs);
+			}
+			kfree(trace_rings);
+		}
+		trace_rings = rings;
+		trace_nrings = num_cpus;
+		trace_ringsize = nrecs;
+	}
+
+	for (i=0; i<trace_nrings; i++) {
+		trace_rings[i].tr_size = nrecs;
+		trace_rings[i].tr_next = 0;
+		trace_rings[i].tr_busy = false;
+	}
+
+	/* Rings first, then the flag that lets cpus at them. */
+	membar_store_store();
+	trace_running = true;
+	result = 0;
+
+ out:
+	trace_leave();
+	return result;
+}
+
+void
+trace_stop(void)
+{
+	unsigned i;
+
+	if (!trace_enter()) {
+		return;
+	}
+
+	trace_running = false;
+
+	/* Same handshake as prof_stop. */
+	membar_any_any();
+	for (i=0; i<trace_nrings; i++) {
+		while (trace_rings[i].tr_busy) {
+			membar_load_load();
+		}
+	}
+
+	trace_leave();
+}
+
+/*
+ * Called through TRACE(), from anywhere: thread context, interrupt
+ * handlers, with or without spinlocks held.
+ */
+void
+trace_record(unsigned event, uint32_t a, uint32_t b)
+{
+	struct tracering *tr;
+	struct tracerec *rec;
+	struct timespec ts;
+	const char *name;
+	unsigned i;
+	int spl;
+
+	/* Keep interrupt handlers on this cpu out of the ring meanwhile. */
+	spl = splhigh();
+
+	tr = &trace_rings[curcpu->c_number];
+	tr->tr_busy = true;
+	membar_any_any();
+	if (!trace_running) {
+		tr->tr_busy = false;
+		splx(spl);
+		return;
+	}
+
+	rec = &tr->tr_recs[tr->tr_next % tr->tr_size];
+	tr->tr_next++;
+
+	gettime(&ts);
+	rec->tr_sec = ts.tv_sec;
+	rec->tr_nsec = ts.tv_nsec;
+	rec->tr_event = event;
+	rec->tr_cpu = curcpu->c_number;
+	rec->tr_thread = (uint32_t)(uintptr_t)current_thread;
+	rec->tr_a = a;
+	rec->tr_b = b;
+	name = current_thread->t_name;
+	for (i=0; i<TRACE_NAMELEN && name[i] != 0; i++) {
+		rec->tr_name[i] = name[i];
+	}
+	for (; i<TRACE_NAMELEN; i++) {
+		rec->tr_name[i] = 0;
+	}
+
+	membar_store_store();
+	tr->tr_busy = false;
+	splx(spl);
+}
+
+/*
+ * Write LEN bytes at POS.
+ */
+static
+int
+trace_write(struct vnode *vn, void *buf, size_t len, off_t *pos)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	if (len == 0) {
+		return 0;
+	}
+	uio_kinit(&iov, &ku, buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid > 0) {
+		return ENOSPC;
+	}
+	*pos += len;
+	return 0;
+}
+
+int
+trace_dump(char *path)
+{
+	struct traceheader th;
+	struct tracering *tr;
+	struct vnode *vn;
+	unsigned i, kept, oldest;
+	off_t pos;
+	int result;
+
+	if (!trace_enter()) {
+		return EBUSY;
+	}
+	if (trace_running) {
+		trace_leave();
+		return EBUSY;
+	}
+
+	bzero(&th, sizeof(th));
+	memcpy(th.th_magic, TRACE_MAGIC, sizeof(th.th_magic));
+	th.th_version = TRACE_VERSION;
+	th.th_recsize = sizeof(struct tracerec);
+	th.th_ncpus = trace_nrings;
+	for (i=0; i<trace_nrings; i++) {
+		tr = &trace_rings[i];
+		kept = tr->tr_next < tr->tr_size ? tr->tr_next : tr->tr_size;
+		th.th_nrecs += kept;
+		th.th_lost += tr->tr_next - kept;
+	}
+
+	/* vfs_open destroys the string it's passed; that's ok here */
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		trace_leave();
+		return result;
+	}
+
+	pos = 0;
+	result = trace_write(vn, &th, sizeof(th), &pos);
+
+	/* Each ring in two pieces: oldest to the end, then the start. */
+	for (i=0; i<trace_nrings && result == 0; i++) {
+		tr = &trace_rings[i];
+		if (tr->tr_next <= tr->tr_size) {
+			result = trace_write(vn, tr->tr_recs,
+				tr->tr_next * sizeof(struct tracerec), &pos);
+			continue;
+		}
+		oldest = tr->tr_next % tr->tr_size;
+		result = trace_write(vn, &tr->tr_recs[oldest],
+			(tr->tr_size - oldest) * sizeof(struct tracerec),
+			&pos);
+		if (result == 0) {
+			result = trace_write(vn, tr->tr_recs,
+				oldest * sizeof(struct tracerec), &pos);
+		}
+	}
+
+	vfs_close(vn);
+	if (result == 0) {
+		kprintf("trace: %u records, %u lost\n",
+			th.th_nrecs, th.th_lost);
+	}
+	trace_leave();
+	return result;
+}
@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <pagecache.h>
 
 /*
  * Structure for a single named device.
@@ -177,6 +178,9 @@ vfs_sync(void)
 	struct knowndev *dev;
 	unsigned i, num;
 
+	/* Mapped pages first, so the filesystems sync what they wrote. */
+	/*result =*/ pagecache_sync();
+
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -180,3 +180,72 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	(void)amount;
+	(void)oldbreak;
+	return ENOSYS;
+}
+
+
+int
+as_mmap(struct addrspace *as, struct vnode *vn, off_t offset, size_t len,
+	int prot, int flags, vaddr_t *ret)
+{
+	/*
+	 * Write this. (See pagecache.h for where file pages come from.)
+	 */
+
+	(void)as;
+	(void)vn;
+	(void)offset;
+	(void)len;
+	(void)prot;
+	(void)flags;
+	(void)ret;
+	return ENOSYS;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	(void)addr;
+	(void)len;
+	return ENOSYS;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t addr, size_t len, int flags)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	(void)addr;
+	(void)len;
+	(void)flags;
+	return ENOSYS;
+}
+
+void
+as_getusage(struct addrspace *as, struct as_usage *ret)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	bzero(ret, sizeof(*ret));
+}
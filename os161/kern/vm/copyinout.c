@@ -34,6 +34,7 @@
 #include <thread.h>
 #include <current.h>
 #include <vm.h>
+#include <uio.h>
 #include <copyinout.h>
 
 /*
@@ -142,12 +143,63 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Copy LEN bytes from SRC to DEST, like memcpy. Unlike memcpy this
+ * doesn't need the length to be a multiple of the word size to copy
+ * by words: if the pointers are equally misaligned it copies bytes up
+ * to a word boundary, then words (four at a time while it can), then
+ * any leftover bytes. Small and odd-sized copies are common here, and
+ * memcpy would do them all a byte at a time.
+ *
+ * Must only be called with tm_badfaultfunc set up, if either pointer
+ * is a user address.
+ */
+static
+void
+copybytes(void *dest, const void *src, size_t len)
+{
+	char *d = dest;
+	const char *s = src;
+	uint32_t *dw;
+	const uint32_t *sw;
+
+	if (((uintptr_t)d ^ (uintptr_t)s) % sizeof(uint32_t) == 0) {
+		while (len > 0 && (uintptr_t)d % sizeof(uint32_t) != 0) {
+			*d++ = *s++;
+			len--;
+		}
+
+		dw = (uint32_t *)d;
+		sw = (const uint32_t *)s;
+		while (len >= 4 * sizeof(uint32_t)) {
+			dw[0] = sw[0];
+			dw[1] = sw[1];
+			dw[2] = sw[2];
+			dw[3] = sw[3];
+			dw += 4;
+			sw += 4;
+			len -= 4 * sizeof(uint32_t);
+		}
+		while (len >= sizeof(uint32_t)) {
+			*dw++ = *sw++;
+			len -= sizeof(uint32_t);
+		}
+		d = (char *)dw;
+		s = (const char *)sw;
+	}
+
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC
- * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * to kernel address DEST. We can use plain loads and stores because
+ * they're protected by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +224,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copybytes(dest, (const void *)usersrc, len);
 
 	current_thread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,8 +234,8 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
- * protected by the tm_badfaultfunc/copyfail logic.
+ * user-level address USERDEST. We can use plain loads and stores
+ * because they're protected by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyout(const void *src, userptr_t userdest, size_t len)
@@ -208,7 +260,117 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copybytes((void *)userdest, src, len);
+
+	current_thread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * copyin_bulk
+ *
+ * Copy an array of NELEM objects of ELEMSIZE bytes each from USERSRC
+ * to DEST. This is copyin with the multiplication checked for
+ * overflow, so syscalls that take a user-supplied count (argv
+ * vectors, iovec arrays) can fetch the whole array with one check
+ * and one recovery setup instead of one per element.
+ */
+int
+copyin_bulk(const_userptr_t usersrc, void *dest, size_t nelem,
+	    size_t elemsize)
+{
+	if (nelem == 0 || elemsize == 0) {
+		return 0;
+	}
+	if (nelem > (size_t)-1 / elemsize) {
+		return EFAULT;
+	}
+	return copyin(usersrc, dest, nelem * elemsize);
+}
+
+/*
+ * copyuio
+ *
+ * The user-space half of uiomove: move up to N bytes between kernel
+ * address PTR and the user iovecs of UIO. Every user range the
+ * transfer will touch is checked before anything is copied, and the
+ * tm_badfaultfunc/copyfail recovery is set up once for the whole
+ * transfer rather than once per iovec.
+ *
+ * If a fault happens partway, the uio reflects what was copied before
+ * the iovec that faulted.
+ */
+int
+copyuio(void *ptr, size_t n, struct uio *uio)
+{
+	struct iovec *iov;
+	size_t left, size, stoplen;
+	unsigned i;
+	int result;
+
+	/* Check the whole transfer up front. */
+	left = n < uio->uio_resid ? n : uio->uio_resid;
+	for (i=0; i<uio->uio_iovcnt && left > 0; i++) {
+		size = uio->uio_iov[i].iov_len;
+		if (size == 0) {
+			continue;
+		}
+		if (size > left) {
+			size = left;
+		}
+		result = copycheck(uio->uio_iov[i].iov_ubase, size, &stoplen);
+		if (result) {
+			return result;
+		}
+		if (stoplen != size) {
+			return EFAULT;
+		}
+		left -= size;
+	}
+	if (left > 0) {
+		/*
+		 * This should only happen if you set uio_resid
+		 * incorrectly (to more than the total length of
+		 * buffers the uio points to).
+		 */
+		panic("uiomove: ran out of buffers\n");
+	}
+
+	current_thread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(current_thread->t_machdep.tm_copyjmp);
+	if (result) {
+		current_thread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	while (n > 0 && uio->uio_resid > 0) {
+		iov = uio->uio_iov;
+		size = iov->iov_len;
+		if (size > n) {
+			size = n;
+		}
+		if (size == 0) {
+			/* move to the next iovec */
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+
+		if (uio->uio_rw == UIO_READ) {
+			copybytes((void *)iov->iov_ubase, ptr, size);
+		}
+		else {
+			copybytes(ptr, (const void *)iov->iov_ubase, size);
+		}
+
+		iov->iov_ubase += size;
+		iov->iov_len -= size;
+		uio->uio_resid -= size;
+		uio->uio_offset += size;
+		ptr = (char *)ptr + size;
+		n -= size;
+	}
 
 	current_thread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
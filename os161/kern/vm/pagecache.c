@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Page cache for mapped files. See pagecache.h for the interface.
+ *
+ * The cache is a hash table of pages keyed by (vnode, offset) under
+ * one sleep lock. Filling and cleaning a page is done without that
+ * lock held, with the page marked busy by the thread doing the I/O.
+ * Others wanting a busy page normally wait on pc_cv.
+ *
+ * That wait is not safe everywhere. The I/O goes through VOP_READ and
+ * VOP_WRITE, which take filesystem locks (vfs_biglock for sfs, e_lock
+ * for emufs), and the filesystem also holds those locks while it
+ * copies to and from user memory - which can fault on a mapped page
+ * and come here. If that page is busy with I/O waiting for the same
+ * locks, neither thread can go on. So filesystems mark those copies
+ * with pagecache_fsio_enter/leave, and a fault inside one never waits
+ * for someone else's busy page: pagecache_get fails with EFAULT, and
+ * pagecache_put hands the page over to the thread doing the I/O,
+ * which finishes the put when it's done (see pc_finish).
+ *
+ * The I/O can also come back here through the filesystem's
+ * pagecache_flush/pagecache_refresh hooks for the very page being
+ * filled or cleaned; those skip pages the current thread has busy.
+ *
+ * Pages that drop out of the cache are kept on a free list instead of
+ * going back to free_kpages, which dumbvm can't reclaim.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <vnode.h>
+#include <vm.h>
+#include <pagecache.h>
+
+#define PC_HASHSIZE	64
+
+struct pcpage {
+	struct pcpage *pp_next;		/* hash chain, or free list */
+	struct vnode *pp_vn;		/* file (we hold a reference) */
+	off_t pp_offset;		/* page-aligned offset in the file */
+	vaddr_t pp_kva;			/* the page itself */
+	unsigned pp_refcount;		/* references from pagecache_get */
+	bool pp_dirty;			/* written through a mapping */
+	struct thread *pp_busy;		/* thread doing I/O on it, or NULL */
+};
+
+static struct lock *pc_lock;
+static struct cv *pc_cv;
+static struct pcpage *pc_hash[PC_HASHSIZE];
+static struct pcpage *pc_freelist;
+
+void
+pagecache_bootstrap(void)
+{
+	pc_lock = lock_create("pagecache");
+	pc_cv = cv_create("pagecache");
+	if (pc_lock == NULL || pc_cv == NULL) {
+		panic("pagecache_bootstrap: Out of memory\n");
+	}
+}
+
+static
+unsigned
+pc_bucket(struct vnode *vn, off_t offset)
+{
+	return ((uintptr_t)vn / sizeof(*vn) +
+		(uint32_t)(offset / PAGE_SIZE)) % PC_HASHSIZE;
+}
+
+/*
+ * Find the page for OFFSET of VN, if it's cached.
+ */
+static
+struct pcpage *
+pc_find(struct vnode *vn, off_t offset)
+{
+	struct pcpage *pp;
+
+	for (pp = pc_hash[pc_bucket(vn, offset)]; pp != NULL;
+	     pp = pp->pp_next) {
+		if (pp->pp_vn == vn && pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find the page of VN with the lowest offset in [START, END), not
+ * counting pages this thread has busy. Waits out other threads' I/O
+ * on the page found.
+ */
+static
+struct pcpage *
+pc_findrange(struct vnode *vn, off_t start, off_t end)
+{
+	struct pcpage *pp, *best;
+	unsigned i;
+
+ again:
+	best = NULL;
+	for (i=0; i<PC_HASHSIZE; i++) {
+		for (pp = pc_hash[i]; pp != NULL; pp = pp->pp_next) {
+			if (pp->pp_vn != vn || pp->pp_busy == current_thread ||
+			    pp->pp_offset < start || pp->pp_offset >= end) {
+				continue;
+			}
+			if (best == NULL || pp->pp_offset < best->pp_offset) {
+				best = pp;
+			}
+		}
+	}
+	if (best != NULL && best->pp_busy != NULL) {
+		cv_wait(pc_cv, pc_lock);
+		goto again;
+	}
+	return best;
+}
+
+/*
+ * Get a page (and its header) from the free list or the VM system.
+ */
+static
+struct pcpage *
+pc_alloc(void)
+{
+	struct pcpage *pp;
+
+	if (pc_freelist != NULL) {
+		pp = pc_freelist;
+		pc_freelist = pp->pp_next;
+		return pp;
+	}
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return NULL;
+	}
+	pp->pp_kva = alloc_kpages(1);
+	if (pp->pp_kva == 0) {
+		kfree(pp);
+		return NULL;
+	}
+	return pp;
+}
+
+/*
+ * Take PP out of the cache and put it on the free list. The caller
+ * drops the vnode reference, after letting go of pc_lock.
+ */
+static
+void
+pc_remove(struct pcpage *pp)
+{
+	struct pcpage **ppp;
+
+	for (ppp = &pc_hash[pc_bucket(pp->pp_vn, pp->pp_offset)];
+	     *ppp != pp; ppp = &(*ppp)->pp_next) {
+		KASSERT(*ppp != NULL);
+	}
+	*ppp = pp->pp_next;
+
+	KASSERT(pp->pp_vn->vn_pcpages > 0);
+	pp->pp_vn->vn_pcpages--;
+
+	pp->pp_vn = NULL;
+	pp->pp_refcount = 0;
+	pp->pp_dirty = false;
+	pp->pp_next = pc_freelist;
+	pc_freelist = pp;
+}
+
+/*
+ * Knock every user mapping out of every TLB, so that a store to a
+ * page that's about to be cleaned faults and marks it dirty again.
+ */
+static
+void
+pc_unmap_all(void)
+{
+	struct tlbshootdown ts;
+
+	ts.ts_vaddr = 0;
+	ts.ts_npages = USERSPACETOP / PAGE_SIZE;
+	ipi_tlbshootdown_sync(NULL, &ts);
+}
+
+/*
+ * Read PP in from its file, or write it out. Reads past EOF give
+ * zeros; writes stop at EOF, so a mapping never grows the file.
+ */
+static
+int
+pc_io(struct pcpage *pp, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct stat st;
+	size_t len;
+	int result;
+
+	if (rw == UIO_READ) {
+		uio_kinit(&iov, &ku, (void *)pp->pp_kva, PAGE_SIZE,
+			  pp->pp_offset, UIO_READ);
+		result = VOP_READ(pp->pp_vn, &ku);
+		if (result) {
+			return result;
+		}
+		bzero((char *)pp->pp_kva + PAGE_SIZE - ku.uio_resid,
+		      ku.uio_resid);
+		return 0;
+	}
+
+	result = VOP_STAT(pp->pp_vn, &st);
+	if (result) {
+		return result;
+	}
+	if (st.st_size <= pp->pp_offset) {
+		return 0;
+	}
+	len = PAGE_SIZE;
+	if (st.st_size - pp->pp_offset < PAGE_SIZE) {
+		len = st.st_size - pp->pp_offset;
+	}
+	uio_kinit(&iov, &ku, (void *)pp->pp_kva, len, pp->pp_offset,
+		  UIO_WRITE);
+	return VOP_WRITE(pp->pp_vn, &ku);
+}
+
+static void pc_finish(struct pcpage *pp);
+
+/*
+ * Do I/O on PP with pc_lock released, holding the page busy instead.
+ * When cleaning a page, clear the dirty bit and (if it might still be
+ * mapped) unmap it everywhere first, so stores made during the write
+ * aren't lost. On failure the page is left dirty.
+ *
+ * If the last reference to PP was dropped while it was busy, PP is
+ * gone when this returns.
+ */
+static
+int
+pc_busyio(struct pcpage *pp, enum uio_rw rw, bool mapped)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+	KASSERT(pp->pp_busy == NULL);
+
+	pp->pp_busy = current_thread;
+	if (rw == UIO_WRITE) {
+		pp->pp_dirty = false;
+	}
+	lock_release(pc_lock);
+
+	if (rw == UIO_WRITE && mapped) {
+		pc_unmap_all();
+	}
+	result = pc_io(pp, rw);
+
+	lock_acquire(pc_lock);
+	pp->pp_busy = NULL;
+	if (result && rw == UIO_WRITE) {
+		pp->pp_dirty = true;
+	}
+	cv_broadcast(pc_cv, pc_lock);
+	if (pp->pp_refcount == 0) {
+		pc_finish(pp);
+	}
+	return result;
+}
+
+/*
+ * The rest of pagecache_put, once PP has no references and isn't
+ * busy: write it back if it's dirty and take it out of the cache.
+ * Lets go of pc_lock for a while. The page may be picked up again
+ * by pagecache_get while it's being written, in which case it stays.
+ */
+static
+void
+pc_finish(struct pcpage *pp)
+{
+	struct vnode *vn;
+	int result;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+	KASSERT(pp->pp_refcount == 0 && pp->pp_busy == NULL);
+
+	while (pp->pp_dirty) {
+		/* Hold it, so the write-back doesn't come back here. */
+		pp->pp_refcount++;
+		result = pc_busyio(pp, UIO_WRITE, false);
+		pp->pp_refcount--;
+		if (result) {
+			kprintf("pagecache: write-back failed: %s\n",
+				strerror(result));
+			break;
+		}
+		if (pp->pp_refcount > 0) {
+			return;
+		}
+	}
+
+	vn = pp->pp_vn;
+	pc_remove(pp);
+	lock_release(pc_lock);
+	VOP_DECREF(vn);
+	lock_acquire(pc_lock);
+}
+
+int
+pagecache_get(struct vnode *vn, off_t offset, struct pcpage **ret)
+{
+	struct pcpage *pp;
+	unsigned bucket;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	lock_acquire(pc_lock);
+	while ((pp = pc_find(vn, offset)) != NULL && pp->pp_busy != NULL) {
+		KASSERT(pp->pp_busy != current_thread);
+		if (current_thread->t_fsio > 0) {
+			/* Its I/O may be waiting for locks we hold. */
+			lock_release(pc_lock);
+			return EFAULT;
+		}
+		cv_wait(pc_cv, pc_lock);
+	}
+	if (pp != NULL) {
+		pp->pp_refcount++;
+		lock_release(pc_lock);
+		*ret = pp;
+		return 0;
+	}
+
+	pp = pc_alloc();
+	if (pp == NULL) {
+		lock_release(pc_lock);
+		return ENOMEM;
+	}
+	VOP_INCREF(vn);
+	pp->pp_vn = vn;
+	pp->pp_offset = offset;
+	pp->pp_refcount = 1;
+	pp->pp_dirty = false;
+	pp->pp_busy = NULL;
+	bucket = pc_bucket(vn, offset);
+	pp->pp_next = pc_hash[bucket];
+	pc_hash[bucket] = pp;
+	vn->vn_pcpages++;
+
+	result = pc_busyio(pp, UIO_READ, false);
+	if (result) {
+		pc_remove(pp);
+		lock_release(pc_lock);
+		VOP_DECREF(vn);
+		return result;
+	}
+	lock_release(pc_lock);
+
+	*ret = pp;
+	return 0;
+}
+
+/*
+ * The caller must already have removed PP from its TLBs: if this is
+ * the last reference, a dirty page is written back without unmapping
+ * it again.
+ */
+void
+pagecache_put(struct pcpage *pp)
+{
+	lock_acquire(pc_lock);
+	KASSERT(pp->pp_refcount > 0);
+	while (pp->pp_refcount == 1 && pp->pp_busy != NULL &&
+	       current_thread->t_fsio == 0) {
+		cv_wait(pc_cv, pc_lock);
+	}
+	pp->pp_refcount--;
+	/* If it's still busy, pc_busyio calls pc_finish when it's done. */
+	if (pp->pp_refcount == 0 && pp->pp_busy == NULL) {
+		pc_finish(pp);
+	}
+	lock_release(pc_lock);
+}
+
+void
+pagecache_dirty(struct pcpage *pp)
+{
+	lock_acquire(pc_lock);
+	KASSERT(pp->pp_refcount > 0);
+	pp->pp_dirty = true;
+	lock_release(pc_lock);
+}
+
+paddr_t
+pagecache_paddr(struct pcpage *pp)
+{
+	return KVADDR_TO_PADDR(pp->pp_kva);
+}
+
+int
+pagecache_flush(struct vnode *vn, off_t start, off_t end)
+{
+	struct pcpage *pp;
+	int result;
+
+	/* Unlocked peek: nothing mapped, nothing to do. */
+	if (vn->vn_pcpages == 0) {
+		return 0;
+	}
+
+	start -= start % PAGE_SIZE;
+	result = 0;
+
+	lock_acquire(pc_lock);
+	while ((pp = pc_findrange(vn, start, end)) != NULL) {
+		start = pp->pp_offset + PAGE_SIZE;
+		if (pp->pp_dirty) {
+			result = pc_busyio(pp, UIO_WRITE, true);
+			if (result) {
+				break;
+			}
+		}
+	}
+	lock_release(pc_lock);
+
+	return result;
+}
+
+void
+pagecache_refresh(struct vnode *vn, off_t start, off_t end)
+{
+	struct pcpage *pp;
+	int result;
+
+	if (vn->vn_pcpages == 0) {
+		return;
+	}
+
+	start -= start % PAGE_SIZE;
+
+	lock_acquire(pc_lock);
+	while ((pp = pc_findrange(vn, start, end)) != NULL) {
+		start = pp->pp_offset + PAGE_SIZE;
+		if (pp->pp_dirty) {
+			/*
+			 * Stored to through a mapping since the flush
+			 * before the write. Rereading would throw those
+			 * stores away; keep them, and let them go out
+			 * when the page is next cleaned.
+			 */
+			continue;
+		}
+		result = pc_busyio(pp, UIO_READ, false);
+		if (result) {
+			/* Leave the old contents; nothing better to do. */
+			kprintf("pagecache: reread failed: %s\n",
+				strerror(result));
+		}
+	}
+	lock_release(pc_lock);
+}
+
+int
+pagecache_sync(void)
+{
+	struct pcpage *pp;
+	unsigned i;
+	int result;
+
+	/*
+	 * Not set up yet, or called with interrupts off (from panic):
+	 * we can neither sleep nor wait for other cpus to unmap pages.
+	 */
+	if (pc_lock == NULL || current_thread->t_curspl > 0) {
+		return 0;
+	}
+
+	lock_acquire(pc_lock);
+ again:
+	for (i=0; i<PC_HASHSIZE; i++) {
+		for (pp = pc_hash[i]; pp != NULL; pp = pp->pp_next) {
+			if (!pp->pp_dirty || pp->pp_busy == current_thread) {
+				continue;
+			}
+			if (pp->pp_busy != NULL) {
+				cv_wait(pc_cv, pc_lock);
+			}
+			else {
+				result = pc_busyio(pp, UIO_WRITE, true);
+				if (result) {
+					lock_release(pc_lock);
+					return result;
+				}
+			}
+			/* The chains may have changed while we slept. */
+			goto again;
+		}
+	}
+	lock_release(pc_lock);
+
+	return 0;
+}
+
+void
+pagecache_fsio_enter(void)
+{
+	current_thread->t_fsio++;
+}
+
+void
+pagecache_fsio_leave(void)
+{
+	KASSERT(current_thread->t_fsio > 0);
+	current_thread->t_fsio--;
+}
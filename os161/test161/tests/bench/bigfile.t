@@ -0,0 +1,14 @@
+---
+name: "bigfile Benchmark"
+description: >
+  Times bigfile building a 1M file in small writes, on one cpu.
+tags: [bench]
+depends: [shell, filesyscalls]
+sys161:
+  cpus: 1
+  ram: 2M
+---
+perf
+$ /testbin/bigfile bench-bigfile.dat 1048576
+perf
+$ /bin/rm bench-bigfile.dat
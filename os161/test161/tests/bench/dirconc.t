@@ -0,0 +1,14 @@
+---
+name: "dirconc Benchmark"
+description: >
+  Times dirconc, many processes doing directory operations on the
+  same names at once, on four cpus.
+tags: [bench]
+depends: [shell, filesyscalls]
+sys161:
+  cpus: 4
+  ram: 4M
+---
+perf
+$ /testbin/dirconc emu0: 1
+perf
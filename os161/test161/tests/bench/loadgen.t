@@ -0,0 +1,15 @@
+---
+name: "Mixed Load Benchmark"
+description: >
+  Times a mix of cpu-bound and memory-bound jobs arriving at random,
+  up to four running at a time, on four cpus. loadgen reports their
+  turnaround percentiles and the throughput.
+tags: [bench]
+depends: [shell, filesyscalls]
+sys161:
+  cpus: 4
+  ram: 8M
+---
+perf
+$ /testbin/loadgen -n 24 -c 4 -r 20 -s 161 /testbin/hog -- /testbin/matmult -- /testbin/sort
+perf
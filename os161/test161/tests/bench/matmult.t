@@ -0,0 +1,14 @@
+---
+name: "matmult Benchmark"
+description: >
+  Times matmult, which faults in and multiplies a large matrix, on one
+  cpu.
+tags: [bench]
+depends: [console]
+sys161:
+  cpus: 1
+  ram: 2M
+---
+perf
+p /testbin/matmult
+perf
@@ -0,0 +1,14 @@
+---
+name: "Parallel VM Benchmark"
+description: >
+  Times parallelvm, several processes doing matrix computations at
+  once, on four cpus.
+tags: [bench]
+depends: [console, sys_fork]
+sys161:
+  cpus: 4
+  ram: 8M
+---
+perf
+p /testbin/parallelvm
+perf
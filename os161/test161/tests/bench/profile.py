@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# Symbolize the kernel profiler's output.
+#
+# "prof dump" prints raw addresses, since the kernel has no symbol
+# table. Given the console output containing a dump and the kernel it
+# came from, this adds the samples up by function and prints a flat
+# profile, the call sites (by calling function), and the thread and
+# process breakdowns, biggest first:
+#
+#     profile.py ~/os161/root/kernel run.log [count]
+#
+# COUNT limits each table (default 25). Symbols come from "nm -n" on
+# the kernel; set NM to use another nm (the default is the OS/161
+# toolchain's).
+
+import bisect
+import os
+import re
+import subprocess
+import sys
+
+PROF = re.compile(r'prof: (\w+) (.*) (\d+)$')
+SAMPLES = re.compile(r'prof: samples (\d+) kernel (\d+) user (\d+) lost (\d+)')
+
+DEFAULT_NM = 'mips-harvard-os161-nm'
+DEFAULT_COUNT = 25
+
+
+def symbols(kernel):
+	nm = os.environ.get('NM', DEFAULT_NM)
+	out = subprocess.check_output([nm, '-n', kernel],
+				      universal_newlines=True)
+	addrs, names = [], []
+	for line in out.splitlines():
+		fields = line.split()
+		if len(fields) == 3 and fields[1] in 'tT':
+			addrs.append(int(fields[0], 16))
+			names.append(fields[2])
+	return addrs, names
+
+
+def lookup(syms, addr):
+	addrs, names = syms
+	i = bisect.bisect_right(addrs, addr) - 1
+	if i < 0:
+		return '0x%08x' % addr
+	return names[i]
+
+
+def table(title, counts, total, count):
+	print('%s:' % title)
+	ranked = sorted(counts.items(), key=lambda kv: (-kv[1], kv[0]))
+	for name, n in ranked[:count]:
+		pct = n * 100.0 / total if total else 0.0
+		print('  %6.2f%% %8d  %s' % (pct, n, name))
+	if len(ranked) > count:
+		rest = sum(n for _, n in ranked[count:])
+		print('  %6.2f%% %8d  (%d more)' %
+		      (rest * 100.0 / total if total else 0.0, rest,
+		       len(ranked) - count))
+	print('')
+
+
+def main(argv):
+	if len(argv) not in (3, 4):
+		sys.stderr.write('Usage: %s KERNEL LOG [count]\n' % argv[0])
+		return 2
+	count = int(argv[3]) if len(argv) == 4 else DEFAULT_COUNT
+	syms = symbols(argv[1])
+
+	funcs, sites, threads, procs = {}, {}, {}, {}
+	kernel = total = 0
+	with open(argv[2]) as f:
+		for line in f:
+			m = SAMPLES.search(line)
+			if m:
+				total += int(m.group(1))
+				kernel += int(m.group(2))
+				print('%s samples: %s kernel, %s user, '
+				      '%s lost to full rings' % m.groups())
+				continue
+			m = PROF.search(line)
+			if not m:
+				continue
+			what, key, n = m.group(1), m.group(2), int(m.group(3))
+			if what == 'pc':
+				name = lookup(syms, int(key, 16))
+				funcs[name] = funcs.get(name, 0) + n
+			elif what == 'site':
+				name = lookup(syms, int(key, 16))
+				sites[name] = sites.get(name, 0) + n
+			elif what == 'thread':
+				threads[key] = threads.get(key, 0) + n
+			elif what == 'proc':
+				procs[key] = procs.get(key, 0) + n
+	print('')
+
+	table('Kernel time by function', funcs, kernel, count)
+	table('Kernel time by caller', sites, kernel, count)
+	table('Samples by thread', threads, total, count)
+	table('Samples by process', procs, total, count)
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
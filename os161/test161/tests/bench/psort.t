@@ -0,0 +1,14 @@
+---
+name: "psort Benchmark"
+description: >
+  Times psort, a parallel external sort across several processes
+  and files, on four cpus.
+tags: [bench]
+depends: [sys_fork, filesyscalls]
+sys161:
+  cpus: 4
+  ram: 8M
+---
+perf
+p /testbin/psort
+perf
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+#
+# Collect and compare benchmark results.
+#
+# Each bench test runs a workload between two "perf" kernel menu
+# commands, which print the kernel's counters as "perf: name value".
+# Given the console output of one or more runs (test161 -v output or
+# plain sys161 logs), "collect" pairs up the snapshots and prints, as
+# JSON, the wall-clock time and the change in every counter across
+# each workload:
+#
+#     results.py collect run.log > old.json
+#
+# Lines that start with a test name ("bench/matmult.t: ...") are
+# grouped by test; anything else is grouped under the log's file name.
+# A test with more than two snapshots gives one result per pair.
+#
+# "compare" shows what changed between two such files, and exits 1 if
+# any workload got slower by more than the threshold (percent):
+#
+#     results.py compare old.json new.json [threshold]
+
+import json
+import os
+import re
+import sys
+
+PERF = re.compile(r'perf: (\w+) (\S+)')
+TESTNAME = re.compile(r'^\s*(\S+\.t)\b')
+
+DEFAULT_THRESHOLD = 5.0
+
+
+def number(s):
+	return float(s) if '.' in s else int(s)
+
+
+def snapshots(path):
+	"""Return {group: [snapshot, ...]} for one log file."""
+	default = os.path.splitext(os.path.basename(path))[0]
+	groups = {}
+	current = {}
+	with open(path) as f:
+		for line in f:
+			m = PERF.search(line)
+			if not m:
+				continue
+			t = TESTNAME.match(line)
+			group = t.group(1) if t else default
+			snap = current.get(group)
+			# "time" is printed first, so it starts a new snapshot.
+			if snap is None or m.group(1) == 'time':
+				snap = {}
+				current[group] = snap
+				groups.setdefault(group, []).append(snap)
+			snap[m.group(1)] = number(m.group(2))
+	return groups
+
+
+def collect(paths):
+	results = {}
+	for path in paths:
+		for group, snaps in snapshots(path).items():
+			pairs = [(snaps[i], snaps[i + 1])
+				 for i in range(0, len(snaps) - 1, 2)]
+			for n, (before, after) in enumerate(pairs):
+				name = group if len(pairs) == 1 else \
+					'%s#%d' % (group, n + 1)
+				result = {}
+				for key in after:
+					if key not in before:
+						continue
+					if key == 'time':
+						result['wall_s'] = round(
+							after[key] - before[key], 6)
+					else:
+						result[key] = after[key] - before[key]
+				results[name] = result
+	json.dump(results, sys.stdout, indent=1, sort_keys=True)
+	sys.stdout.write('\n')
+	return 0
+
+
+def compare(oldpath, newpath, threshold):
+	with open(oldpath) as f:
+		old = json.load(f)
+	with open(newpath) as f:
+		new = json.load(f)
+
+	slower = 0
+	for test in sorted(set(old) & set(new)):
+		print(test)
+		for key in sorted(set(old[test]) & set(new[test])):
+			a, b = old[test][key], new[test][key]
+			if a == b and key != 'wall_s':
+				continue
+			change = (b - a) * 100.0 / a if a else 0.0
+			note = ''
+			if key == 'wall_s' and change > threshold:
+				note = '  SLOWER'
+				slower += 1
+			print('  %-20s %14s %14s %+8.1f%%%s' %
+			      (key, a, b, change, note))
+	for test in sorted(set(old) ^ set(new)):
+		print('%s: only in %s' % (test,
+		      oldpath if test in old else newpath))
+	return 1 if slower else 0
+
+
+def main(argv):
+	if len(argv) >= 3 and argv[1] == 'collect':
+		return collect(argv[2:])
+	if len(argv) in (4, 5) and argv[1] == 'compare':
+		threshold = float(argv[4]) if len(argv) == 5 \
+			else DEFAULT_THRESHOLD
+		return compare(argv[2], argv[3], threshold)
+	sys.stderr.write('Usage: %s collect LOG...\n'
+			 '       %s compare OLD.json NEW.json [threshold]\n'
+			 % (argv[0], argv[0]))
+	return 2
+
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
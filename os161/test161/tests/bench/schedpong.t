@@ -0,0 +1,14 @@
+---
+name: "schedpong Benchmark"
+description: >
+  Times schedpong with a mix of cpu-bound, memory-bound and I/O-bound
+  processes, on two cpus.
+tags: [bench]
+depends: [shell, filesyscalls]
+sys161:
+  cpus: 2
+  ram: 4M
+---
+perf
+$ /testbin/schedpong -t 2 -g 1 -p 2
+perf
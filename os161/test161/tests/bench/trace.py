@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+#
+# Turn a kernel trace into a timeline and latency figures.
+#
+# A kernel built with "options trace" records events (context
+# switches, sleeps and wakeups, lock waits, VM faults, system calls,
+# disk I/O) while "trace start" is in effect; "trace dump FILE" writes
+# them out in binary. Dump to emu0: so the file lands in the
+# System/161 root directory:
+#
+#     OS/161 kernel [? for menu]: trace start; p /testbin/...; trace stop
+#     OS/161 kernel [? for menu]: trace dump emu0:trace.out
+#
+# Then
+#
+#     trace.py timeline trace.out
+#
+# prints every event in time order, and
+#
+#     trace.py latency trace.out
+#
+# pairs events up and prints how long things took: system calls (by
+# call number), faults, disk requests, lock waits, how long threads
+# slept, and how long a woken thread waited before it ran.
+
+import struct
+import sys
+
+HEADER = struct.Struct('>4s5I')
+RECORD = struct.Struct('>IIHHIII8s')
+MAGIC = b'KTRC'
+VERSION = 1
+
+SWITCH, SLEEP, WAKE, LOCKWAIT, LOCKGOT, FAULT, FAULTDONE, \
+	SYSCALL, SYSRET, DISKIO, DISKDONE = range(1, 12)
+
+EVENTS = {
+	SWITCH: 'switch',
+	SLEEP: 'sleep',
+	WAKE: 'wake',
+	LOCKWAIT: 'lockwait',
+	LOCKGOT: 'lockgot',
+	FAULT: 'fault',
+	FAULTDONE: 'faultdone',
+	SYSCALL: 'syscall',
+	SYSRET: 'sysret',
+	DISKIO: 'diskio',
+	DISKDONE: 'diskdone',
+}
+
+# Thread states, for the second word of a switch.
+STATES = {0: 'run', 1: 'ready', 2: 'sleep', 3: 'zombie'}
+
+FAULTTYPES = {0: 'read', 1: 'write', 2: 'readonly'}
+
+
+class Record:
+	def __init__(self, fields):
+		sec, nsec, self.event, self.cpu, self.thread, \
+			self.a, self.b, name = fields
+		self.time = sec + nsec / 1e9
+		self.name = name.rstrip(b'\0').decode('ascii', 'replace')
+
+
+def load(path):
+	with open(path, 'rb') as f:
+		data = f.read()
+	if len(data) < HEADER.size:
+		raise ValueError('%s: too short for a trace header' % path)
+	magic, version, recsize, ncpus, nrecs, lost = \
+		HEADER.unpack_from(data)
+	if magic != MAGIC or version != VERSION or recsize != RECORD.size:
+		raise ValueError('%s: not a version %d kernel trace' %
+				 (path, VERSION))
+	recs = []
+	pos = HEADER.size
+	for _ in range(nrecs):
+		if pos + RECORD.size > len(data):
+			break
+		recs.append(Record(RECORD.unpack_from(data, pos)))
+		pos += RECORD.size
+	# Each cpu's records are in order; merge them.
+	recs.sort(key=lambda r: r.time)
+	return ncpus, lost, recs
+
+
+def describe(r, names):
+	a, b = r.a, r.b
+	if r.event == SWITCH:
+		return 'to %s, %s' % (names.get(a, '0x%08x' % a),
+				      STATES.get(b, b))
+	if r.event in (SLEEP, LOCKWAIT):
+		return '0x%08x' % a
+	if r.event == WAKE:
+		return '0x%08x, %s' % (a, names.get(b, '0x%08x' % b))
+	if r.event == LOCKGOT:
+		return '0x%08x%s' % (a, ' after waiting' if b else '')
+	if r.event == FAULT:
+		return '0x%08x %s' % (a, FAULTTYPES.get(b, b))
+	if r.event == FAULTDONE:
+		return '0x%08x error %d' % (a, b)
+	if r.event == SYSCALL:
+		return 'call %d' % a
+	if r.event == SYSRET:
+		return 'call %d error %d' % (a, b)
+	if r.event == DISKIO:
+		return 'sector %d %s' % (a, 'write' if b else 'read')
+	if r.event == DISKDONE:
+		return 'sector %d error %d' % (a, b)
+	return '0x%08x 0x%08x' % (a, b)
+
+
+def threadnames(recs):
+	names = {}
+	for r in recs:
+		names[r.thread] = '%s@%08x' % (r.name or '-', r.thread)
+	return names
+
+
+def timeline(path):
+	ncpus, lost, recs = load(path)
+	names = threadnames(recs)
+	start = recs[0].time if recs else 0.0
+	print('# %d records from %d cpus, %d lost' %
+	      (len(recs), ncpus, lost))
+	print('# milliseconds since the first record')
+	for r in recs:
+		print('%12.6f cpu%-2d %-20s %-9s %s' %
+		      ((r.time - start) * 1e3, r.cpu, names[r.thread],
+		       EVENTS.get(r.event, r.event), describe(r, names)))
+	return 0
+
+
+class Latency:
+	def __init__(self):
+		self.times = []
+
+	def add(self, t):
+		self.times.append(t)
+
+	def line(self, what):
+		t = sorted(self.times)
+		n = len(t)
+		return '  %-24s %8d %12.3f %12.3f %12.3f %12.3f' % \
+			(what, n, sum(t) / n * 1e6, t[n // 2] * 1e6,
+			 t[min(n - 1, int(n * 0.99))] * 1e6, t[-1] * 1e6)
+
+
+def latency(path):
+	ncpus, lost, recs = load(path)
+	table = {}
+	pending = {}	# (kind, thread) -> start time
+
+	def begin(kind, thread, t):
+		pending[(kind, thread)] = t
+
+	def end(kind, thread, t, what):
+		start = pending.pop((kind, thread), None)
+		if start is not None:
+			table.setdefault(what, Latency()).add(t - start)
+
+	for r in recs:
+		if r.event == SYSCALL:
+			begin('sys', r.thread, r.time)
+		elif r.event == SYSRET:
+			end('sys', r.thread, r.time, 'syscall %d' % r.a)
+		elif r.event == FAULT:
+			begin('fault', r.thread, r.time)
+		elif r.event == FAULTDONE:
+			end('fault', r.thread, r.time, 'vm fault')
+		elif r.event == DISKIO:
+			begin('disk', r.thread, r.time)
+		elif r.event == DISKDONE:
+			end('disk', r.thread, r.time, 'disk io')
+		elif r.event == LOCKWAIT:
+			begin('lock', r.thread, r.time)
+		elif r.event == LOCKGOT and r.b:
+			end('lock', r.thread, r.time, 'lock wait')
+		elif r.event == SLEEP:
+			begin('sleep', r.thread, r.time)
+		elif r.event == WAKE:
+			begin('wake', r.b, r.time)
+		elif r.event == SWITCH:
+			end('sleep', r.a, r.time, 'sleeping')
+			end('wake', r.a, r.time, 'wakeup to running')
+
+	print('# %d records from %d cpus, %d lost' %
+	      (len(recs), ncpus, lost))
+	print('  %-24s %8s %12s %12s %12s %12s' %
+	      ('(microseconds)', 'count', 'mean', 'median', '99th', 'max'))
+	for what in sorted(table):
+		print(table[what].line(what))
+	return 0
+
+
+def main(argv):
+	if len(argv) == 3 and argv[1] == 'timeline':
+		return timeline(argv[2])
+	if len(argv) == 3 and argv[1] == 'latency':
+		return latency(argv[2])
+	sys.stderr.write('Usage: %s timeline TRACEFILE\n'
+			 '       %s latency TRACEFILE\n' % (argv[0], argv[0]))
+	return 2
+
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
@@ -0,0 +1,11 @@
+---
+name: "Futex Wakeup Order Test"
+description:
+  Puts several threads to sleep on one futex word and checks that
+  FUTEX_WAKE brings them back oldest first.
+tags: [synch, futex]
+depends: [boot]
+sys161:
+  cpus: 8
+---
+fxt1
@@ -0,0 +1,13 @@
+---
+name: "Priority Chain Test"
+description:
+  Checks that lock priority inheritance follows a chain of waiters
+  and is given back on release.
+tags: [synch, locks, priority, kleaks]
+depends: [boot, semaphores, locks]
+sys161:
+  cpus: 8
+---
+khu
+pit1
+khu
@@ -0,0 +1,13 @@
+---
+name: "Priority Inversion Test"
+description:
+  Reproduces a priority inversion on one cpu and checks that lock
+  priority inheritance bounds the high-priority thread's wait.
+tags: [synch, locks, priority, kleaks]
+depends: [boot, semaphores, locks]
+sys161:
+  cpus: 1
+---
+khu
+pit2
+khu
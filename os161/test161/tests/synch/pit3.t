@@ -0,0 +1,14 @@
+---
+name: "Rwlock Reader Handoff Test"
+description:
+  Has the first of two readers release an rwlock and exit while the
+  other still holds it, and checks that no reader is left owning the
+  rwlock's locks and that a waiting writer gets in only afterwards.
+tags: [synch, rwlocks, priority, kleaks]
+depends: [boot, semaphores, locks]
+sys161:
+  cpus: 8
+---
+khu
+pit3
+khu
@@ -0,0 +1,12 @@
+---
+name: "Timed Semaphore Test"
+description:
+  Races semaphore timeouts against V() across cpus.
+tags: [synch, semaphores, timeouts, kleaks]
+depends: [boot, semaphores]
+sys161:
+  cpus: 8
+---
+khu
+tmt1
+khu
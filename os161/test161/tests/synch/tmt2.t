@@ -0,0 +1,12 @@
+---
+name: "Timed Lock Test"
+description:
+  Races timed lock acquires against a long-held lock.
+tags: [synch, locks, timeouts, kleaks]
+depends: [boot, semaphores, locks]
+sys161:
+  cpus: 8
+---
+khu
+tmt2
+khu
@@ -0,0 +1,12 @@
+---
+name: "Timed CV Test"
+description:
+  Races CV wait timeouts against cv_signal across cpus.
+tags: [synch, cvs, timeouts, kleaks]
+depends: [boot, semaphores, locks, cvs]
+sys161:
+  cpus: 8
+---
+khu
+tmt3
+khu
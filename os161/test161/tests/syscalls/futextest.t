@@ -0,0 +1,11 @@
+---
+name: "Futex Test"
+description: >
+  Tests the futex syscall's error and timeout behavior and the libc
+  mutex and semaphore built on it.
+tags: [futex,syscalls]
+depends: [console]
+sys161:
+  ram: 512K
+---
+p /testbin/futextest
@@ -0,0 +1,11 @@
+---
+name: "TLB Shootdown Test"
+description:
+  Floods every cpu with batched TLB shootdowns and checks that each
+  one completes.
+tags: [threads]
+depends: [boot]
+sys161:
+  cpus: 8
+---
+tlbt1
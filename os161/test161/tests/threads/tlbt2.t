@@ -0,0 +1,11 @@
+---
+name: "Heap Shrink Shootdown Test"
+description:
+  Shrinks and regrows a heap while threads on other cpus keep reading
+  it, and checks that none of them sees memory after it's freed.
+tags: [threads]
+depends: [boot]
+sys161:
+  cpus: 8
+---
+tlbt2
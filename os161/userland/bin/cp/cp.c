@@ -27,36 +27,34 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
  * cp - copy a file.
  * Usage: cp oldfile newfile
+ *
+ * If the filesystem can tell us where the holes in the old file are
+ * (with the FIOSEEKDATA and FIOSEEKHOLE ioctls) we copy only the data
+ * and leave the holes as holes in the new file. Otherwise we just
+ * copy everything.
  */
 
+static char buf[4096];
 
-/* Copy one file to another. */
+/*
+ * Copy bytes from FROMFD to TOFD at their current positions, stopping
+ * after LEN bytes or at EOF if LEN is negative.
+ */
 static
 void
-copy(const char *from, const char *to)
+copydata(int fromfd, int tofd, off_t len, const char *from, const char *to)
 {
-	int fromfd;
-	int tofd;
-	char buf[1024];
-	int len, wr, wrtot;
-
-	/*
-	 * Open the files, and give up if they won't open
-	 */
-	fromfd = open(from, O_RDONLY);
-	if (fromfd<0) {
-		err(1, "%s", from);
-	}
-	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
-	if (tofd<0) {
-		err(1, "%s", to);
-	}
+	size_t want;
+	int rd, wr, wrtot;
 
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
@@ -64,26 +62,114 @@ copy(const char *from, const char *to)
 	 * We may read less than we asked for, though, in various cases
 	 * for various reasons.
 	 */
-	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
+	while (len != 0) {
+		want = sizeof(buf);
+		if (len > 0 && len < (off_t)want) {
+			want = len;
+		}
+		rd = read(fromfd, buf, want);
+		if (rd < 0) {
+			err(1, "%s", from);
+		}
+		if (rd == 0) {
+			break;
+		}
+
 		/*
 		 * Likewise, we may actually write less than we attempted
 		 * to. So loop until we're done.
 		 */
 		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(tofd, buf+wrtot, len-wrtot);
+		while (wrtot < rd) {
+			wr = write(tofd, buf+wrtot, rd-wrtot);
 			if (wr<0) {
 				err(1, "%s", to);
 			}
 			wrtot += wr;
 		}
+		if (len > 0) {
+			len -= rd;
+		}
+	}
+}
+
+/*
+ * Copy only the data regions of FROMFD, seeking over the holes.
+ * Returns -1 without having done anything if the filesystem doesn't
+ * support finding holes.
+ */
+static
+int
+copysparse(int fromfd, int tofd, const char *from, const char *to)
+{
+	struct stat st;
+	off_t data, hole;
+
+	if (fstat(fromfd, &st) < 0) {
+		return -1;
+	}
+
+	data = 0;
+	if (ioctl(fromfd, FIOSEEKDATA, &data) < 0) {
+		if (errno != ENXIO) {
+			return -1;
+		}
+		/* Empty, or nothing but holes */
+		data = st.st_size;
 	}
+
+	while (data < st.st_size) {
+		hole = data;
+		if (ioctl(fromfd, FIOSEEKHOLE, &hole) < 0) {
+			err(1, "%s: FIOSEEKHOLE", from);
+		}
+		if (lseek(fromfd, data, SEEK_SET) < 0) {
+			err(1, "%s: lseek", from);
+		}
+		if (lseek(tofd, data, SEEK_SET) < 0) {
+			err(1, "%s: lseek", to);
+		}
+		copydata(fromfd, tofd, hole - data, from, to);
+
+		data = hole;
+		if (ioctl(fromfd, FIOSEEKDATA, &data) < 0) {
+			if (errno != ENXIO) {
+				err(1, "%s: FIOSEEKDATA", from);
+			}
+			break;
+		}
+	}
+
+	/* Make the new file the right size if it ends in a hole. */
+	if (ftruncate(tofd, st.st_size) < 0) {
+		err(1, "%s: ftruncate", to);
+	}
+	return 0;
+}
+
+/* Copy one file to another. */
+static
+void
+copy(const char *from, const char *to)
+{
+	int fromfd;
+	int tofd;
+
 	/*
-	 * If we got a read error, print it and exit.
+	 * Open the files, and give up if they won't open
 	 */
-	if (len<0) {
+	fromfd = open(from, O_RDONLY);
+	if (fromfd<0) {
 		err(1, "%s", from);
 	}
+	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
+	if (tofd<0) {
+		err(1, "%s", to);
+	}
+
+	if (copysparse(fromfd, tofd, from, to) < 0) {
+		copydata(fromfd, tofd, -1, from, to);
+	}
 
 	if (close(fromfd) < 0) {
 		err(1, "%s: close", from);
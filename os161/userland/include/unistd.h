@@ -39,6 +39,7 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
@@ -148,8 +149,10 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+int futex(volatile int *addr, int op, int val, unsigned timeout_ms);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
+/* getrusage, getrlimit, setrlimit - see sys/resource.h */
 
 /*
  * These are not themselves system calls, but wrapper routines in libc.
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _USYNC_H_
+#define _USYNC_H_
+
+/*
+ * User-level mutexes and semaphores.
+ *
+ * These live entirely in user memory and use atomic instructions for
+ * the uncontended cases; they only make a system call (futex) when a
+ * thread actually has to sleep, or when there is a sleeper to wake.
+ * Because the kernel matches sleepers by physical address, an object
+ * placed in memory shared between processes works across them too.
+ *
+ * Both may be set up statically with the INITIALIZER macros or with
+ * the init functions. There's nothing to destroy.
+ *
+ * umutex_trylock and usema_tryP return 0 on success and -1 (without
+ * sleeping) if the mutex is held or the count is zero.
+ */
+
+struct umutex {
+	volatile int um_state;	/* 0 free, 1 held, 2 held w/ sleepers */
+};
+
+struct usema {
+	volatile int us_count;
+	volatile int us_sleepers;
+};
+
+#define UMUTEX_INITIALIZER	{ 0 }
+#define USEMA_INITIALIZER(n)	{ (n), 0 }
+
+void umutex_init(struct umutex *mx);
+void umutex_lock(struct umutex *mx);
+int umutex_trylock(struct umutex *mx);
+void umutex_unlock(struct umutex *mx);
+
+void usema_init(struct usema *sem, unsigned count);
+void usema_P(struct usema *sem);
+int usema_tryP(struct usema *sem);
+void usema_V(struct usema *sem);
+
+#endif /* _USYNC_H_ */
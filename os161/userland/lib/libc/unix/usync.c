@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <usync.h>
+
+/*
+ * User-level mutexes and semaphores on top of futex().
+ *
+ * The mutex is the usual three-state one: 0 is unlocked, 1 is locked
+ * with nobody waiting, and 2 is locked with (possibly) somebody
+ * waiting. Lock and unlock only call into the kernel from state 2,
+ * so an uncontended lock/unlock pair is two atomic operations.
+ *
+ * The semaphore keeps its count in us_count and a count of threads
+ * that are about to sleep or are sleeping in us_sleepers. V only
+ * calls FUTEX_WAKE when us_sleepers is nonzero. A P that registers
+ * itself after V looked at us_sleepers is not lost: by then the
+ * count is nonzero, so its FUTEX_WAIT on a zero count fails at once
+ * and it goes around again.
+ */
+
+/* in arch/<machine>/atomic-<machine>.S */
+int __usync_cas(volatile int *p, int old, int new);
+
+static
+int
+usync_swap(volatile int *p, int new)
+{
+	int old;
+
+	do {
+		old = *p;
+	} while (__usync_cas(p, old, new) != old);
+	return old;
+}
+
+static
+int
+usync_add(volatile int *p, int delta)
+{
+	int old;
+
+	do {
+		old = *p;
+	} while (__usync_cas(p, old, old + delta) != old);
+	return old;
+}
+
+////////////////////////////////////////////////////////////
+// mutex
+
+void
+umutex_init(struct umutex *mx)
+{
+	mx->um_state = 0;
+}
+
+int
+umutex_trylock(struct umutex *mx)
+{
+	return __usync_cas(&mx->um_state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+umutex_lock(struct umutex *mx)
+{
+	int c;
+
+	c = __usync_cas(&mx->um_state, 0, 1);
+	if (c == 0) {
+		return;
+	}
+
+	/*
+	 * Contended. Mark the mutex as having sleepers and wait until
+	 * we're the one who takes it from 0. Since we can't tell
+	 * whether anyone else is still asleep, we take it in state 2;
+	 * at worst that costs one unneeded wakeup at unlock time.
+	 */
+	if (c != 2) {
+		c = usync_swap(&mx->um_state, 2);
+	}
+	while (c != 0) {
+		/* EAGAIN here just means the state changed; recheck. */
+		futex(&mx->um_state, FUTEX_WAIT, 2, 0);
+		c = usync_swap(&mx->um_state, 2);
+	}
+}
+
+void
+umutex_unlock(struct umutex *mx)
+{
+	if (usync_swap(&mx->um_state, 0) == 2) {
+		futex(&mx->um_state, FUTEX_WAKE, 1, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// semaphore
+
+void
+usema_init(struct usema *sem, unsigned count)
+{
+	sem->us_count = count;
+	sem->us_sleepers = 0;
+}
+
+int
+usema_tryP(struct usema *sem)
+{
+	int c;
+
+	while ((c = sem->us_count) > 0) {
+		if (__usync_cas(&sem->us_count, c, c - 1) == c) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void
+usema_P(struct usema *sem)
+{
+	while (usema_tryP(sem) < 0) {
+		usync_add(&sem->us_sleepers, 1);
+		futex(&sem->us_count, FUTEX_WAIT, 0, 0);
+		usync_add(&sem->us_sleepers, -1);
+	}
+}
+
+void
+usema_V(struct usema *sem)
+{
+	usync_add(&sem->us_count, 1);
+	if (sem->us_sleepers > 0) {
+		futex(&sem->us_count, FUTEX_WAKE, 1, 0);
+	}
+}
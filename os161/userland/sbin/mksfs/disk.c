@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
@@ -50,6 +51,18 @@
 static int fd=-1;
 static uint32_t nblocks;
 
+/*
+ * Optional read cache (see diskcache()). The disk is divided into
+ * chunks of CACHECHUNK blocks and a miss reads the whole chunk in one
+ * go. The cache is direct-mapped: chunk N lives in slot N % ncache.
+ * cachetags[slot] is the chunk number plus one, or 0 if empty.
+ */
+#define CACHECHUNK 64
+
+static char *cachedata;
+static uint32_t *cachetags;
+static unsigned ncache;
+
 /*
  * Open a disk. If we're built for the host OS, check that it's a
  * System/161 disk image, and then ignore the header block.
@@ -126,12 +139,22 @@ diskwrite(const void *data, uint32_t block)
 
 	assert(fd>=0);
 
+	if (ncache > 0) {
+		unsigned slot = (block / CACHECHUNK) % ncache;
+
+		if (cachetags[slot] == block / CACHECHUNK + 1) {
+			memcpy(cachedata + ((size_t)slot * CACHECHUNK +
+					    block % CACHECHUNK) * BLOCKSIZE,
+			       data, BLOCKSIZE);
+		}
+	}
+
 #ifdef HOST
 	// skip over disk file header
 	block++;
 #endif
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	if (lseek(fd, (off_t)block*BLOCKSIZE, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
@@ -151,28 +174,74 @@ diskwrite(const void *data, uint32_t block)
 }
 
 /*
- * Read a block.
+ * Write COUNT consecutive blocks starting at BLOCK, in one go.
  */
 void
-diskread(void *data, uint32_t block)
+diskwriterun(const void *data, uint32_t block, uint32_t count)
 {
-	char *cdata = data;
-	uint32_t tot=0;
-	int len;
+	const char *cdata = data;
+	size_t tot=0, want;
+	ssize_t len;
+	uint32_t i;
 
 	assert(fd>=0);
 
+	if (ncache > 0) {
+		/* Not worth being clever; the cache is for sfsck. */
+		for (i=0; i<count; i++) {
+			diskwrite(cdata + (size_t)i * BLOCKSIZE, block + i);
+		}
+		return;
+	}
+
 #ifdef HOST
 	// skip over disk file header
 	block++;
 #endif
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	if (lseek(fd, (off_t)block*BLOCKSIZE, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	want = (size_t)count * BLOCKSIZE;
+	while (tot < want) {
+		len = write(fd, cdata + tot, want - tot);
+		if (len < 0) {
+			if (errno==EINTR || errno==EAGAIN) {
+				continue;
+			}
+			err(1, "write");
+		}
+		if (len==0) {
+			err(1, "write returned 0?");
+		}
+		tot += len;
+	}
+}
+
+/*
+ * Read COUNT blocks starting at BLOCK.
+ */
+static
+void
+doread(void *data, uint32_t block, uint32_t count)
+{
+	char *cdata = data;
+	size_t tot=0, want;
+	ssize_t len;
+
+#ifdef HOST
+	// skip over disk file header
+	block++;
+#endif
+
+	if (lseek(fd, (off_t)block*BLOCKSIZE, SEEK_SET)<0) {
+		err(1, "lseek");
+	}
+
+	want = (size_t)count * BLOCKSIZE;
+	while (tot < want) {
+		len = read(fd, cdata + tot, want - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -186,6 +255,74 @@ diskread(void *data, uint32_t block)
 	}
 }
 
+/*
+ * Read a block.
+ */
+void
+diskread(void *data, uint32_t block)
+{
+	uint32_t chunk, first, count;
+	unsigned slot;
+	char *cdata;
+
+	assert(fd>=0);
+
+	if (ncache == 0 || block >= nblocks) {
+		doread(data, block, 1);
+		return;
+	}
+
+	chunk = block / CACHECHUNK;
+	slot = chunk % ncache;
+	cdata = cachedata + (size_t)slot * CACHECHUNK * BLOCKSIZE;
+
+	if (cachetags[slot] != chunk + 1) {
+		first = chunk * CACHECHUNK;
+		count = CACHECHUNK;
+		if (count > nblocks - first) {
+			count = nblocks - first;
+		}
+		doread(cdata, first, count);
+		cachetags[slot] = chunk + 1;
+	}
+
+	memcpy(data, cdata + (size_t)(block % CACHECHUNK) * BLOCKSIZE,
+	       BLOCKSIZE);
+}
+
+/*
+ * Turn on the read cache, using about KBYTES of memory. Programs that
+ * read the disk a block at a time in roughly ascending order (sfsck)
+ * then do one large read per CACHECHUNK blocks instead of one per
+ * block. Writes go through to the disk.
+ */
+void
+diskcache(unsigned kbytes)
+{
+	unsigned i;
+
+	assert(ncache == 0);
+
+	ncache = kbytes * 1024 / (CACHECHUNK * BLOCKSIZE);
+	if (ncache == 0) {
+		return;
+	}
+	cachedata = malloc((size_t)ncache * CACHECHUNK * BLOCKSIZE);
+	cachetags = malloc(ncache * sizeof(cachetags[0]));
+	if (cachedata == NULL || cachetags == NULL) {
+		/* not fatal; just run without */
+		free(cachedata);
+		free(cachetags);
+		cachedata = NULL;
+		cachetags = NULL;
+		ncache = 0;
+		return;
+	}
+	for (i=0; i<ncache; i++) {
+		cachetags[i] = 0;
+	}
+}
+
 /*
  * Close the disk.
  */
@@ -197,4 +334,10 @@ closedisk(void)
 		err(1, "close");
 	}
 	fd = -1;
+
+	free(cachedata);
+	free(cachetags);
+	cachedata = NULL;
+	cachetags = NULL;
+	ncache = 0;
 }
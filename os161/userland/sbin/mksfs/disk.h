@@ -33,6 +33,10 @@ uint32_t diskblocksize(void);
 uint32_t diskblocks(void);
 
 void diskwrite(const void *data, uint32_t block);
+void diskwriterun(const void *data, uint32_t block, uint32_t count);
 void diskread(void *data, uint32_t block);
 
+/* Cache reads, in memory of about KBYTES; call after opendisk. */
+void diskcache(unsigned kbytes);
+
 void closedisk(void);
@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -43,6 +44,9 @@
 #include <netinet/in.h> // for arpa/inet.h
 #include <arpa/inet.h>  // for ntohl
 #include "hostcompat.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
 #define SWAP64(x) ntohll(x)
 #define SWAP32(x) ntohl(x)
 #define SWAP16(x) ntohs(x)
@@ -58,11 +62,22 @@
 #include "disk.h"
 
 /* Maximum size of freemap we support */
-#define MAXFREEMAPBLOCKS 32
+#define MAXFREEMAPBLOCKS 256
+
+/* Blocks collected by putblock() before writing them out */
+#define RUNBLOCKS 256
+
+/* The journal gets this fraction of the volume, up to a limit */
+#define JOURNALFRACTION 32
+#define MAXJOURNALBLOCKS 512
 
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
 
+/* Pending run of consecutive blocks for putblock() */
+static char runbuf[RUNBLOCKS * SFS_BLOCKSIZE];
+static uint32_t runstart, runcount;
+
 /*
  * Assert that the on-disk data structures are correctly sized.
  */
@@ -73,6 +88,7 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
 }
 
 /*
@@ -89,6 +105,69 @@ allocblock(uint32_t block)
 	freemapbuf[mapbyte] |= mask;
 }
 
+/*
+ * Write out the pending run of blocks, if any.
+ */
+static
+void
+flushrun(void)
+{
+	if (runcount > 0) {
+		diskwriterun(runbuf, runstart, runcount);
+		runcount = 0;
+	}
+}
+
+/*
+ * Write a block. Consecutive blocks are collected and written with
+ * one call; anything else flushes what's been collected. Call
+ * flushrun() before closing the disk.
+ */
+static
+void
+putblock(const void *data, uint32_t block)
+{
+	if (runcount > 0 &&
+	    (block != runstart + runcount || runcount == RUNBLOCKS)) {
+		flushrun();
+	}
+	if (runcount == 0) {
+		runstart = block;
+	}
+	memcpy(runbuf + runcount * SFS_BLOCKSIZE, data, SFS_BLOCKSIZE);
+	runcount++;
+}
+
+/*
+ * Choose the journal size. Volumes too small for a useful journal
+ * don't get one.
+ */
+static
+uint32_t
+journalsize(uint32_t fsblocks)
+{
+	uint32_t jblocks;
+
+	jblocks = fsblocks / JOURNALFRACTION;
+	if (jblocks > MAXJOURNALBLOCKS) {
+		jblocks = MAXJOURNALBLOCKS;
+	}
+	if (jblocks < SFS_JOURNAL_MINBLOCKS) {
+		jblocks = 0;
+	}
+	return jblocks;
+}
+
+/*
+ * The journal goes right after the freemap.
+ */
+static
+uint32_t
+journalstart(uint32_t fsblocks)
+{
+	return SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+}
+
 /*
  * Initialize the free block bitmap.
  */
@@ -114,6 +193,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* and so must the journal */
+	for (i=0; i<journalsize(fsblocks); i++) {
+		allocblock(journalstart(fsblocks) + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -140,6 +224,10 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	if (journalsize(nblocks) > 0) {
+		sb.sb_journalstart = SWAP32(journalstart(nblocks));
+		sb.sb_journalblocks = SWAP32(journalsize(nblocks));
+	}
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -164,6 +252,38 @@ writefreemap(uint32_t fsblocks)
 	}
 }
 
+/*
+ * Write out an empty journal: a header saying the log starts at the
+ * beginning, and zeros, so nothing left on the disk looks like a
+ * transaction.
+ */
+static
+void
+writejournal(uint32_t fsblocks)
+{
+	struct sfs_jheader jh;
+	char zeros[SFS_BLOCKSIZE];
+	uint32_t i, jstart, jblocks;
+
+	jstart = journalstart(fsblocks);
+	jblocks = journalsize(fsblocks);
+	if (jblocks == 0) {
+		return;
+	}
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JOURNAL_MAGIC);
+	jh.jh_tail = SWAP32(0);
+	jh.jh_tailseq = SWAP32(1);
+	diskwrite(&jh, jstart);
+
+	bzero((void *)zeros, sizeof(zeros));
+	for (i=1; i<jblocks; i++) {
+		putblock(zeros, jstart + i);
+	}
+	flushrun();
+}
+
 /*
  * Write out the root directory inode.
  */
@@ -183,6 +303,337 @@ writerootdir(void)
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
 }
 
+#ifdef HOST
+
+/*
+ * Building a volume from a host directory tree.
+ *
+ * First the tree is read into memory (scannode), then every file and
+ * directory is given its blocks in one pass over the tree in preorder
+ * (layoutnode): the inode, then the data blocks, then the indirect
+ * block if there is one, all consecutive. Then the blocks are
+ * written in the same order (writenode), which makes the writes one
+ * sequential stream, collected into large writes by putblock().
+ *
+ * Only regular files and directories are copied. Host hard links
+ * become separate files.
+ */
+
+struct node {
+	char *name;			/* name in parent directory */
+	char *path;			/* host path */
+	int isdir;
+	uint32_t size;			/* file or directory size in bytes */
+	uint32_t ino;			/* inode block */
+	uint32_t firstdata;		/* first data block */
+	uint32_t ndata;			/* number of data blocks */
+	uint32_t indirect;		/* indirect block, or 0 */
+	uint32_t nsubdirs;		/* directories only */
+	struct node *parent;
+	struct node **kids;		/* directories only */
+	unsigned nkids;
+};
+
+/* Largest file SFS can represent, in blocks */
+#define MAXFILEBLOCKS (SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB)
+
+/* Next block to hand out, and the volume size */
+static uint32_t nextblock, totalblocks;
+
+static
+void *
+xmalloc(size_t len)
+{
+	void *ret;
+
+	ret = malloc(len);
+	if (ret == NULL) {
+		errx(1, "Out of memory");
+	}
+	return ret;
+}
+
+static
+char *
+xstrdup(const char *str)
+{
+	return strcpy(xmalloc(strlen(str) + 1), str);
+}
+
+static
+int
+nodecmp(const void *av, const void *bv)
+{
+	const struct node *const *a = av;
+	const struct node *const *b = bv;
+
+	return strcmp((*a)->name, (*b)->name);
+}
+
+/*
+ * Read the host file or directory PATH (which is called NAME) into
+ * a node. Returns NULL for things we don't copy.
+ */
+static
+struct node *
+scannode(const char *path, const char *name, struct node *parent)
+{
+	struct stat st;
+	struct node *n;
+	DIR *dir;
+	struct dirent *de;
+	struct node *kid;
+	char *kidpath;
+	unsigned maxkids;
+
+	if (lstat(path, &st) < 0) {
+		err(1, "%s", path);
+	}
+	if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+		warnx("%s: Not a regular file or directory; skipped", path);
+		return NULL;
+	}
+	if (strlen(name) >= SFS_NAMELEN) {
+		errx(1, "%s: Name too long for SFS", path);
+	}
+
+	n = xmalloc(sizeof(*n));
+	n->name = xstrdup(name);
+	n->path = xstrdup(path);
+	n->isdir = S_ISDIR(st.st_mode);
+	n->ino = n->firstdata = n->ndata = n->indirect = 0;
+	n->nsubdirs = 0;
+	n->parent = parent;
+	n->kids = NULL;
+	n->nkids = 0;
+
+	if (!n->isdir) {
+		if ((uint64_t)st.st_size >
+		    (uint64_t)MAXFILEBLOCKS * SFS_BLOCKSIZE) {
+			errx(1, "%s: Too large for SFS", path);
+		}
+		n->size = st.st_size;
+		return n;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		err(1, "%s", path);
+	}
+	maxkids = 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		kidpath = xmalloc(strlen(path) + strlen(de->d_name) + 2);
+		sprintf(kidpath, "%s/%s", path, de->d_name);
+		kid = scannode(kidpath, de->d_name, n);
+		free(kidpath);
+		if (kid == NULL) {
+			continue;
+		}
+		if (n->nkids == maxkids) {
+			maxkids = maxkids ? maxkids * 2 : 16;
+			n->kids = realloc(n->kids, maxkids * sizeof(n->kids[0]));
+			if (n->kids == NULL) {
+				errx(1, "Out of memory");
+			}
+		}
+		n->kids[n->nkids++] = kid;
+		if (kid->isdir) {
+			n->nsubdirs++;
+		}
+	}
+	closedir(dir);
+
+	/* Sort the entries so the image doesn't depend on host order. */
+	qsort(n->kids, n->nkids, sizeof(n->kids[0]), nodecmp);
+
+	/* . and .. plus the entries */
+	if ((uint64_t)(n->nkids + 2) * sizeof(struct sfs_direntry) >
+	    (uint64_t)MAXFILEBLOCKS * SFS_BLOCKSIZE) {
+		errx(1, "%s: Too many entries for an SFS directory", path);
+	}
+	n->size = (n->nkids + 2) * sizeof(struct sfs_direntry);
+	return n;
+}
+
+/*
+ * Hand out the next free block.
+ */
+static
+uint32_t
+getblock(void)
+{
+	if (nextblock >= totalblocks) {
+		errx(1, "Volume too small for the files given");
+	}
+	allocblock(nextblock);
+	return nextblock++;
+}
+
+/*
+ * Assign blocks to N and everything under it.
+ */
+static
+void
+layoutnode(struct node *n)
+{
+	unsigned i;
+
+	if (n->parent == NULL) {
+		/* the root directory's inode is in a fixed place */
+		n->ino = SFS_ROOTDIR_INO;
+	}
+	else {
+		n->ino = getblock();
+	}
+
+	n->ndata = (n->size + SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE;
+	for (i=0; i<n->ndata; i++) {
+		if (i == 0) {
+			n->firstdata = getblock();
+		}
+		else {
+			getblock();
+		}
+	}
+	if (n->ndata > SFS_NDIRECT) {
+		n->indirect = getblock();
+	}
+
+	for (i=0; i<n->nkids; i++) {
+		layoutnode(n->kids[i]);
+	}
+}
+
+/*
+ * Fill in a directory entry.
+ */
+static
+void
+setdirentry(struct sfs_direntry *sfd, uint32_t ino, const char *name)
+{
+	bzero((void *)sfd, sizeof(*sfd));
+	sfd->sfd_ino = SWAP32(ino);
+	strcpy(sfd->sfd_name, name);
+}
+
+/*
+ * Write out N (its inode, data, and indirect block) and then
+ * everything under it.
+ */
+static
+void
+writenode(struct node *n)
+{
+	struct sfs_dinode sfi;
+	uint32_t indir[SFS_DBPERIDB];
+	union {
+		char data[SFS_BLOCKSIZE];
+		struct sfs_direntry ents[SFS_BLOCKSIZE /
+					 sizeof(struct sfs_direntry)];
+	} buf;
+	const unsigned perblock = SFS_BLOCKSIZE / sizeof(struct sfs_direntry);
+	FILE *f = NULL;
+	size_t len;
+	unsigned i, j, ent;
+
+	bzero((void *)&sfi, sizeof(sfi));
+	sfi.sfi_size = SWAP32(n->size);
+	sfi.sfi_type = SWAP16(n->isdir ? SFS_TYPE_DIR : SFS_TYPE_FILE);
+	sfi.sfi_linkcount = SWAP16(n->isdir ? 2 + n->nsubdirs : 1);
+	bzero((void *)indir, sizeof(indir));
+	for (i=0; i<n->ndata; i++) {
+		if (i < SFS_NDIRECT) {
+			sfi.sfi_direct[i] = SWAP32(n->firstdata + i);
+		}
+		else {
+			indir[i - SFS_NDIRECT] = SWAP32(n->firstdata + i);
+		}
+	}
+	sfi.sfi_indirect = SWAP32(n->indirect);
+	putblock(&sfi, n->ino);
+
+	if (!n->isdir && n->ndata > 0) {
+		f = fopen(n->path, "rb");
+		if (f == NULL) {
+			err(1, "%s", n->path);
+		}
+	}
+
+	for (i=0; i<n->ndata; i++) {
+		bzero((void *)buf.data, sizeof(buf.data));
+		if (n->isdir) {
+			for (j=0; j<perblock; j++) {
+				ent = i * perblock + j;
+				if (ent == 0) {
+					setdirentry(&buf.ents[j], n->ino, ".");
+				}
+				else if (ent == 1) {
+					setdirentry(&buf.ents[j],
+						    n->parent ? n->parent->ino
+						    : n->ino, "..");
+				}
+				else if (ent - 2 < n->nkids) {
+					setdirentry(&buf.ents[j],
+						    n->kids[ent-2]->ino,
+						    n->kids[ent-2]->name);
+				}
+			}
+		}
+		else {
+			len = fread(buf.data, 1, sizeof(buf.data), f);
+			if (len < sizeof(buf.data) &&
+			    (size_t)i * SFS_BLOCKSIZE + len < n->size) {
+				errx(1, "%s: File changed while reading it",
+				     n->path);
+			}
+		}
+		putblock(buf.data, n->firstdata + i);
+	}
+
+	if (f != NULL) {
+		fclose(f);
+	}
+
+	if (n->indirect != 0) {
+		putblock(indir, n->indirect);
+	}
+
+	for (i=0; i<n->nkids; i++) {
+		writenode(n->kids[i]);
+	}
+}
+
+/*
+ * Copy the host directory tree at PATH onto the volume as its root
+ * directory.
+ */
+static
+void
+writetree(const char *path, uint32_t fsblocks)
+{
+	struct node *root;
+	uint32_t jblocks;
+
+	root = scannode(path, "", NULL);
+	if (root == NULL || !root->isdir) {
+		errx(1, "%s: Not a directory", path);
+	}
+
+	jblocks = journalsize(fsblocks);
+	nextblock = jblocks > 0 ? journalstart(fsblocks) + jblocks
+		: SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+	totalblocks = fsblocks;
+
+	layoutnode(root);
+	writenode(root);
+	flushrun();
+}
+
+#endif /* HOST */
+
 /*
  * Main.
  */
@@ -196,9 +647,15 @@ main(int argc, char **argv)
 	hostcompat_init(argc, argv);
 #endif
 
+#ifdef HOST
+	if (argc!=3 && argc!=4) {
+		errx(1, "Usage: mksfs device/diskfile volume-name [hostdir]");
+	}
+#else
 	if (argc!=3) {
 		errx(1, "Usage: mksfs device/diskfile volume-name");
 	}
+#endif
 
 	check();
 
@@ -231,8 +688,18 @@ main(int argc, char **argv)
 	/* Write out the on-disk structures */
 	initfreemap(size);
 	writesuper(volname, size);
-	writefreemap(size);
+	writejournal(size);
+#ifdef HOST
+	if (argc == 4) {
+		writetree(argv[3], size);
+	}
+	else {
+		writerootdir();
+	}
+#else
 	writerootdir();
+#endif
+	writefreemap(size);
 
 	closedisk();
 
@@ -56,7 +56,7 @@ void
 freemap_setup(void)
 {
 	size_t i, mapbytes;
-	uint32_t fsblocks, mapblocks;
+	uint32_t fsblocks, mapblocks, jstart, jblocks;
 
 	fsblocks = sb_totalblocks();
 	mapblocks = sb_freemapblocks();
@@ -78,6 +78,13 @@ freemap_setup(void)
 	for (i=0; i < mapblocks; i++) {
 		freemap_blockinuse(SFS_FREEMAP_START+i, B_FREEMAPBLOCK, i);
 	}
+
+	/* And the journal, if there is one */
+	jstart = sb_journalstart();
+	jblocks = sb_journalblocks();
+	for (i=0; i < jblocks; i++) {
+		freemap_blockinuse(jstart+i, B_JOURNAL, i);
+	}
 }
 
 /*
@@ -95,6 +102,10 @@ blockusagestr(blockusage_t how, uint32_t howdesc)
 		snprintf(rv, sizeof(rv), "freemap block %lu",
 			 (unsigned long) howdesc);
 		break;
+	    case B_JOURNAL:
+		snprintf(rv, sizeof(rv), "journal block %lu",
+			 (unsigned long) howdesc);
+		break;
 	    case B_INODE:
 		snprintf(rv, sizeof(rv), "inode %lu",
 			 (unsigned long) howdesc);
@@ -53,78 +53,79 @@ struct inodeinfo {
 	int type;
 };
 
-/* Table of inodes found. */
+/*
+ * Table of inodes found: an open-addressing hash table keyed on the
+ * inode number, with linear probing. Inode 0 is the superblock, so
+ * ino == 0 marks an empty slot. It's kept at most half full.
+ */
 static struct inodeinfo *inodes = NULL;
-static unsigned ninodes = 0, maxinodes = 0;
-
-/* Whether the table is sorted and can be looked up with binary search. */
-static int inodes_sorted = 0;
+static unsigned ninodes = 0, tablesize = 0;
 
 ////////////////////////////////////////////////////////////
 // inode table ops
 
 /*
- * Add an entry to the inode table, realloc'ing it if needed.
+ * Hash slot to start probing at for an inode number. (Multiplicative
+ * hashing, since tablesize is a power of 2 and inode numbers tend to
+ * cluster.)
  */
 static
-void
-inode_addtable(uint32_t ino, int type)
+unsigned
+inode_hash(uint32_t ino)
 {
-	unsigned newmax;
-
-	assert(ninodes <= maxinodes);
-	if (ninodes == maxinodes) {
-		newmax = maxinodes ? maxinodes * 2 : 4;
-		inodes = dorealloc(inodes, maxinodes * sizeof(inodes[0]),
-				   newmax * sizeof(inodes[0]));
-		maxinodes = newmax;
-	}
-	inodes[ninodes].ino = ino;
-	inodes[ninodes].linkcount = 0;
-	inodes[ninodes].visited = 0;
-	inodes[ninodes].type = type;
-	ninodes++;
-	inodes_sorted = 0;
+	return (ino * 2654435761U) & (tablesize - 1);
 }
 
 /*
- * Compare function for inodes.
+ * Find the slot for an inode: either the slot holding it or the empty
+ * slot where it would go.
  */
 static
-int
-inode_compare(const void *av, const void *bv)
+struct inodeinfo *
+inode_slot(uint32_t ino)
 {
-	const struct inodeinfo *a = av;
-	const struct inodeinfo *b = bv;
+	unsigned i;
 
-	if (a->ino < b->ino) {
-		return -1;
-	}
-	if (a->ino > b->ino) {
-		return 1;
+	assert(ino != 0);
+	assert(ninodes < tablesize);
+
+	i = inode_hash(ino);
+	while (inodes[i].ino != 0 && inodes[i].ino != ino) {
+		i = (i + 1) & (tablesize - 1);
 	}
-	/*
-	 * There should be no duplicates in the table! But C99 makes
-	 * no guarantees about whether the implementation of qsort can
-	 * ask us to compare an element to itself. Assert that this is
-	 * what happened.
-	 */
-	assert(av == bv);
-	return 0;
+	return &inodes[i];
 }
 
 /*
- * After pass1, we sort the inode table for faster access.
+ * Grow the table to NEWSIZE slots and rehash.
  */
+static
 void
-inode_sorttable(void)
+inode_growtable(unsigned newsize)
 {
-	qsort(inodes, ninodes, sizeof(inodes[0]), inode_compare);
-	inodes_sorted = 1;
+	struct inodeinfo *old, *slot;
+	unsigned oldsize, i;
+
+	old = inodes;
+	oldsize = tablesize;
+
+	inodes = domalloc(newsize * sizeof(inodes[0]));
+	tablesize = newsize;
+	for (i=0; i<newsize; i++) {
+		inodes[i].ino = 0;
+	}
+
+	for (i=0; i<oldsize; i++) {
+		if (old[i].ino != 0) {
+			slot = inode_slot(old[i].ino);
+			*slot = old[i];
+		}
+	}
+	free(old);
 }
 
 /*
- * Find an inode by binary search.
+ * Find an inode.
  *
  * This will error out if asked for an inode not in the table; that's
  * not supposed to happen. (This might need to change; if we improve
@@ -136,31 +137,15 @@ static
 struct inodeinfo *
 inode_find(uint32_t ino)
 {
-	unsigned min, max, i;
-
-	assert(inodes_sorted);
-	assert(ninodes > 0);
+	struct inodeinfo *inf = NULL;
 
-	min = 0;
-	max = ninodes;
-	while (1) {
-		assert(min <= max);
-		if (min == max) {
-			errx(EXIT_UNRECOV, "FATAL: inode %u wasn't found in my inode table", ino);
-		}
-		i = min + (max - min)/2;
-		if (inodes[i].ino < ino) {
-			min = i + 1;
-		}
-		else if (inodes[i].ino > ino) {
-			max = i;
-		}
-		else {
-			assert(inodes[i].ino == ino);
-			return &inodes[i];
-		}
+	if (ninodes > 0 && ino != 0) {
+		inf = inode_slot(ino);
 	}
-	/* NOTREACHED */
+	if (inf == NULL || inf->ino == 0) {
+		errx(EXIT_UNRECOV, "FATAL: inode %u wasn't found in my inode table", ino);
+	}
+	return inf;
 }
 
 ////////////////////////////////////////////////////////////
@@ -168,25 +153,28 @@ inode_find(uint32_t ino)
 
 /*
  * Add an inode; returns 1 if we've already seen it.
- *
- * Uses linear search because we only sort the table for faster access
- * after all inodes have been added. In the FUTURE this could be
- * changed to a better data structure.
  */
 int
 inode_add(uint32_t ino, int type)
 {
-	unsigned i;
+	struct inodeinfo *inf;
 
-	for (i=0; i<ninodes; i++) {
-		if (inodes[i].ino==ino) {
-			assert(inodes[i].linkcount == 0);
-			assert(inodes[i].type == type);
-			return 1;
-		}
+	if (2 * (ninodes + 1) > tablesize) {
+		inode_growtable(tablesize ? tablesize * 2 : 64);
 	}
 
-	inode_addtable(ino, type);
+	inf = inode_slot(ino);
+	if (inf->ino == ino) {
+		assert(inf->linkcount == 0);
+		assert(inf->type == type);
+		return 1;
+	}
+
+	inf->ino = ino;
+	inf->linkcount = 0;
+	inf->visited = 0;
+	inf->type = type;
+	ninodes++;
 
 	return 0;
 }
@@ -239,7 +227,11 @@ inode_adjust_filelinks(void)
 	struct sfs_dinode sfi;
 	unsigned i;
 
-	for (i=0; i<ninodes; i++) {
+	for (i=0; i<tablesize; i++) {
+		if (inodes[i].ino == 0) {
+			/* empty slot */
+			continue;
+		}
 		if (inodes[i].type == SFS_TYPE_DIR) {
 			/* directory */
 			continue;
@@ -42,6 +42,9 @@
 #include "passes.h"
 #include "main.h"
 
+/* Memory to spend caching disk reads, in kilobytes. */
+#define SFSCK_CACHEKB 8192
+
 static int badness=0;
 
 /*
@@ -74,6 +77,7 @@ main(int argc, char **argv)
 	}
 
 	opendisk(argv[1]);
+	diskcache(SFSCK_CACHEKB);
 
 	sfs_setup();
 	sb_load();
@@ -85,7 +89,6 @@ main(int argc, char **argv)
 	freemap_check();
 
 	printf("Phase 2 -- check directory tree\n");
-	inode_sorttable();
 	pass2();
 
 	printf("Phase 3 -- check reference counts\n");
@@ -30,12 +30,14 @@
 #include <sys/types.h>	/* for CHAR_BIT */
 #include <limits.h>	/* also for CHAR_BIT */
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <err.h>
 
 #include "compat.h"
 #include <kern/sfs.h>
 
+#include "disk.h"
 #include "utils.h"
 #include "sfs.h"
 #include "sb.h"
@@ -59,6 +61,47 @@ sb_load(void)
 	assert(SFS_FREEMAPBLOCKS(sb.sb_nblocks) > 0);
 }
 
+/*
+ * Check the journal header. If the journal might still hold
+ * committed transactions, stop: checking the volume without them
+ * would "fix" things the journal is about to put right. Replaying is
+ * the kernel's job; mounting the volume does it.
+ */
+static
+void
+sb_checkjournal(void)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	uint32_t i, logblocks;
+
+	sfs_readjheader(sb.sb_journalstart, &jh);
+	logblocks = sb.sb_journalblocks - 1;
+
+	if (jh.jh_magic != SFS_JOURNAL_MAGIC || jh.jh_tail >= logblocks) {
+		warnx("Journal header invalid (fixed)");
+		setbadness(EXIT_RECOV);
+
+		/* Clear the log so nothing stale in it can be replayed. */
+		bzero(&jd, sizeof(jd));
+		for (i=1; i<sb.sb_journalblocks; i++) {
+			diskwrite(&jd, sb.sb_journalstart + i);
+		}
+		bzero(&jh, sizeof(jh));
+		jh.jh_magic = SFS_JOURNAL_MAGIC;
+		jh.jh_tail = 0;
+		jh.jh_tailseq = 1;
+		sfs_writejheader(sb.sb_journalstart, &jh);
+		return;
+	}
+
+	sfs_readjdesc(sb.sb_journalstart + 1 + jh.jh_tail, &jd);
+	if (jd.jd_magic == SFS_JDESC_MAGIC && jd.jd_seq == jh.jh_tailseq) {
+		errx(EXIT_FATAL, "Journal holds unreplayed transactions; "
+		     "mount the volume to replay them first");
+	}
+}
+
 /*
  * Validate the superblock.
  */
@@ -88,11 +131,32 @@ sb_check(void)
 		setbadness(EXIT_RECOV);
 		schanged = 1;
 	}
+	if (sb.sb_journalblocks != 0 &&
+	    (sb.sb_journalblocks < SFS_JOURNAL_MINBLOCKS ||
+	     sb.sb_journalstart < SFS_FREEMAP_START + sb_freemapblocks() ||
+	     sb.sb_journalstart >= sb.sb_nblocks ||
+	     sb.sb_journalblocks > sb.sb_nblocks - sb.sb_journalstart)) {
+		warnx("Journal location invalid (journal removed)");
+		setbadness(EXIT_RECOV);
+		sb.sb_journalstart = 0;
+		sb.sb_journalblocks = 0;
+		schanged = 1;
+	}
+	else if (sb.sb_journalblocks == 0 && sb.sb_journalstart != 0) {
+		warnx("Journal start set with no journal (fixed)");
+		setbadness(EXIT_RECOV);
+		sb.sb_journalstart = 0;
+		schanged = 1;
+	}
 
 	/* Write the superblock back if necessary */
 	if (schanged) {
 		sfs_writesb(SFS_SUPER_BLOCK, &sb);
 	}
+
+	if (sb.sb_journalblocks > 0) {
+		sb_checkjournal();
+	}
 }
 
 /*
@@ -114,6 +178,21 @@ sb_freemapblocks(void)
 	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
 }
 
+/*
+ * Return the journal's first block and size (0 if there's none).
+ */
+uint32_t
+sb_journalstart(void)
+{
+	return sb.sb_journalstart;
+}
+
+uint32_t
+sb_journalblocks(void)
+{
+	return sb.sb_journalblocks;
+}
+
 /*
  * Return the volume name.
  */
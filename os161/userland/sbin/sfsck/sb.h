@@ -46,10 +46,17 @@ uint32_t sb_totalblocks(void);
 /* After the superblock is loaded: return number of freemap blocks. */
 uint32_t sb_freemapblocks(void);
 
+/* After the superblock is loaded: return journal location and size. */
+uint32_t sb_journalstart(void);
+uint32_t sb_journalblocks(void);
+
 /* After the superblock is loaded: return volume name. */
 const char *sb_volname(void);
 
-/* Check the superblock. Must load it first. */
+/*
+ * Check the superblock. Must load it first. Exits if the journal
+ * holds transactions that haven't been replayed.
+ */
 void sb_check(void);
 
 #endif /* SB_H */
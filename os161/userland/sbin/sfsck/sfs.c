@@ -62,6 +62,8 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_journalstart = SWAP32(sb->sb_journalstart);
+	sb->sb_journalblocks = SWAP32(sb->sb_journalblocks);
 }
 
 static
@@ -206,6 +208,40 @@ sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb)
 	swapsb(sb);
 }
 
+/*
+ * journal header and transaction descriptor - blocknum is a disk
+ * block number. Only the fields sfsck looks at are swapped.
+ */
+
+void
+sfs_readjheader(uint32_t blocknum, struct sfs_jheader *jh)
+{
+	diskread(jh, blocknum);
+	jh->jh_magic = SWAP32(jh->jh_magic);
+	jh->jh_tail = SWAP32(jh->jh_tail);
+	jh->jh_tailseq = SWAP32(jh->jh_tailseq);
+}
+
+void
+sfs_writejheader(uint32_t blocknum, struct sfs_jheader *jh)
+{
+	struct sfs_jheader tmp;
+
+	tmp = *jh;
+	tmp.jh_magic = SWAP32(tmp.jh_magic);
+	tmp.jh_tail = SWAP32(tmp.jh_tail);
+	tmp.jh_tailseq = SWAP32(tmp.jh_tailseq);
+	diskwrite(&tmp, blocknum);
+}
+
+void
+sfs_readjdesc(uint32_t blocknum, struct sfs_jdesc *jd)
+{
+	diskread(jd, blocknum);
+	jd->jd_magic = SWAP32(jd->jd_magic);
+	jd->jd_seq = SWAP32(jd->jd_seq);
+}
+
 /*
  * freemap blocks - whichblock is a block number within the free block
  * bitmap.
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * conbench.c
+ *
+ * 	Console output throughput benchmark.
+ *
+ * Usage: conbench [kbytes [writesize]]
+ *
+ * Writes KBYTES kilobytes (default 1024) of text to standard output,
+ * WRITESIZE bytes (default 1024) per write call, then reports how long
+ * it took on standard error. The text is lines of printable characters,
+ * so the output can be eyeballed for drops or reordering.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+
+#define LINELEN   64
+#define MAXWRITE  16384
+
+static char buf[MAXWRITE];
+
+/*
+ * Fill BUF with lines of LINELEN characters (the last one a newline),
+ * so that consecutive writes continue the pattern seamlessly.
+ */
+static
+void
+fillbuf(size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (i % LINELEN == LINELEN - 1) {
+			buf[i] = '\n';
+		}
+		else {
+			buf[i] = 'a' + (i / LINELEN) % 26;
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long kbytes, total, done;
+	size_t writesize, len;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	unsigned long long usecs;
+	ssize_t r;
+
+	kbytes = 1024;
+	writesize = 1024;
+	if (argc > 1) {
+		kbytes = strtoul(argv[1], NULL, 0);
+	}
+	if (argc > 2) {
+		writesize = strtoul(argv[2], NULL, 0);
+	}
+	if (argc > 3 || kbytes == 0 || writesize == 0 ||
+	    writesize > MAXWRITE) {
+		errx(1, "Usage: conbench [kbytes [writesize]] "
+		     "(writesize at most %d)", MAXWRITE);
+	}
+
+	/* Keep every write a whole number of lines if we can. */
+	if (writesize >= LINELEN) {
+		writesize -= writesize % LINELEN;
+	}
+	fillbuf(writesize);
+
+	total = kbytes * 1024;
+	done = 0;
+
+	__time(&startsecs, &startnsecs);
+	while (done < total) {
+		len = writesize;
+		if (len > total - done) {
+			len = total - done;
+		}
+		r = write(STDOUT_FILENO, buf, len);
+		if (r < 0) {
+			err(1, "write");
+		}
+		if (r == 0) {
+			errx(1, "write: short write");
+		}
+		done += r;
+	}
+	__time(&endsecs, &endnsecs);
+
+	usecs = (endsecs - startsecs) * 1000000ULL;
+	usecs += endnsecs / 1000;
+	usecs -= startnsecs / 1000;
+
+	warnx("%lu bytes in %lu writes of %lu: %llu.%06llu seconds, "
+	      "%llu bytes/sec",
+	      done, (done + writesize - 1) / writesize,
+	      (unsigned long)writesize,
+	      usecs / 1000000, usecs % 1000000,
+	      usecs ? done * 1000000ULL / usecs : 0);
+	return 0;
+}
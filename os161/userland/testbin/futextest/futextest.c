@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futextest.c
+ *
+ * 	Tests the futex syscall and the libc mutex and semaphore built
+ * 	on it (<usync.h>).
+ *
+ * Everything here runs in one process and one thread, so it checks the
+ * error and timeout behavior of futex and that the uncontended paths
+ * of the mutex and semaphore leave their words in the right state. It
+ * should work as soon as futex is wired up, without fork or exec.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <err.h>
+#include <usync.h>
+#include <test161/test161.h>
+
+static volatile int word;
+
+static
+void
+check(int ok, const char *what)
+{
+	if (!ok) {
+		errx(1, "FAILED: %s", what);
+	}
+	tprintf("%s: ok\n", what);
+}
+
+static
+void
+futex_errors(void)
+{
+	int ret;
+
+	word = 5;
+
+	ret = futex(&word, FUTEX_WAIT, 6, 0);
+	check(ret == -1 && errno == EAGAIN, "wait on changed value");
+
+	ret = futex(&word, FUTEX_WAKE, 10, 0);
+	check(ret == 0, "wake with no sleepers");
+
+	ret = futex(&word, 12345, 0, 0);
+	check(ret == -1 && errno == EINVAL, "bad op");
+
+	ret = futex((volatile int *)((char *)&word + 1), FUTEX_WAKE, 1, 0);
+	check(ret == -1 && errno == EINVAL, "unaligned address");
+
+	ret = futex(NULL, FUTEX_WAKE, 1, 0);
+	check(ret == -1 && errno == EFAULT, "NULL address");
+
+	ret = futex((volatile int *)0x80000000, FUTEX_WAIT, 0, 0);
+	check(ret == -1 && errno == EFAULT, "kernel address");
+}
+
+static
+void
+futex_timeout(void)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned long elapsed;
+	int ret;
+
+	word = 0;
+	__time(&s0, &ns0);
+	ret = futex(&word, FUTEX_WAIT, 0, 200);
+	__time(&s1, &ns1);
+	check(ret == -1 && errno == ETIMEDOUT, "timed wait expires");
+
+	elapsed = (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	tprintf("200ms wait took %lu ms\n", elapsed);
+	check(elapsed >= 190 && elapsed < 2000, "timed wait duration");
+}
+
+static
+void
+mutex_states(void)
+{
+	struct umutex mx = UMUTEX_INITIALIZER;
+
+	umutex_lock(&mx);
+	check(mx.um_state == 1, "uncontended lock");
+	check(umutex_trylock(&mx) == -1, "trylock of held mutex");
+	umutex_unlock(&mx);
+	check(mx.um_state == 0, "unlock");
+	check(umutex_trylock(&mx) == 0, "trylock of free mutex");
+	umutex_unlock(&mx);
+
+	/* Unlocking with sleepers marked must wake (nobody) and clear. */
+	mx.um_state = 2;
+	umutex_unlock(&mx);
+	check(mx.um_state == 0, "unlock with sleepers marked");
+}
+
+static
+void
+sema_counts(void)
+{
+	struct usema sem = USEMA_INITIALIZER(2);
+
+	usema_P(&sem);
+	usema_P(&sem);
+	check(sem.us_count == 0, "P down to zero");
+	check(usema_tryP(&sem) == -1, "tryP at zero");
+	usema_V(&sem);
+	check(sem.us_count == 1 && sem.us_sleepers == 0, "V");
+	check(usema_tryP(&sem) == 0, "tryP after V");
+	check(sem.us_count == 0, "count after tryP");
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	futex_errors();
+	futex_timeout();
+	mutex_states();
+	sema_counts();
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/futextest");
+	return 0;
+}
@@ -0,0 +1,617 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *      Written by David A. Holland.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * loadgen.c
+ *
+ * Load generator for throughput benchmarking. Runs a number of jobs,
+ * each one an ordinary program, with a given number at most running
+ * at once and arrivals at a given rate, and reports how long jobs
+ * took from arrival to exit (turnaround) and how many finished per
+ * second.
+ *
+ * Usage: loadgen [-n jobs] [-c concurrency] [-r rate] [-f] [-s seed]
+ *                prog [args...] [-- prog [args...]]...
+ *
+ *    -n   number of jobs to run (default 16)
+ *    -c   most jobs to run at once (default 4); a job that arrives
+ *         while that many are running waits, and the wait counts
+ *         toward its turnaround
+ *    -r   arrivals per second; 0 (the default) means each job
+ *         arrives as soon as there's room for it
+ *    -f   space arrivals evenly instead of at random (Poisson
+ *         arrivals, to the nearest millisecond, by default)
+ *    -s   random seed
+ *
+ * The jobs are the programs given, taken in turn, so
+ *
+ *    loadgen -n 12 -r 20 /testbin/hog -- /testbin/matmult -- /bin/cat f
+ *
+ * runs hog, matmult and cat four times each. Each job is started by
+ * a monitor process of its own, which records when the job started
+ * and finished in the file loadgen.results; the report comes from
+ * there once all jobs are done.
+ *
+ * Needs fork, execv, waitpid, and the file calls; pacing arrivals
+ * uses the futex timeout to sleep. waitpid's WNOHANG is used if the
+ * kernel supports it, so that a slot freed by any job is noticed
+ * promptly; otherwise new jobs wait for the oldest one.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define RESULTSFILE "loadgen.results"
+#define MAXPROGS 16
+#define SLOTPOLL 5000	/* us between checks for a free slot */
+
+/* What happened to one job. Times are microseconds since the start. */
+struct jobresult {
+	unsigned jr_prog;		/* index into progs[] */
+	int jr_status;			/* from waitpid; -1 if fork failed */
+	unsigned long jr_arrive;
+	unsigned long jr_start;
+	unsigned long jr_end;
+};
+
+/* The programs to run, each a null-terminated argv. */
+static char **progs[MAXPROGS];
+static unsigned numprogs;
+
+/* Options. */
+static unsigned numjobs = 16;
+static unsigned concurrency = 4;
+static unsigned rate = 0;
+static bool fixedrate = false;
+static unsigned long seed = 0;
+
+/* When the run started. */
+static time_t startsecs;
+static unsigned long startnsecs;
+
+/* Monitor processes running, oldest first, and their job numbers. */
+static pid_t *running;
+static unsigned *runningjob;
+static unsigned numrunning;
+static bool nohang = true;
+
+/* Word to sleep on. Nobody ever wakes it. */
+static volatile int sleepword;
+
+////////////////////////////////////////////////////////////
+// time
+
+static
+unsigned long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (secs - startsecs) * 1000000 + nsecs / 1000
+		- startnsecs / 1000;
+}
+
+/*
+ * Sleep until WHEN, in the futex call's millisecond timeouts.
+ */
+static
+void
+sleepuntil(unsigned long when)
+{
+	unsigned long t;
+
+	while ((t = now()) < when) {
+		futex(&sleepword, FUTEX_WAIT, 0, (when - t + 999) / 1000);
+	}
+}
+
+/*
+ * Time from one arrival to the next.
+ */
+static
+unsigned long
+nextgap(void)
+{
+	unsigned long ms;
+
+	if (rate == 0) {
+		return 0;
+	}
+	if (fixedrate) {
+		return 1000000 / rate;
+	}
+	/*
+	 * Poisson arrivals: each millisecond, one arrives with
+	 * probability rate/1000. That makes the gaps geometric, which
+	 * is as close to exponential as millisecond sleeps can tell.
+	 */
+	ms = 1;
+	while ((unsigned long)random() % 1000 >= rate) {
+		ms++;
+	}
+	return ms * 1000;
+}
+
+////////////////////////////////////////////////////////////
+// results file
+
+static
+void
+createresultsfile(void)
+{
+	int fd;
+
+	fd = open(RESULTSFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", RESULTSFILE);
+	}
+	if (close(fd) == -1) {
+		warn("%s: close", RESULTSFILE);
+	}
+}
+
+static
+void
+putresult(unsigned job, const struct jobresult *jr)
+{
+	ssize_t r;
+	int fd;
+
+	fd = open(RESULTSFILE, O_WRONLY, 0);
+	if (fd < 0) {
+		err(1, "%s", RESULTSFILE);
+	}
+	if (lseek(fd, job * sizeof(*jr), SEEK_SET) == -1) {
+		err(1, "%s: lseek", RESULTSFILE);
+	}
+	r = write(fd, jr, sizeof(*jr));
+	if (r < 0) {
+		err(1, "%s: write", RESULTSFILE);
+	}
+	if ((size_t)r < sizeof(*jr)) {
+		errx(1, "%s: write: Short write", RESULTSFILE);
+	}
+	if (close(fd) == -1) {
+		warn("%s: close", RESULTSFILE);
+	}
+}
+
+static
+void
+getresults(struct jobresult *results)
+{
+	size_t len;
+	ssize_t r;
+	int fd;
+
+	fd = open(RESULTSFILE, O_RDONLY, 0);
+	if (fd < 0) {
+		err(1, "%s", RESULTSFILE);
+	}
+	len = numjobs * sizeof(*results);
+	r = read(fd, results, len);
+	if (r < 0) {
+		err(1, "%s: read", RESULTSFILE);
+	}
+	if ((size_t)r < len) {
+		errx(1, "%s: read: Unexpected EOF", RESULTSFILE);
+	}
+	if (close(fd) == -1) {
+		warn("%s: close", RESULTSFILE);
+	}
+	if (remove(RESULTSFILE) == -1 && errno != ENOSYS) {
+		warn("%s: remove", RESULTSFILE);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// running jobs
+
+/*
+ * Monitor process for one job: run it, wait for it, and write down
+ * what happened.
+ */
+static
+void
+monitor(unsigned job, unsigned long arrive)
+{
+	struct jobresult jr;
+	char **argv;
+	pid_t pid;
+	int status;
+
+	jr.jr_prog = job % numprogs;
+	jr.jr_arrive = arrive;
+	jr.jr_start = now();
+	argv = progs[jr.jr_prog];
+
+	pid = fork();
+	if (pid < 0) {
+		warn("fork");
+		jr.jr_status = -1;
+	}
+	else if (pid == 0) {
+		execv(argv[0], argv);
+		warn("%s", argv[0]);
+		_exit(1);
+	}
+	else {
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		jr.jr_status = status;
+	}
+	jr.jr_end = now();
+
+	putresult(job, &jr);
+	_exit(0);
+}
+
+static
+void
+launch(unsigned job, unsigned long arrive)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		monitor(job, arrive);
+	}
+	running[numrunning] = pid;
+	runningjob[numrunning] = job;
+	numrunning++;
+}
+
+/*
+ * Take a monitor that has exited off the running list.
+ */
+static
+void
+finished(unsigned i, int status)
+{
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "monitor for job %u failed", runningjob[i]);
+	}
+	numrunning--;
+	memmove(&running[i], &running[i+1],
+		(numrunning - i) * sizeof(running[0]));
+	memmove(&runningjob[i], &runningjob[i+1],
+		(numrunning - i) * sizeof(runningjob[0]));
+}
+
+/*
+ * Collect monitors that have finished, if WNOHANG works.
+ */
+static
+void
+reap(void)
+{
+	unsigned i;
+	pid_t r;
+	int status;
+
+	i = 0;
+	while (nohang && i < numrunning) {
+		r = waitpid(running[i], &status, WNOHANG);
+		if (r < 0 && errno == EINVAL) {
+			/* Not supported; we'll have to block instead. */
+			nohang = false;
+			break;
+		}
+		if (r < 0) {
+			err(1, "waitpid");
+		}
+		if (r == 0) {
+			i++;
+			continue;
+		}
+		finished(i, status);
+	}
+}
+
+/*
+ * Wait for the oldest monitor to finish.
+ */
+static
+void
+reapoldest(void)
+{
+	int status;
+
+	if (waitpid(running[0], &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	finished(0, status);
+}
+
+/*
+ * Wait until there's room for another job. With WNOHANG, check every
+ * few milliseconds so a slot is noticed whichever job frees it;
+ * without, all we can do is wait for the oldest.
+ */
+static
+void
+waitforslot(void)
+{
+	reap();
+	while (numrunning == concurrency) {
+		if (nohang) {
+			sleepuntil(now() + SLOTPOLL);
+			reap();
+		}
+		else {
+			reapoldest();
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// report
+
+static
+int
+compareulong(const void *av, const void *bv)
+{
+	unsigned long a = *(const unsigned long *)av;
+	unsigned long b = *(const unsigned long *)bv;
+
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static
+bool
+failed(const struct jobresult *jr)
+{
+	return jr->jr_status == -1 || !WIFEXITED(jr->jr_status) ||
+		WEXITSTATUS(jr->jr_status) != 0;
+}
+
+static
+void
+printms(unsigned long us)
+{
+	printf(" %6lu.%03lu", us / 1000, us % 1000);
+}
+
+/*
+ * One line of the report: turnaround and wait figures for the jobs
+ * running program PROG, or all of them if PROG is numprogs.
+ */
+static
+void
+reportline(const struct jobresult *results, unsigned long *times,
+	   unsigned prog, const char *name)
+{
+	unsigned i, n, fails;
+	unsigned long long turnaround, wait;
+
+	n = fails = 0;
+	turnaround = wait = 0;
+	for (i=0; i<numjobs; i++) {
+		if (prog < numprogs && results[i].jr_prog != prog) {
+			continue;
+		}
+		if (failed(&results[i])) {
+			fails++;
+		}
+		times[n++] = results[i].jr_end - results[i].jr_arrive;
+		turnaround += results[i].jr_end - results[i].jr_arrive;
+		wait += results[i].jr_start - results[i].jr_arrive;
+	}
+	if (n == 0) {
+		return;
+	}
+	qsort(times, n, sizeof(times[0]), compareulong);
+
+	printf("%-16.16s %5u %5u", name, n, fails);
+	printms(wait / n);
+	printms(turnaround / n);
+	printms(times[(n - 1) * 50 / 100]);
+	printms(times[(n - 1) * 90 / 100]);
+	printms(times[(n - 1) * 99 / 100]);
+	printms(times[n - 1]);
+	printf("\n");
+}
+
+static
+void
+report(void)
+{
+	struct jobresult *results;
+	unsigned long *times;
+	unsigned long elapsed;
+	unsigned long long perhundred;
+	const char *name;
+	unsigned i;
+
+	results = malloc(numjobs * sizeof(*results));
+	times = malloc(numjobs * sizeof(*times));
+	if (results == NULL || times == NULL) {
+		err(1, "malloc");
+	}
+	getresults(results);
+
+	elapsed = 0;
+	for (i=0; i<numjobs; i++) {
+		if (failed(&results[i])) {
+			if (results[i].jr_status == -1) {
+				warnx("job %u: could not fork", i);
+			}
+			else if (WIFSIGNALED(results[i].jr_status)) {
+				warnx("job %u: signal %d", i,
+				      WTERMSIG(results[i].jr_status));
+			}
+			else {
+				warnx("job %u: exit %d", i,
+				      WEXITSTATUS(results[i].jr_status));
+			}
+		}
+		if (results[i].jr_end > elapsed) {
+			elapsed = results[i].jr_end;
+		}
+	}
+
+	/* jobs per second, times 100, for two decimal places */
+	perhundred = elapsed == 0 ? 0 :
+		(unsigned long long)numjobs * 100000000 / elapsed;
+	printf("loadgen: %u jobs in", numjobs);
+	printms(elapsed);
+	printf(" ms: %llu.%02llu jobs/s\n", perhundred / 100,
+	       perhundred % 100);
+
+	printf("%-16s %5s %5s %10s %10s %10s %10s %10s %10s\n",
+	       "(ms)", "jobs", "fail", "wait", "mean", "p50", "p90", "p99",
+	       "max");
+	if (numprogs > 1) {
+		for (i=0; i<numprogs; i++) {
+			name = strrchr(progs[i][0], '/');
+			name = name ? name + 1 : progs[i][0];
+			reportline(results, times, i, name);
+		}
+	}
+	reportline(results, times, numprogs, "all");
+
+	free(times);
+	free(results);
+}
+
+////////////////////////////////////////////////////////////
+// main
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: loadgen [-n jobs] [-c concurrency] [-r rate] [-f] "
+	     "[-s seed] prog [args...] [-- prog [args...]]...");
+}
+
+static
+void
+doargs(int argc, char *argv[])
+{
+	int i, j, ch, val;
+
+	for (i=1; i<argc && argv[i][0] == '-'; i++) {
+		ch = argv[i][1];
+		if (ch == 'f' && argv[i][2] == 0) {
+			fixedrate = true;
+			continue;
+		}
+		if (ch != 'n' && ch != 'c' && ch != 'r' && ch != 's') {
+			usage();
+		}
+		if (argv[i][2]) {
+			val = atoi(argv[i]+2);
+		}
+		else {
+			i++;
+			if (i == argc) {
+				errx(1, "Option -%c requires an argument", ch);
+			}
+			val = atoi(argv[i]);
+		}
+		switch (ch) {
+		    case 'n': numjobs = val; break;
+		    case 'c': concurrency = val; break;
+		    case 'r': rate = val; break;
+		    case 's': seed = val; break;
+		}
+	}
+	if (numjobs < 1 || concurrency < 1) {
+		errx(1, "Need at least one job, and one at a time");
+	}
+	if (rate > 1000 && !fixedrate) {
+		errx(1, "Random arrivals go up to 1000 a second; use -f");
+	}
+
+	/* Split the rest at each "--" into programs. */
+	for (j=i; j<=argc; j++) {
+		if (j < argc && strcmp(argv[j], "--") != 0) {
+			continue;
+		}
+		if (j == i) {
+			usage();
+		}
+		if (numprogs == MAXPROGS) {
+			errx(1, "Too many programs (max %d)", MAXPROGS);
+		}
+		progs[numprogs++] = &argv[i];
+		argv[j] = NULL;
+		i = j + 1;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long arrive;
+	unsigned job;
+
+	doargs(argc, argv);
+	srandom(seed);
+
+	running = malloc(concurrency * sizeof(*running));
+	runningjob = malloc(concurrency * sizeof(*runningjob));
+	if (running == NULL || runningjob == NULL) {
+		err(1, "malloc");
+	}
+	createresultsfile();
+
+	__time(&startsecs, &startnsecs);
+	arrive = 0;
+	for (job=0; job<numjobs; job++) {
+		if (job > 0) {
+			arrive += nextgap();
+		}
+		sleepuntil(arrive);
+		waitforslot();
+		launch(job, arrive);
+	}
+	while (numrunning > 0) {
+		reapoldest();
+	}
+
+	report();
+	return 0;
+}